@@ -7,11 +7,18 @@
 
 #include <ArduinoJson.hpp>
 #include <HTTPClient.h>
-#include <sstream>
-#include <string>
+#include <StreamUtils.h>
+#include "ApiConnection.hpp"
 #include "IO/Pump.hpp"
+#include "IO/PumpScheduler.hpp"
+#include "IO/Sensor.hpp"
+#include "JsonArena.hpp"
+#include "Payload.hpp"
+#include "ReadingBuffer.hpp"
+#include "SeriesCodec.hpp"
+#include "TokenCache.hpp"
+#include "WakeProfiler.hpp"
 #include "common.hpp"
-#include "datetime.h"
 
 namespace meltwin {
 
@@ -37,57 +44,79 @@ namespace meltwin {
     INVALID_USER_ID = 520
   };
 
-  enum InternalErrors { SUCCESS = 0, FAILED = 1, WRONG_AUTH = 2, WRONG_TOKEN = 3, OTHER = 4 };
-
-  struct Endpoints {
-    constchar TIME{"http://worldtimeapi.org/api/ip"};
-    constchar LOGIN{"https://meltwin.fr/api/auth/login"};
-    constchar SEND_DATA{"https://meltwin.fr/api/plants/record"};
-    constchar GET_WATERING_CMD{"https://meltwin.fr/api/plants/get_cmd"};
-    constchar WATERING_COMPLETED{"https://meltwin.fr/api/plants/done"};
+  enum InternalErrors {
+    SUCCESS = 0,
+    FAILED = 1,
+    WRONG_AUTH = 2,
+    WRONG_TOKEN = 3,
+    OTHER = 4,
+    INVALID_RESPONSE = 5,
+    REJECTED = 6 // The request went through, but the API refused some of its items
   };
 
-  struct Payload {
-
-    explicit Payload() {}
-    std::string str() { return buffer.str(); }
-
-    template <typename T>
-    void add_data(const std::string& param, const T& value) {
-      if (!buffer.str().empty())
-        buffer << "&";
-      buffer << param << "=" << value;
-    }
+// Define API_LOCAL_SERVER (e.g. "192.168.1.10:8080") to target the stand-in server from tools/mock_api_server.py
+#ifdef API_LOCAL_SERVER
+#define API_ROOT "http://" API_LOCAL_SERVER "/api"
+#else
+#define API_ROOT "https://meltwin.fr/api"
+#endif
 
-  private:
-    std::stringstream buffer;
+  struct Endpoints {
+    constchar LOGIN{API_ROOT "/auth/login"};
+    constchar SEND_SERIES{API_ROOT "/plants/record_series"};
+    constchar GET_WATERING_CMDS{API_ROOT "/plants/get_cmds"};
+    constchar WATERING_COMPLETED_BATCH{API_ROOT "/plants/done_batch"};
   };
 
   struct APICaller {
-
-    inline static InternalErrors authenticate(std::string& token) {
-      HTTPClient client;
-      setup_post_client(client);
-
+    static constexpr size_t SMALL_PAYLOAD_SIZE{256};
+    static constexpr size_t SERIES_PAYLOAD_SIZE{2560}; // Enough for ReadingBuffer::FLUSH_CHUNK readings and a profile
+    static constexpr size_t SERIES_MAX_SENSORS{256};   // Sensor ids are sent on 8 bits
+    static_assert(ReadingBuffer::FLUSH_CHUNK < 256, "The readings count of a series is sent on 8 bits");
+    // Define API_PAYLOAD_CBOR to send CBOR bodies instead of form-urlencoded ones (the mock API server accepts both)
+#ifdef API_PAYLOAD_CBOR
+    static constexpr PayloadFormat PAYLOAD_FORMAT{PayloadFormat::CBOR};
+#else
+    static constexpr PayloadFormat PAYLOAD_FORMAT{PayloadFormat::URLENCODED};
+#endif
+
+    /**
+     * Create the lock of the token cache, once per wake before calls are made from several tasks
+     */
+    static void begin() { token_lock = xSemaphoreCreateMutexStatic(&token_lock_buffer); }
+
+    /**
+     * Log into the API and cache the new token in RTC memory
+     */
+    inline static InternalErrors authenticate() {
       // Make Payload
-      Payload payload;
+      uint8_t buffer[SMALL_PAYLOAD_SIZE];
+      Payload payload(buffer, sizeof(buffer), PAYLOAD_FORMAT);
       payload.add_data("username", "plant01");
       payload.add_data("password", "plt01_access");
-      client.begin(Endpoints::LOGIN);
-      int code = client.POST(String(payload.str().c_str()));
+      HTTPClient* client = APIConnection::open(Endpoints::LOGIN);
+      int code = post(client, payload);
       if (code <= 0) {
-        client.end();
+        APIConnection::release();
         return InternalErrors::FAILED;
       }
 
-      ArduinoJson::JsonDocument doc;
-      ArduinoJson::deserializeJson(doc, client.getString());
-      client.end();
+      ArduinoJson::JsonDocument filter(&JsonArena::instance());
+      error_filter(filter);
+      filter["token"] = true;
+      filter["expires_in"] = true;
+
+      ArduinoJson::JsonDocument doc(&JsonArena::instance());
+      bool parsed = parse_response(*client, doc, filter, "Login");
+      APIConnection::release();
+      if (!parsed)
+        return InternalErrors::INVALID_RESPONSE;
 
       // Process error code
       switch (doc["err_code"].as<int>()) {
       case APIErrors::NO_ERROR:
-        token = std::string(doc["token"].as<const char*>());
+        if (!TokenCache::store(doc["token"].as<const char*>(), doc["expires_in"] | TokenCache::DEFAULT_TTL_S))
+          return InternalErrors::OTHER;
         return InternalErrors::SUCCESS;
       case APIErrors::INVALID_CREDENTIALS:
         return InternalErrors::WRONG_AUTH;
@@ -97,106 +126,225 @@ namespace meltwin {
       }
     }
 
-    inline static InternalErrors sendData(const char* token, unsigned int sensor_id, float value) {
-      HTTPClient client;
-      setup_post_client(client);
+    /**
+     * Get a valid token, reusing the cached one when it hasn't expired. Tasks take turns, so that the cache is never
+     * read while another one writes it, and tasks needing a new token at once only authenticate once.
+     * @param token receives a copy of the token, at least TokenCache::TOKEN_LENGTH characters
+     * @param rejected a token the API refused, renewed unless another task already did
+     */
+    inline static InternalErrors get_token(char* token, const char* rejected = nullptr) {
+      xSemaphoreTake(token_lock, portMAX_DELAY);
+      const char* cached = TokenCache::get();
+      if (cached != nullptr && rejected != nullptr && strncmp(cached, rejected, TokenCache::TOKEN_LENGTH) == 0) {
+        TokenCache::invalidate();
+        cached = nullptr;
+      }
+      auto code = InternalErrors::SUCCESS;
+      if (cached == nullptr) {
+        code = authenticate();
+        cached = TokenCache::get();
+        if (code == InternalErrors::SUCCESS && cached == nullptr)
+          code = InternalErrors::OTHER; // Expires before it can be used
+      }
+      if (code == InternalErrors::SUCCESS)
+        strncpy(token, cached, TokenCache::TOKEN_LENGTH);
+      xSemaphoreGive(token_lock);
+      return code;
+    }
 
-      // Make Payload
-      Payload payload;
-      payload.add_data("token", token);
-      payload.add_data("sensor_id", sensor_id);
-      payload.add_data("value", value);
+    /**
+     * Run an API call with a valid token. If the API rejects the token, authenticate again and retry once.
+     * @param call callable taking the token and returning an InternalErrors
+     */
+    template <typename Call>
+    inline static InternalErrors with_token(Call&& call) {
+      char token[TokenCache::TOKEN_LENGTH];
+      if (auto code = get_token(token); code != InternalErrors::SUCCESS)
+        return code;
+      if (auto code = call(static_cast<const char*>(token)); code != InternalErrors::WRONG_TOKEN)
+        return code;
+
+      Serial.println("[Token] Token rejected, authenticating again");
+      if (auto code = get_token(token, token); code != InternalErrors::SUCCESS)
+        return code;
+      return call(static_cast<const char*>(token));
+    }
+
+    /**
+     * Upload up to ReadingBuffer::FLUSH_CHUNK readings in a single request, compressed as a "series" bit stream holding
+     * for each sensor: its id (8 bits), its number of readings (8 bits) and its readings (see SeriesEncoder)
+     * @param statuses if not null, receives the status of each reading (same order as readings): SUCCESS, REJECTED, or
+     * the error of the whole request
+     * @param with_profile also send the wake cycle profile
+     * @return SUCCESS if every reading was recorded by the API, REJECTED if it refused some of them
+     */
+    inline static InternalErrors sendSeries(const char* token, const SensorReading* readings, size_t count,
+                                            InternalErrors* statuses = nullptr, bool with_profile = false) {
+      if (count > ReadingBuffer::FLUSH_CHUNK) {
+        fill_statuses(statuses, count, InternalErrors::OTHER);
+        return InternalErrors::OTHER;
+      }
 
-      client.begin(Endpoints::SEND_DATA);
-      int code = client.POST(payload.str().c_str());
+      // Group the readings by sensor, keeping them in time order (insertion sort, chunks are small)
+      size_t order[ReadingBuffer::FLUSH_CHUNK];
+      for (size_t i = 0; i < count; i++) {
+        size_t j = i;
+        for (; j > 0 && readings[order[j - 1]].sensor_id > readings[i].sensor_id; j--)
+          order[j] = order[j - 1];
+        order[j] = i;
+      }
+
+      // Encode the series
+      uint8_t encoded[SeriesEncoder::max_size(ReadingBuffer::FLUSH_CHUNK) + 2 * ReadingBuffer::FLUSH_CHUNK];
+      BitWriter bits(encoded, sizeof(encoded));
+      size_t n_series = 0;
+      for (size_t first = 0; first < count; n_series++) {
+        size_t last = first;
+        while (last < count && readings[order[last]].sensor_id == readings[order[first]].sensor_id)
+          last++;
+        bits.write(readings[order[first]].sensor_id, 8);
+        bits.write(last - first, 8);
+        SeriesEncoder series(bits);
+        for (; first < last; first++)
+          series.add(readings[order[first]].timestamp, readings[order[first]].value);
+      }
+      if (bits.overflowed()) {
+        Serial.println("[Series] Readings too large for the series buffer");
+        fill_statuses(statuses, count, InternalErrors::OTHER);
+        return InternalErrors::OTHER;
+      }
+
+      // Make Payload (static buffer, too large for the task stack)
+      static uint8_t buffer[SERIES_PAYLOAD_SIZE];
+      Payload payload(buffer, sizeof(buffer), PAYLOAD_FORMAT);
+      payload.add_data("token", token);
+      payload.add_data("count", count);
+      payload.add_data("series_count", n_series);
+      payload.add_data("series", PayloadBytes{encoded, bits.size()});
+      if (with_profile)
+        WakeProfiler::add_to(payload);
+
+      HTTPClient* client = APIConnection::open(Endpoints::SEND_SERIES);
+      int code = post(client, payload);
       if (code <= 0) {
-        client.end();
+        APIConnection::release();
+        fill_statuses(statuses, count, InternalErrors::FAILED);
         return InternalErrors::FAILED;
       }
 
-      ArduinoJson::JsonDocument doc;
-      ArduinoJson::deserializeJson(doc, client.getString());
-      client.end();
+      ArduinoJson::JsonDocument filter(&JsonArena::instance());
+      error_filter(filter);
+      filter["results"][0]["err_code"] = true;
+
+      ArduinoJson::JsonDocument doc(&JsonArena::instance());
+      bool parsed = parse_response(*client, doc, filter, "Series");
+      APIConnection::release();
+      if (!parsed) {
+        fill_statuses(statuses, count, InternalErrors::INVALID_RESPONSE);
+        return InternalErrors::INVALID_RESPONSE;
+      }
 
       // Process error code
       switch (doc["err_code"].as<int>()) {
       case APIErrors::NO_ERROR:
-        return InternalErrors::SUCCESS;
+        break;
       case APIErrors::INVALID_TOKEN:
+        fill_statuses(statuses, count, InternalErrors::WRONG_TOKEN);
         return InternalErrors::WRONG_TOKEN;
       default:
-        Serial.printf("[Record] Other error: %d\n%s\n", doc["err_code"].as<int>(), doc["err_msg"].as<const char*>());
+        Serial.printf("[Series] Other error: %d\n%s\n", doc["err_code"].as<int>(), doc["err_msg"].as<const char*>());
+        fill_statuses(statuses, count, InternalErrors::OTHER);
         return InternalErrors::OTHER;
       }
-    }
-
-    inline static InternalErrors getTime(DateTime& datetime) {
-      HTTPClient client;
-      client.begin(Endpoints::TIME);
-      int code = client.GET();
-      if (code <= 0) {
-        client.end();
-        return InternalErrors::FAILED;
-      }
 
-      ArduinoJson::JsonDocument doc;
-      ArduinoJson::deserializeJson(doc, client.getString());
-
-      datetime = DateTime::from_iso(doc["datetime"]);
-      client.end();
-      return InternalErrors::SUCCESS;
+      return read_results(doc, count, order, statuses, "Series");
     }
 
-    inline static InternalErrors getPumpCmd(const char* token, const size_t pump_id, PumpCmd& cmd) {
-      HTTPClient client;
-      client.begin(Endpoints::GET_WATERING_CMD);
-
-      Payload payload;
+    /**
+     * Fetch the commands of every pump in a single request.
+     * @param cmds receives the command of pump i at index i, pumps without a command are left stopped
+     * @param count the number of pumps
+     */
+    inline static InternalErrors getPumpCmds(const char* token, PumpCmd* cmds, size_t count) {
+      for (size_t i = 0; i < count; i++)
+        cmds[i] = PumpCmd{i, 0.0, 0};
+
+      uint8_t buffer[SMALL_PAYLOAD_SIZE];
+      Payload payload(buffer, sizeof(buffer), PAYLOAD_FORMAT);
       payload.add_data("token", token);
-      payload.add_data("pump_id", pump_id);
+      payload.add_data("count", count);
 
-      int code = client.POST(payload.str().c_str());
+      HTTPClient* client = APIConnection::open(Endpoints::GET_WATERING_CMDS);
+      int code = post(client, payload);
       if (code <= 0) {
-        client.end();
+        APIConnection::release();
         return InternalErrors::FAILED;
       }
 
-      ArduinoJson::JsonDocument doc;
-      ArduinoJson::deserializeJson(doc, client.getString());
+      ArduinoJson::JsonDocument filter(&JsonArena::instance());
+      error_filter(filter);
+      filter["cmds"][0]["pump_id"] = true;
+      filter["cmds"][0]["duration"] = true;
+      filter["cmds"][0]["pwm"] = true;
 
-      cmd.pump_id = doc["pump_id"];
-      cmd.time = doc["duration"];
-      cmd.pwm = doc["pwm"];
+      ArduinoJson::JsonDocument doc(&JsonArena::instance());
+      bool parsed = parse_response(*client, doc, filter, "GetCMDs");
+      APIConnection::release();
+      if (!parsed)
+        return InternalErrors::INVALID_RESPONSE;
 
-      client.end(); // Process error code
+      // Process error code
       switch (doc["err_code"].as<int>()) {
       case APIErrors::NO_ERROR:
-        return InternalErrors::SUCCESS;
+        break;
       case APIErrors::INVALID_TOKEN:
         return InternalErrors::WRONG_TOKEN;
       default:
-        Serial.printf("[GetCMD] Other error: %d\n%s\n", doc["err_code"].as<int>(), doc["err_msg"].as<const char*>());
+        Serial.printf("[GetCMDs] Other error: %d\n%s\n", doc["err_code"].as<int>(), doc["err_msg"].as<const char*>());
         return InternalErrors::OTHER;
       }
-    }
 
-    inline static InternalErrors pumpingDone(const char* token, const size_t pump_id) {
-      HTTPClient client;
-      client.begin(Endpoints::WATERING_COMPLETED);
+      for (auto item : doc["cmds"].as<ArduinoJson::JsonArray>()) {
+        size_t pump_id = item["pump_id"].as<size_t>();
+        if (pump_id >= count)
+          continue;
+        cmds[pump_id].time = item["duration"];
+        cmds[pump_id].pwm = item["pwm"];
+      }
+      return InternalErrors::SUCCESS;
+    }
 
-      Payload payload;
+    /**
+     * Acknowledge every pump run of this wake in a single request.
+     * @param runs the actual run time and duty of each pump
+     * @param count the number of runs
+     */
+    inline static InternalErrors pumpingDoneBatch(const char* token, const PumpRun* runs, size_t count) {
+      uint8_t buffer[SMALL_PAYLOAD_SIZE + 64 * PumpScheduler::MAX_JOBS];
+      Payload payload(buffer, sizeof(buffer), PAYLOAD_FORMAT);
       payload.add_data("token", token);
-      payload.add_data("pump_id", pump_id);
+      payload.add_data("count", count);
+      for (size_t i = 0; i < count; i++) {
+        payload.add_item("runs", i, "pump_id", runs[i].pump_id);
+        payload.add_item("runs", i, "duration", runs[i].time);
+        payload.add_item("runs", i, "pwm", runs[i].pwm);
+      }
 
-      int code = client.POST(payload.str().c_str());
+      HTTPClient* client = APIConnection::open(Endpoints::WATERING_COMPLETED_BATCH);
+      int code = post(client, payload);
       if (code <= 0) {
-        client.end();
+        APIConnection::release();
         return InternalErrors::FAILED;
       }
 
-      ArduinoJson::JsonDocument doc;
-      ArduinoJson::deserializeJson(doc, client.getString());
-      client.end();
+      ArduinoJson::JsonDocument filter(&JsonArena::instance());
+      error_filter(filter);
+
+      ArduinoJson::JsonDocument doc(&JsonArena::instance());
+      bool parsed = parse_response(*client, doc, filter, "PumpsDone");
+      APIConnection::release();
+      if (!parsed)
+        return InternalErrors::INVALID_RESPONSE;
 
       // Process error code
       switch (doc["err_code"].as<int>()) {
@@ -205,16 +353,92 @@ namespace meltwin {
       case APIErrors::INVALID_TOKEN:
         return InternalErrors::WRONG_TOKEN;
       default:
-        Serial.printf("[PumpDone] Other error: %d\n%s\n", doc["err_code"].as<int>(), doc["err_msg"].as<const char*>());
+        Serial.printf("[PumpsDone] Other error: %d\n%s\n", doc["err_code"].as<int>(), doc["err_msg"].as<const char*>());
         return InternalErrors::OTHER;
       }
     }
 
   private:
-    void static setup_post_client(HTTPClient& client) {
-      char header[1024];
-      client.addHeader("Content-Type", "application/x-www-form-urlencoded");
-      client.addHeader("Charset", "ascii");
+    inline static SemaphoreHandle_t token_lock;
+    inline static StaticSemaphore_t token_lock_buffer;
+
+    /**
+     * Send a payload on a freshly opened client, if APIConnection::open() gave one
+     * @return the HTTP code, or a negative value if the request couldn't be sent (including a too large payload)
+     */
+    static int post(HTTPClient* client, Payload& payload) {
+      if (client == nullptr) {
+        Serial.println("[API] No idle connection before the request timeout");
+        return HTTPC_ERROR_NOT_CONNECTED;
+      }
+      if (payload.finish().overflowed()) {
+        Serial.println("[API] Payload too large for its buffer");
+        return HTTPC_ERROR_TOO_LESS_RAM;
+      }
+      client->addHeader("Content-Type", payload.content_type());
+      client->addHeader("Charset", "ascii");
+      return client->POST(payload.data(), payload.size());
+    }
+
+    /**
+     * Parse a JSON response straight from the connection, keeping only the fields set in the filter
+     * @param tag name of the call, for logging
+     * @return false if the body isn't valid JSON
+     */
+    static bool parse_response(HTTPClient& client, ArduinoJson::JsonDocument& doc,
+                               const ArduinoJson::JsonDocument& filter, const char* tag) {
+      auto option = ArduinoJson::DeserializationOption::Filter(filter);
+      ArduinoJson::DeserializationError error;
+      if (client.header("Transfer-Encoding").equalsIgnoreCase("chunked")) {
+        StreamUtils::ChunkDecodingStream body(client.getStream());
+        error = ArduinoJson::deserializeJson(doc, body, option);
+      }
+      else
+        error = ArduinoJson::deserializeJson(doc, client.getStream(), option);
+
+      if (error) {
+        Serial.printf("[%s] Invalid response: %s\n", tag, error.c_str());
+        return false;
+      }
+      return true;
+    }
+
+    // Fields read from every response
+    void static error_filter(ArduinoJson::JsonDocument& filter) {
+      filter["err_code"] = true;
+      filter["err_msg"] = true;
+    }
+
+    /**
+     * Read the per-item results of a request, item i of the request being item order[i] of the caller.
+     * An answer that doesn't match the request fails as a whole.
+     */
+    static InternalErrors read_results(ArduinoJson::JsonDocument& doc, size_t count, const size_t* order,
+                                       InternalErrors* statuses, const char* tag) {
+      auto results = doc["results"].as<ArduinoJson::JsonArray>();
+      if (results.size() != count) {
+        Serial.printf("[%s] %u results for %u items\n", tag, static_cast<unsigned int>(results.size()),
+                      static_cast<unsigned int>(count));
+        fill_statuses(statuses, count, InternalErrors::INVALID_RESPONSE);
+        return InternalErrors::INVALID_RESPONSE;
+      }
+      InternalErrors status = InternalErrors::SUCCESS;
+      for (size_t i = 0; i < count; i++) {
+        InternalErrors item = (results[i]["err_code"].as<int>() == APIErrors::NO_ERROR) ? InternalErrors::SUCCESS
+                                                                                         : InternalErrors::REJECTED;
+        if (item != InternalErrors::SUCCESS)
+          status = InternalErrors::REJECTED;
+        if (statuses != nullptr)
+          statuses[order[i]] = item;
+      }
+      return status;
+    }
+
+    void static fill_statuses(InternalErrors* statuses, size_t count, InternalErrors status) {
+      if (statuses == nullptr)
+        return;
+      for (size_t i = 0; i < count; i++)
+        statuses[i] = status;
     }
   };
 
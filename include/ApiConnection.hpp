@@ -0,0 +1,193 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef API_CONNECTION_HPP
+#define API_CONNECTION_HPP
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <WiFiClientSecure.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include "hardware_configs.h"
+
+namespace meltwin {
+
+  /**
+   * Keep-alive connections shared by the API calls of a wake, one per task that may make calls at the same time.
+   * A request takes an idle connection, preferably one already open to its host, and gives it back once done.
+   */
+  struct APIConnection {
+    static constexpr size_t HOST_LENGTH{64}; // Max length of "scheme://host:port"
+    static constexpr size_t COUNT{1 + API_WORKERS};
+    inline static const char* COLLECTED_HEADERS[]{"Transfer-Encoding"}; // Needed to parse the body from the stream
+
+    /**
+     * Take a connection for a new request, to be given back by release(). Waits for one to be idle at most as long as
+     * the request timeout (see set_timeout()).
+     * @param url the full url of the request
+     * @return the client to add headers to and send the request with, or nullptr if every connection stayed busy
+     */
+    static HTTPClient* open(const char* url) {
+      char host[HOST_LENGTH];
+      host_of(url, host);
+      if (xSemaphoreTake(idle_slots, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+        return nullptr;
+      Slot& slot = acquire(host);
+      held = &slot;
+
+      // Only reuse an open socket if it points to the same host
+      if (strncmp(host, slot.host, HOST_LENGTH) != 0) {
+        stop(slot);
+        strncpy(slot.host, host, HOST_LENGTH);
+      }
+
+      bool secure = strncmp(url, "https://", 8) == 0;
+      WiFiClient& transport = (secure) ? static_cast<WiFiClient&>(slot.secure_transport) : slot.plain_transport;
+      if (secure)
+        slot.secure_transport.setInsecure();
+      slot.http.setReuse(true);
+      slot.http.setTimeout(timeout_ms);
+      slot.http.setConnectTimeout(timeout_ms);
+      slot.http.begin(transport, url);
+      slot.http.collectHeaders(COLLECTED_HEADERS, 1);
+      return &slot.http;
+    }
+
+    /**
+     * End the request of the calling task. The socket stays open for the next request if the server allows it.
+     */
+    static void release() {
+      if (held == nullptr)
+        return;
+      held->http.end();
+      held->busy.store(false, std::memory_order_release);
+      xSemaphoreGive(idle_slots);
+      held = nullptr;
+    }
+
+    /**
+     * Open an idle connection to the host of a url ahead of the requests, so that they don't wait for the handshakes
+     * @return false if the connection couldn't be made, or if every connection is busy or already open to the host
+     */
+    static bool preconnect(const char* url) {
+      char host[HOST_LENGTH];
+      host_of(url, host);
+      if (xSemaphoreTake(idle_slots, 0) != pdTRUE)
+        return false;
+      Slot* slot = nullptr;
+      for (Slot& candidate : slots)
+        if (!(candidate.connected() && strncmp(candidate.host, host, HOST_LENGTH) == 0) && try_take(candidate)) {
+          slot = &candidate;
+          break;
+        }
+      if (slot == nullptr) {
+        xSemaphoreGive(idle_slots);
+        return false;
+      }
+
+      stop(*slot);
+      bool secure = strncmp(url, "https://", 8) == 0;
+      char name[HOST_LENGTH];
+      uint16_t port = port_of(host, secure, name);
+      bool connected = false;
+      if (secure) {
+        slot->secure_transport.setInsecure();
+        connected = slot->secure_transport.connect(name, port, timeout_ms);
+      }
+      else
+        connected = slot->plain_transport.connect(name, port, timeout_ms);
+      if (connected)
+        strncpy(slot->host, host, HOST_LENGTH);
+      slot->busy.store(false, std::memory_order_release);
+      xSemaphoreGive(idle_slots);
+      return connected;
+    }
+
+    /**
+     * Set how long the requests of the calling task may wait for the connection and for each answer
+     */
+    static void set_timeout(uint32_t ms) { timeout_ms = static_cast<uint16_t>(std::min<uint32_t>(ms, UINT16_MAX)); }
+
+    /**
+     * Close every socket and free every connection, to be called when no request is running: before going to sleep,
+     * and before the API workers start (in the native build, RAM outlives a wake that its deadline cut short)
+     */
+    static void close() {
+      for (Slot& slot : slots) {
+        slot.http.end();
+        stop(slot);
+        slot.busy.store(false, std::memory_order_release);
+      }
+      idle_slots = xSemaphoreCreateCountingStatic(COUNT, COUNT, &idle_slots_buffer);
+    }
+
+  private:
+    struct Slot {
+      HTTPClient http;
+      WiFiClientSecure secure_transport;
+      WiFiClient plain_transport;
+      char host[HOST_LENGTH]; // Empty, as the slots are static (zero-initialized)
+      std::atomic<bool> busy; // Idle, same
+
+      bool connected() { return secure_transport.connected() || plain_transport.connected(); }
+    };
+
+    inline static Slot slots[COUNT];
+    inline static SemaphoreHandle_t idle_slots; // Counts the idle slots, created by close()
+    inline static StaticSemaphore_t idle_slots_buffer;
+    inline static thread_local Slot* held = nullptr;
+    inline static thread_local uint16_t timeout_ms = API_REQUEST_TIMEOUT_MS;
+
+    static bool try_take(Slot& slot) {
+      bool idle = false;
+      return slot.busy.compare_exchange_strong(idle, true, std::memory_order_acquire);
+    }
+
+    // An idle connection, open to the host if there is one. The caller holds an idle_slots count, so one is left.
+    static Slot& acquire(const char* host) {
+      for (Slot& slot : slots)
+        if (slot.connected() && strncmp(slot.host, host, HOST_LENGTH) == 0 && try_take(slot))
+          return slot;
+      while (true) // Only loops if other tasks take the slots it scans first
+        for (Slot& slot : slots)
+          if (try_take(slot))
+            return slot;
+    }
+
+    static void stop(Slot& slot) {
+      slot.secure_transport.stop();
+      slot.plain_transport.stop();
+      slot.host[0] = '\0';
+    }
+
+    static void host_of(const char* url, char* host) {
+      const char* start = strstr(url, "://");
+      start = (start == nullptr) ? url : start + 3;
+      const char* end = strchr(start, '/');
+      size_t len = (end == nullptr) ? strlen(url) : static_cast<size_t>(end - url);
+      len = std::min(len, HOST_LENGTH - 1);
+      strncpy(host, url, len);
+      host[len] = '\0';
+    }
+
+    // Split "scheme://name[:port]" into the name and the port, which defaults to the one of the scheme
+    static uint16_t port_of(const char* host, bool secure, char* name) {
+      const char* start = strstr(host, "://");
+      start = (start == nullptr) ? host : start + 3;
+      const char* colon = strchr(start, ':');
+      size_t len = (colon == nullptr) ? strlen(start) : static_cast<size_t>(colon - start);
+      memcpy(name, start, len);
+      name[len] = '\0';
+      if (colon != nullptr)
+        return static_cast<uint16_t>(strtoul(colon + 1, nullptr, 10));
+      return (secure) ? 443 : 80;
+    }
+  };
+
+} // namespace meltwin
+
+#endif // API_CONNECTION_HPP
@@ -0,0 +1,233 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef API_WORKERS_HPP
+#define API_WORKERS_HPP
+
+#include <Arduino.h>
+#include <atomic>
+#include <esp_timer.h>
+#include "ApiCaller.hpp"
+#include "ApiConnection.hpp"
+#include "JsonArena.hpp"
+#include "common.hpp"
+#include "hardware_configs.h"
+
+namespace meltwin {
+
+  /**
+   * Handle of a request submitted to the ApiWorkers, to wait for its result
+   */
+  struct ApiFuture {
+    uint8_t slot;
+    bool valid; // False if the request couldn't be queued
+  };
+
+  /**
+   * FreeRTOS tasks running API calls in the background, each with its own connection and JSON arena.
+   * A waiter gives up at the request deadline while the call may still run, so calls must use static storage.
+   */
+  struct ApiWorkers {
+    static constexpr size_t WORKERS{API_WORKERS};
+    static constexpr size_t QUEUE{8}; // Requests queued or running
+    static constexpr uint32_t STACK_SIZE{8192};
+    static constexpr BaseType_t CORE{0}; // Same core as the WiFi stack
+
+    using Call = InternalErrors (*)(void* context);
+
+    /**
+     * Start the workers, once per wake before submitting requests
+     */
+    static void begin() {
+      APIConnection::close();
+      JsonArena::reset();
+      APICaller::begin();
+      stopping = false;
+      for (Request& request : requests)
+        request.state.store(FREE);
+      pending = xSemaphoreCreateCountingStatic(QUEUE + WORKERS, 0, &pending_buffer);
+      exited = xSemaphoreCreateCountingStatic(WORKERS, 0, &exited_buffer);
+      finished = xEventGroupCreateStatic(&finished_buffer);
+      for (size_t i = 0; i < WORKERS; i++)
+        xTaskCreateStaticPinnedToCore(worker, "api", STACK_SIZE, reinterpret_cast<void*>(i), 1, stacks[i],
+                                      &task_buffers[i], CORE);
+      started = true;
+    }
+
+    /**
+     * Queue a call for the next idle worker
+     * @param context passed to the call, must outlive the request
+     * @param timeout_ms time given to the request from now on, waiting for a worker included
+     */
+    static ApiFuture submit(Call call, void* context, uint32_t timeout_ms = API_REQUEST_TIMEOUT_MS) {
+      return queue(call, context, timeout_ms, false);
+    }
+
+    /**
+     * Queue a call whose result isn't needed, e.g. to open a connection ahead of the requests
+     * @return false if the queue is full
+     */
+    static bool post(Call call, void* context = nullptr, uint32_t timeout_ms = API_REQUEST_TIMEOUT_MS) {
+      return queue(call, context, timeout_ms, true).valid;
+    }
+
+    /**
+     * Queue a callable object, e.g. a lambda kept in a static variable
+     */
+    template <typename F>
+    static ApiFuture submit(F& call, uint32_t timeout_ms = API_REQUEST_TIMEOUT_MS) {
+      return submit([](void* context) { return (*static_cast<F*>(context))(); }, &call, timeout_ms);
+    }
+
+    /**
+     * Wait for a request until its deadline, then free its slot
+     * @return its result, or FAILED if it couldn't be queued or timed out
+     */
+    static InternalErrors wait(ApiFuture future) {
+      if (!future.valid)
+        return InternalErrors::FAILED;
+      Request& request = requests[future.slot];
+      int64_t left_us = std::max<int64_t>(0, request.deadline_us - esp_timer_get_time());
+      auto ticks = static_cast<TickType_t>((left_us + 999) / 1000 / portTICK_PERIOD_MS);
+      xEventGroupWaitBits(finished, bit(future.slot), pdTRUE, pdTRUE, ticks);
+
+      uint8_t state = QUEUED;
+      if (request.state.compare_exchange_strong(state, FREE)) {
+        Serial.println("[Workers] Request timed out before a worker took it");
+        return InternalErrors::FAILED;
+      }
+      if (state == RUNNING && request.state.compare_exchange_strong(state, ABANDONED)) {
+        Serial.println("[Workers] Request timed out, left to its worker");
+        return InternalErrors::FAILED;
+      }
+      InternalErrors status = request.status; // DONE, possibly just after the deadline
+      request.state.store(FREE);
+      return status;
+    }
+
+    /**
+     * Let the workers exit once their current request is done, and wait for them before going to sleep. A request
+     * abandoned by its waiter may still be running, its connection can only be closed once it is over.
+     * @param timeout_ms how long to wait for the workers
+     * @return false if a worker is still running a request, the connections must then be left alone
+     */
+    static bool stop(uint32_t timeout_ms) {
+      if (!started)
+        return true;
+      stopping = true;
+      for (size_t i = 0; i < WORKERS; i++)
+        xSemaphoreGive(pending);
+      started = false;
+
+      TickType_t start = xTaskGetTickCount(), ticks = pdMS_TO_TICKS(timeout_ms);
+      for (size_t i = 0; i < WORKERS; i++) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (xSemaphoreTake(exited, (elapsed < ticks) ? ticks - elapsed : 0) != pdTRUE) {
+          Serial.println("[Workers] A request is still running, its connection is left open");
+          return false;
+        }
+      }
+      return true;
+    }
+
+  private:
+    enum State : uint8_t { FREE, RESERVED, QUEUED, RUNNING, DONE, ABANDONED };
+
+    struct Request {
+      std::atomic<uint8_t> state; // FREE, as the requests are static (zero-initialized)
+      Call call;
+      void* context;
+      int64_t deadline_us; // esp_timer time
+      uint32_t ticket;     // Submission order
+      bool detached;       // Nobody waits for it, freed by its worker
+      InternalErrors status;
+    };
+
+    inline static Request requests[QUEUE];
+    inline static uint32_t next_ticket = 0;
+    inline static std::atomic<bool> stopping{false};
+    inline static bool started = false;
+    inline static SemaphoreHandle_t pending;
+    inline static StaticSemaphore_t pending_buffer;
+    inline static SemaphoreHandle_t exited; // Given by each worker as it exits
+    inline static StaticSemaphore_t exited_buffer;
+    inline static EventGroupHandle_t finished; // One bit per request slot
+    inline static StaticEventGroup_t finished_buffer;
+    inline static StackType_t stacks[WORKERS][STACK_SIZE];
+    inline static StaticTask_t task_buffers[WORKERS];
+
+    static_assert(QUEUE <= 24, "An event group holds 24 bits");
+    static_assert(WORKERS < JsonArena::INSTANCES && WORKERS < APIConnection::COUNT,
+                  "Each worker needs a JSON arena and a connection of its own");
+
+    static constexpr EventBits_t bit(size_t slot) { return static_cast<EventBits_t>(1) << slot; }
+
+    static ApiFuture queue(Call call, void* context, uint32_t timeout_ms, bool detached) {
+      if (!started)
+        return ApiFuture{0, false};
+      for (uint8_t i = 0; i < QUEUE; i++) {
+        uint8_t idle = FREE;
+        if (!requests[i].state.compare_exchange_strong(idle, RESERVED))
+          continue;
+        Request& request = requests[i];
+        request.call = call;
+        request.context = context;
+        request.deadline_us = esp_timer_get_time() + static_cast<int64_t>(timeout_ms) * MS_2US;
+        request.ticket = next_ticket++;
+        request.status = InternalErrors::FAILED;
+        request.detached = detached;
+        xEventGroupClearBits(finished, bit(i));
+        request.state.store(QUEUED);
+        xSemaphoreGive(pending);
+        return ApiFuture{i, true};
+      }
+      Serial.println("[Workers] Request queue full");
+      return ApiFuture{0, false};
+    }
+
+    // Oldest queued request, taken by the calling worker
+    static Request* take() {
+      while (true) {
+        Request* oldest = nullptr;
+        for (Request& request : requests)
+          if (request.state.load() == QUEUED && (oldest == nullptr || request.ticket - oldest->ticket > UINT32_MAX / 2))
+            oldest = &request;
+        if (oldest == nullptr)
+          return nullptr; // Cancelled by its waiter
+        uint8_t queued = QUEUED;
+        if (oldest->state.compare_exchange_strong(queued, RUNNING))
+          return oldest;
+      }
+    }
+
+    static void worker(void* arg) {
+      size_t index = reinterpret_cast<size_t>(arg);
+      JsonArena::bind(1 + index);
+      while (xSemaphoreTake(pending, portMAX_DELAY) == pdTRUE && !stopping) {
+        Request* request = take();
+        if (request == nullptr)
+          continue;
+
+        int64_t left_us = request->deadline_us - esp_timer_get_time();
+        InternalErrors status = InternalErrors::FAILED;
+        if (left_us > 0) {
+          APIConnection::set_timeout(static_cast<uint32_t>(left_us / MS_2US));
+          status = request->call(request->context);
+        }
+        request->status = status;
+
+        uint8_t running = RUNNING;
+        if (!request->detached && request->state.compare_exchange_strong(running, DONE))
+          xEventGroupSetBits(finished, bit(request - requests));
+        else
+          request->state.store(FREE); // Detached, or abandoned by its waiter
+      }
+      xSemaphoreGive(exited);
+      vTaskDelete(nullptr);
+    }
+  };
+
+} // namespace meltwin
+
+#endif // API_WORKERS_HPP
@@ -0,0 +1,130 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef CONFIG_STORE_HPP
+#define CONFIG_STORE_HPP
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <cstddef>
+#include <cstring>
+#include <esp_rom_crc.h>
+#include "MoistureTrend.hpp"
+
+namespace meltwin {
+
+  /**
+   * Settings and checkpoints of a plant
+   */
+  struct PlantConfig {
+    uint32_t open_time_ms;   // How long the pump stays open for a watering
+    uint32_t period_s;       // Time between two waterings
+    int64_t last_watered_us; // Checkpoint: time of the last watering since the epoch, 0 if never watered
+  };
+
+  struct ConfigBlob {
+    uint16_t version;
+    uint16_t size;     // sizeof(ConfigBlob), so that a layout change is caught even if the version wasn't bumped
+    uint32_t reserved; // Always 0, keeps the plants aligned without padding
+    PlantConfig plants[PLANT_COUNT];
+    uint32_t crc; // CRC32 of every field above
+  };
+
+  /**
+   * Typed configuration kept in NVS as a single CRC-protected blob, with a copy in RTC memory.
+   * Setters change the working copy, commit() writes it back once per wake and only if it changed.
+   */
+  struct ConfigStore {
+    static constexpr uint16_t VERSION{1};
+    static constexpr const char* NAMESPACE{"config"};
+    static constexpr const char* KEY{"blob"};
+    static constexpr PlantConfig DEFAULT_PLANT{3000, 86400, 0};
+
+    static void begin() {
+      if (!valid(rtc_stored_config) && !load(rtc_stored_config)) {
+        Serial.println("[Config] No valid configuration stored, using the defaults");
+        rtc_stored_config = defaults();
+      }
+      current_config = rtc_stored_config;
+    }
+
+    static const PlantConfig& plant(size_t plant) { return current_config.plants[plant]; }
+
+    static void set_pump(size_t plant, uint32_t open_time_ms, uint32_t period_s) {
+      if (plant >= PLANT_COUNT)
+        return;
+      current_config.plants[plant].open_time_ms = open_time_ms;
+      current_config.plants[plant].period_s = period_s;
+    }
+
+    static void set_last_watered(size_t plant, int64_t epoch_us) {
+      if (plant < PLANT_COUNT)
+        current_config.plants[plant].last_watered_us = epoch_us;
+    }
+
+    /**
+     * Write the changed settings to NVS, at the end of the wake
+     * @return false if the NVS write failed, the changes are then kept for the next commit
+     */
+    static bool commit() {
+      current_config.crc = crc_of(current_config);
+      if (memcmp(&current_config, &rtc_stored_config, offsetof(ConfigBlob, crc)) == 0)
+        return true;
+
+      Preferences preferences;
+      if (!preferences.begin(NAMESPACE, false))
+        return false;
+      bool written = preferences.putBytes(KEY, &current_config, sizeof(ConfigBlob)) == sizeof(ConfigBlob);
+      preferences.end();
+      if (!written) {
+        Serial.println("[Config] Couldn't write the configuration");
+        return false;
+      }
+      rtc_stored_config = current_config;
+      return true;
+    }
+
+    /**
+     * Forget the stored configuration, e.g. after the NVS partition has been erased
+     */
+    static void reset() {
+      rtc_stored_config.crc = ~crc_of(rtc_stored_config);
+      current_config = defaults();
+    }
+
+  private:
+    inline static RTC_DATA_ATTR ConfigBlob rtc_stored_config; // Copy of the blob in NVS, valid if its CRC matches
+    inline static ConfigBlob current_config;                  // Working copy, changes are committed by commit()
+
+    static ConfigBlob defaults() {
+      ConfigBlob blob{};
+      blob.version = VERSION;
+      blob.size = sizeof(ConfigBlob);
+      for (auto& plant : blob.plants)
+        plant = DEFAULT_PLANT;
+      blob.crc = crc_of(blob);
+      return blob;
+    }
+
+    static bool load(ConfigBlob& blob) {
+      Preferences preferences;
+      if (!preferences.begin(NAMESPACE, true))
+        return false;
+      size_t read = preferences.getBytes(KEY, &blob, sizeof(ConfigBlob));
+      preferences.end();
+      return read == sizeof(ConfigBlob) && valid(blob);
+    }
+
+    static bool valid(const ConfigBlob& blob) {
+      return blob.version == VERSION && blob.size == sizeof(ConfigBlob) && blob.crc == crc_of(blob);
+    }
+
+    static uint32_t crc_of(const ConfigBlob& blob) {
+      return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&blob), offsetof(ConfigBlob, crc));
+    }
+  };
+
+} // namespace meltwin
+
+#endif // CONFIG_STORE_HPP
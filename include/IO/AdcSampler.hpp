@@ -0,0 +1,117 @@
+#ifndef ADC_SAMPLER_HPP
+#define ADC_SAMPLER_HPP
+
+#include <Arduino.h>
+#include <algorithm>
+#include <driver/adc.h>
+#include <esp_adc_cal.h>
+
+namespace meltwin {
+
+  enum class AdcFilter : uint8_t { MEAN, MEDIAN, TRIMMED_MEAN };
+
+  struct AdcConfig {
+    uint16_t samples = 64;                // Number of samples taken in one burst
+    AdcFilter filter = AdcFilter::MEDIAN; // How the burst is reduced to a single value
+    uint8_t trim_percent = 25;            // For TRIMMED_MEAN, the share of samples dropped on each side
+  };
+
+  /**
+   * Burst acquisition on the ESP32 ADC.
+   * Samples are taken back to back with the IDF one-shot driver at 12 bits and 11 dB, reduced in integer arithmetic,
+   * then converted to millivolts with the eFuse calibration.
+   */
+  struct AdcSampler {
+    static constexpr uint16_t MAX_SAMPLES{256};
+    static constexpr uint32_t FULL_SCALE_MV{3300}; // Input voltage mapped to a measure of 1.0
+    static constexpr uint32_t DEFAULT_VREF_MV{1100};
+
+    /**
+     * Acquire a filtered voltage on a pin
+     * @param pin the GPIO to read, which must be an ADC pin
+     * @param config the number of samples and the filter to use
+     * @param millivolts receives the calibrated voltage
+     * @return false if the pin can't be read (not an ADC pin, or ADC2 while the WiFi is on)
+     */
+    static bool read_mv(gpio_num_t pin, const AdcConfig& config, uint32_t& millivolts) {
+      int8_t channel = digitalPinToAnalogChannel(pin);
+      if (channel < 0)
+        return false;
+      bool adc2 = channel >= SOC_ADC_MAX_CHANNEL_NUM;
+      if (adc2)
+        channel -= SOC_ADC_MAX_CHANNEL_NUM;
+
+      // Burst acquisition
+      uint16_t buffer[MAX_SAMPLES];
+      uint16_t n = std::min(std::max(config.samples, uint16_t{1}), MAX_SAMPLES);
+      if (!acquire(adc2, channel, buffer, n))
+        return false;
+
+      uint32_t raw = reduce(buffer, n, config);
+      millivolts = esp_adc_cal_raw_to_voltage(raw, characteristics(adc2));
+      return true;
+    }
+
+    /**
+     * Reduce a burst of raw samples to a single raw value. The samples may be reordered.
+     */
+    static uint32_t reduce(uint16_t* samples, uint16_t n, const AdcConfig& config) {
+      switch (config.filter) {
+      case AdcFilter::MEDIAN:
+        std::nth_element(samples, samples + n / 2, samples + n);
+        return samples[n / 2];
+      case AdcFilter::TRIMMED_MEAN: {
+        uint16_t trim = std::min<uint16_t>(n * config.trim_percent / 100, (n - 1) / 2);
+        std::sort(samples, samples + n);
+        return mean(samples + trim, n - 2 * trim);
+      }
+      case AdcFilter::MEAN:
+      default:
+        return mean(samples, n);
+      }
+    }
+
+  private:
+    static uint32_t mean(const uint16_t* samples, uint16_t n) {
+      uint32_t sum = 0;
+      for (uint16_t i = 0; i < n; i++)
+        sum += samples[i];
+      return (sum + n / 2) / n;
+    }
+
+    static bool acquire(bool adc2, int8_t channel, uint16_t* buffer, uint16_t n) {
+      if (!adc2) {
+        auto ch = static_cast<adc1_channel_t>(channel);
+        adc1_config_width(ADC_WIDTH_BIT_12);
+        adc1_config_channel_atten(ch, ADC_ATTEN_DB_11);
+        for (uint16_t i = 0; i < n; i++)
+          buffer[i] = adc1_get_raw(ch);
+        return true;
+      }
+
+      auto ch = static_cast<adc2_channel_t>(channel);
+      adc2_config_channel_atten(ch, ADC_ATTEN_DB_11);
+      for (uint16_t i = 0; i < n; i++) {
+        int raw;
+        if (adc2_get_raw(ch, ADC_WIDTH_BIT_12, &raw) != ESP_OK)
+          return false;
+        buffer[i] = raw;
+      }
+      return true;
+    }
+
+    static const esp_adc_cal_characteristics_t* characteristics(bool adc2) {
+      static esp_adc_cal_characteristics_t chars[2];
+      static bool ready[2] = {false, false};
+      if (!ready[adc2]) {
+        esp_adc_cal_characterize((adc2) ? ADC_UNIT_2 : ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, DEFAULT_VREF_MV,
+                                 &chars[adc2]);
+        ready[adc2] = true;
+      }
+      return &chars[adc2];
+    }
+  };
+
+} // namespace meltwin
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef DEVICE_TABLE_HPP
+#define DEVICE_TABLE_HPP
+
+#include <Arduino.h>
+#include <array>
+#include <iterator>
+#include <utility>
+#include "IO/Pump.hpp"
+#include "IO/Sensor.hpp"
+
+namespace meltwin {
+
+  /**
+   * What each GPIO of the ESP32 (WROOM/WROVER modules) can be used for
+   */
+  struct Esp32Pins {
+    static constexpr uint8_t LEDC_CHANNELS{16};
+    static constexpr uint8_t LEDC_MAX_RESOLUTION{16};  // PWMValue is 16 bits wide
+    static constexpr uint32_t LEDC_CLOCK_HZ{80000000}; // APB clock, divided down to frequency * 2^resolution
+
+    static constexpr bool exists(gpio_num_t pin) {
+      return (pin >= 0 && pin <= 19) || (pin >= 21 && pin <= 23) || (pin >= 25 && pin <= 27) ||
+             (pin >= 32 && pin <= 39);
+    }
+
+    // GPIO 6 to 11 are wired to the SPI flash, GPIO 34 to 39 are inputs only
+    static constexpr bool can_output(gpio_num_t pin) { return exists(pin) && !(pin >= 6 && pin <= 11) && pin < 34; }
+
+    /**
+     * Same numbering as digitalPinToAnalogChannel(): ADC2 channels are offset by SOC_ADC_MAX_CHANNEL_NUM
+     * @return -1 if the pin has no ADC channel
+     */
+    static constexpr int8_t adc_channel(gpio_num_t pin) {
+      constexpr gpio_num_t ADC1[]{GPIO_NUM_36, GPIO_NUM_37, GPIO_NUM_38, GPIO_NUM_39, GPIO_NUM_32,
+                                  GPIO_NUM_33, GPIO_NUM_34, GPIO_NUM_35};
+      constexpr gpio_num_t ADC2[]{GPIO_NUM_4,  GPIO_NUM_0,  GPIO_NUM_2,  GPIO_NUM_15, GPIO_NUM_13,
+                                  GPIO_NUM_12, GPIO_NUM_14, GPIO_NUM_27, GPIO_NUM_25, GPIO_NUM_26};
+      for (size_t i = 0; i < std::size(ADC1); i++)
+        if (ADC1[i] == pin)
+          return i;
+      for (size_t i = 0; i < std::size(ADC2); i++)
+        if (ADC2[i] == pin)
+          return SOC_ADC_MAX_CHANNEL_NUM + i;
+      return -1;
+    }
+
+    // ADC2 is shared with the WiFi radio, so it can't be read while the WiFi is on
+    static constexpr bool on_adc2(gpio_num_t pin) { return adc_channel(pin) >= SOC_ADC_MAX_CHANNEL_NUM; }
+  };
+
+  /**
+   * Wiring rules checked by DeviceTable, each one is a static_assert there
+   */
+  template <const auto& SENSORS, const auto& PUMPS>
+  struct WiringChecks {
+    static constexpr size_t SENSOR_COUNT{std::size(SENSORS)};
+    static constexpr size_t PUMP_COUNT{std::size(PUMPS)};
+
+    static constexpr bool sensor_pins_usable() {
+      for (const SensorSpec& s : SENSORS)
+        if (Esp32Pins::adc_channel(s.data) < 0 || (s.enable != GPIO_NUM_NC && !Esp32Pins::can_output(s.enable)))
+          return false;
+      return true;
+    }
+
+    // Sensors may share a data pin if they are powered one at a time, but each enable pin drives a single sensor
+    static constexpr bool sensor_pins_distinct() {
+      for (size_t i = 0; i < SENSOR_COUNT; i++)
+        for (size_t j = 0; j < SENSOR_COUNT; j++) {
+          const SensorSpec &a = SENSORS[i], &b = SENSORS[j];
+          if (a.enable != GPIO_NUM_NC && a.enable == b.data)
+            return false;
+          if (i != j && a.enable != GPIO_NUM_NC && a.enable == b.enable)
+            return false;
+          if (i != j && a.data == b.data && (a.enable == GPIO_NUM_NC || b.enable == GPIO_NUM_NC))
+            return false;
+        }
+      return true;
+    }
+
+    static constexpr bool pump_pins_usable() {
+      for (const PumpSpec& p : PUMPS) {
+        if (!Esp32Pins::can_output(p.pin))
+          return false;
+        for (const SensorSpec& s : SENSORS)
+          if (p.pin == s.data || p.pin == s.enable)
+            return false;
+      }
+      for (size_t i = 0; i < PUMP_COUNT; i++)
+        for (size_t j = i + 1; j < PUMP_COUNT; j++)
+          if (PUMPS[i].pin == PUMPS[j].pin)
+            return false;
+      return true;
+    }
+
+    // Each pair of LEDC channels (2n, 2n + 1) runs from the same timer, so they share their resolution
+    static constexpr bool pump_channels_valid() {
+      for (size_t i = 0; i < PUMP_COUNT; i++) {
+        const PumpSpec& a = PUMPS[i];
+        if (a.channel >= Esp32Pins::LEDC_CHANNELS || a.resolution == 0 ||
+            a.resolution > Esp32Pins::LEDC_MAX_RESOLUTION)
+          return false;
+        for (size_t j = i + 1; j < PUMP_COUNT; j++) {
+          const PumpSpec& b = PUMPS[j];
+          if (a.channel == b.channel || (a.channel / 2 == b.channel / 2 && a.resolution != b.resolution))
+            return false;
+        }
+      }
+      return true;
+    }
+  };
+
+  /**
+   * Sensors and pumps of the board, described by constexpr arrays of SensorSpec and PumpSpec.
+   * Pin and LEDC channel conflicts fail the build.
+   */
+  template <const auto& SENSORS, const auto& PUMPS>
+  struct DeviceTable : WiringChecks<SENSORS, PUMPS> {
+    using Checks = WiringChecks<SENSORS, PUMPS>;
+    static constexpr size_t SENSOR_COUNT{Checks::SENSOR_COUNT};
+    static constexpr size_t PUMP_COUNT{Checks::PUMP_COUNT};
+
+    template <size_t I>
+    using SensorAt = Sensor<SENSORS, I>;
+
+    /**
+     * Call f(SensorAt<I>{}) for every sensor, unrolled
+     */
+    template <typename F>
+    static void for_each_sensor(F&& f) {
+      for_each_sensor(f, std::make_index_sequence<SENSOR_COUNT>{});
+    }
+
+    static constexpr std::array<Pump, PUMP_COUNT> pumps() { return pumps(std::make_index_sequence<PUMP_COUNT>{}); }
+
+    static constexpr std::array<float, SENSOR_COUNT> deadbands() {
+      std::array<float, SENSOR_COUNT> deadbands{};
+      for (size_t i = 0; i < SENSOR_COUNT; i++)
+        deadbands[i] = SENSORS[i].deadband;
+      return deadbands;
+    }
+
+    static constexpr bool uses_pin(gpio_num_t pin) {
+      if (pin == GPIO_NUM_NC)
+        return false;
+      for (const SensorSpec& s : SENSORS)
+        if (pin == s.data || pin == s.enable)
+          return true;
+      for (const PumpSpec& p : PUMPS)
+        if (pin == p.pin)
+          return true;
+      return false;
+    }
+
+    /**
+     * Whether every pump can run its PWM at this frequency with its resolution
+     */
+    static constexpr bool pwm_frequency_fits(uint32_t frequency) {
+      for (const PumpSpec& p : PUMPS)
+        if (static_cast<uint64_t>(frequency) << p.resolution > Esp32Pins::LEDC_CLOCK_HZ)
+          return false;
+      return true;
+    }
+
+  private:
+    template <typename F, size_t... I>
+    static void for_each_sensor(F& f, std::index_sequence<I...>) {
+      (f(SensorAt<I>{}), ...);
+    }
+
+    template <size_t... I>
+    static constexpr std::array<Pump, PUMP_COUNT> pumps(std::index_sequence<I...>) {
+      return {Pump(PUMPS[I])...};
+    }
+
+    static_assert(Checks::sensor_pins_usable(),
+                  "A sensor data pin has no ADC channel, or an enable pin can't drive an output");
+    static_assert(Checks::sensor_pins_distinct(), "Sensor pins conflict: shared enable pin, enable pin used as a "
+                                                  "data pin, or shared data pin without an enable pin on each sensor");
+    static_assert(Checks::pump_pins_usable(), "A pump pin can't drive an output or is already used");
+    static_assert(Checks::pump_channels_valid(), "LEDC channel conflict: shared channel, invalid resolution, or "
+                                                 "channels of a same timer with different resolutions");
+  };
+
+} // namespace meltwin
+
+#endif
@@ -9,43 +9,65 @@ namespace meltwin {
   struct PumpCmd {
     size_t pump_id = 0;
     float time = 0.0;
-    unsigned short pwm; // In [0 - 100]
+    unsigned short pwm = 0; // In [0 - 100]
   };
 
-  struct Pump {
+  // What a pump actually did, reported back to the API
+  struct PumpRun {
+    size_t pump_id = 0;
+    float time = 0.0;       // Actual run time, in seconds
+    unsigned short pwm = 0; // In [0 - 100]
+  };
 
-    explicit Pump(gpio_num_t _out_pin, unsigned short pwm_channel, unsigned short _resolution) :
-        channel(pwm_channel), resolution(_resolution), pwm_pin(_out_pin) {
-      max_value = std::pow(2, resolution) - 1;
-    }
+  /**
+   * Wiring of a PWM driven pump, as an entry of a device table (see DeviceTable.hpp)
+   */
+  struct PumpSpec {
+    gpio_num_t pin;
+    uint8_t channel;             // LEDC channel
+    uint8_t resolution;          // LEDC resolution, in bits
+    uint32_t max_current_ma = 0; // Current drawn at full duty
+  };
 
+  struct Pump {
+    constexpr explicit Pump(const PumpSpec& spec) :
+        channel(spec.channel), resolution(spec.resolution), max_value((1U << spec.resolution) - 1), pwm_pin(spec.pin),
+        max_current_ma(spec.max_current_ma) {}
 
-    void setup_pump(unsigned int freq) {
+    void setup_pump(unsigned int freq) const {
       ledcSetup(channel, freq, resolution);
       ledcAttachPin(pwm_pin, channel);
     }
 
-    void run_pump(const PumpCmd& cmd) {
+    void run_pump(const PumpCmd& cmd) const {
+      start_pump(cmd);
+      delay(static_cast<unsigned long>(cmd.time * 1000));
+      ledcWrite(channel, 0);
+    }
+
+    // Start the pump at the commanded duty, without waiting
+    void start_pump(const PumpCmd& cmd) const {
       // Convert percentages from API to PWMValue
       PWMValue pump_cmd = (cmd.pwm / 100.0) * max_value;
-
-      // Run the pump
-      auto end = millis() + static_cast<unsigned long>(cmd.time * 1000);
-      while (millis() < end) {
-        ledcWrite(channel, pump_cmd);
-        delay(250);
-      }
+      ledcWrite(channel, pump_cmd);
     }
 
-    void stop_pump() {
+    // Cut the output only, safe to call from a timer callback
+    void cut_pump() const { ledcWrite(channel, 0); }
+
+    void stop_pump() const {
       ledcWrite(channel, 0);
       ledcDetachPin(pwm_pin);
     }
 
+    // Current drawn at the given duty, in mA
+    uint32_t current(unsigned short pwm) const { return max_current_ma * pwm / 100; }
+
   private:
     unsigned short channel, resolution;
     PWMValue max_value;
     gpio_num_t pwm_pin;
+    uint32_t max_current_ma;
   };
 
 } // namespace meltwin
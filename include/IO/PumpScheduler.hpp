@@ -0,0 +1,162 @@
+#ifndef PUMP_SCHEDULER_HPP
+#define PUMP_SCHEDULER_HPP
+
+#include <Arduino.h>
+#include <algorithm>
+#include <cmath>
+#include <esp_timer.h>
+#include "IO/Pump.hpp"
+
+namespace meltwin {
+
+  /**
+   * Run several pumps at once within a current budget, each one stopped by a one-shot esp_timer.
+   * Each pump must have its own LEDC channel.
+   */
+  struct PumpScheduler {
+    static constexpr size_t MAX_JOBS{8};
+    static constexpr float MAX_RUN_S{600.0f}; // Longer commands are rejected as bogus
+    static constexpr unsigned short MAX_PWM{100};
+
+    struct Job {
+      const Pump* pump;
+      PumpCmd cmd;
+      int64_t run_us;     // Planned run time, the commanded one unless cut short by the deadline
+      int64_t started_us; // esp_timer time at which the pump started
+      int64_t stopped_us; // esp_timer time at which the pump stopped
+      esp_timer_handle_t timer;
+      bool running;
+      volatile bool stopped; // Set by the timer callback, before signaling the scheduler
+      PumpScheduler* scheduler;
+    };
+
+    /**
+     * @param _budget_ma max total current drawn by the running pumps, in mA
+     * @param _freq the PWM frequency
+     */
+    explicit PumpScheduler(uint32_t _budget_ma, unsigned int _freq) : budget_ma(_budget_ma), freq(_freq) {}
+
+    /**
+     * Queue a pump run. Runs with a null duration or duty are ignored, duties above 100 % are clamped.
+     * @return false if the duration is not a number or longer than MAX_RUN_S, or if the queue is full
+     */
+    bool add(const Pump& pump, const PumpCmd& cmd) {
+      if (!std::isfinite(cmd.time) || cmd.time > MAX_RUN_S) {
+        Serial.printf("Ignoring pump %zu, invalid run time %f s\n", cmd.pump_id, cmd.time);
+        return false;
+      }
+      if (cmd.time <= 0.0 || cmd.pwm == 0)
+        return true;
+      if (n_jobs == MAX_JOBS)
+        return false;
+      PumpCmd clamped{cmd.pump_id, cmd.time, std::min(cmd.pwm, MAX_PWM)};
+      jobs[n_jobs++] = Job{&pump, clamped, static_cast<int64_t>(cmd.time * S_2US), 0, 0, nullptr, false, false, this};
+      return true;
+    }
+
+    /**
+     * Run every queued pump, blocking until the last one stops
+     * @param deadline_us esp_timer time by which every pump must have stopped, a run that would end later is cut short
+     * (see cut_short()), or a negative value for no deadline
+     */
+    void run(int64_t deadline_us = -1) {
+      finished = xSemaphoreCreateCountingStatic(MAX_JOBS, 0, &finished_buffer);
+      size_t next = 0, signaled = 0;
+      uint32_t load_ma = 0;
+      n_cut = 0;
+
+      // Every started job signals once, wait for all of them before deleting the semaphore
+      while (signaled < n_jobs) {
+        // Start as many pumps as the budget allows, keeping the queue order
+        while (next < n_jobs) {
+          auto& job = jobs[next];
+          uint32_t current = job.pump->current(job.cmd.pwm);
+          bool alone = load_ma == 0; // A pump above the budget still runs, alone
+          if (!alone && load_ma + current > budget_ma)
+            break;
+          if (int64_t left_us = deadline_us - esp_timer_get_time(); deadline_us >= 0 && job.run_us > left_us) {
+            job.run_us = std::max<int64_t>(left_us, 0);
+            n_cut++;
+            Serial.printf("Cutting pump %zu to %f s, its run would end past the deadline\n", job.cmd.pump_id,
+                          static_cast<float>(job.run_us) / S_2US);
+            if (job.run_us == 0) {
+              next++;
+              signaled++;
+              continue;
+            }
+          }
+          start(job);
+          load_ma += current;
+          next++;
+        }
+        if (signaled == n_jobs)
+          break;
+
+        // Sleep until a pump stops
+        xSemaphoreTake(finished, portMAX_DELAY);
+        signaled++;
+        for (size_t i = 0; i < next; i++) {
+          auto& job = jobs[i];
+          if (job.running && job.stopped) {
+            job.running = false;
+            job.pump->stop_pump();
+            esp_timer_delete(job.timer);
+            load_ma -= job.pump->current(job.cmd.pwm);
+          }
+        }
+      }
+
+      vSemaphoreDelete(finished);
+    }
+
+    size_t size() const { return n_jobs; }
+
+    // Number of runs of the last run() cut short, or not started at all, to stop by the deadline
+    size_t cut_short() const { return n_cut; }
+    const Job& job(size_t i) const { return jobs[i]; }
+
+    /**
+     * What a finished job actually did
+     */
+    static PumpRun run_of(const Job& job) {
+      float time = (job.stopped) ? static_cast<float>(job.stopped_us - job.started_us) / S_2US : 0.0f;
+      return PumpRun{job.cmd.pump_id, time, job.cmd.pwm};
+    }
+
+  private:
+    uint32_t budget_ma;
+    unsigned int freq;
+    Job jobs[MAX_JOBS];
+    size_t n_jobs = 0;
+    size_t n_cut = 0;
+    SemaphoreHandle_t finished = nullptr;
+    StaticSemaphore_t finished_buffer;
+
+    void start(Job& job) {
+      Serial.printf("Running pump %zu for %f s at %u %% ...\n", job.cmd.pump_id, static_cast<float>(job.run_us) / S_2US,
+                    job.cmd.pwm);
+      esp_timer_create_args_t args{};
+      args.callback = &PumpScheduler::on_timeout;
+      args.arg = &job;
+      args.name = "pump";
+      esp_timer_create(&args, &job.timer);
+
+      job.running = true;
+      job.pump->setup_pump(freq);
+      job.pump->start_pump(job.cmd);
+      job.started_us = esp_timer_get_time();
+      esp_timer_start_once(job.timer, static_cast<uint64_t>(job.run_us));
+    }
+
+    static void on_timeout(void* arg) {
+      auto& job = *static_cast<Job*>(arg);
+      job.pump->cut_pump();
+      job.stopped_us = esp_timer_get_time();
+      job.stopped = true;
+      xSemaphoreGive(job.scheduler->finished);
+    }
+  };
+
+} // namespace meltwin
+
+#endif
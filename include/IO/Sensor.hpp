@@ -2,45 +2,66 @@
 #define SENSOR_HPP
 
 #include <Arduino.h>
+#include "IO/AdcSampler.hpp"
 
 namespace meltwin {
 
+  struct SensorReading {
+    unsigned int sensor_id = 0;
+    float value = 0.0;
+    time_t timestamp = 0; // Seconds since epoch
+  };
+
+  /**
+   * Wiring and scale of an analog sensor, as an entry of a device table (see DeviceTable.hpp)
+   */
+  struct SensorSpec {
+    gpio_num_t data;                 // ADC pin
+    gpio_num_t enable = GPIO_NUM_NC; // Powers the sensor while HIGH, the sensor is always on without one
+    float min_value = 0.0f;          // Value at 0 V
+    float max_value = 1.0f;          // Value at AdcSampler::FULL_SCALE_MV
+    unsigned long warmup_ms = 1000;  // Delay between power on and reading, only with an enable pin
+    float deadband = 0.0f;           // Changes below this are not reported
+    AdcConfig adc{};
+  };
+
+  /**
+   * Sensor I of a device table. Everything about its wiring is known at compile time, so the pin checks are resolved
+   * by the compiler instead of on every call.
+   */
+  template <const auto& TABLE, size_t I>
   struct Sensor {
-    explicit Sensor(gpio_num_t _data, float min_real_value = 0.0, float max_real_value = 1.0,
-                    gpio_num_t _enb_pin = GPIO_NUM_NC) :
-        min_val(min_real_value), max_val(max_real_value), enb_pin(_enb_pin), data_pin(_data) {}
-
-    void setup_sensor() {
-      if (enb_pin != GPIO_NUM_NC)
-        pinMode(enb_pin, OUTPUT);
-      pinMode(data_pin, INPUT_PULLDOWN);
+    static constexpr const SensorSpec& SPEC{TABLE[I]};
+    static constexpr bool SWITCHED{SPEC.enable != GPIO_NUM_NC};
+    static constexpr unsigned long WARMUP_MS{(SWITCHED) ? SPEC.warmup_ms : 0};
+
+    static void setup() {
+      if constexpr (SWITCHED)
+        pinMode(SPEC.enable, OUTPUT);
+      pinMode(SPEC.data, INPUT_PULLDOWN);
     }
 
-    float read_sensor() {
-      // Sleep a bit to let the time to the sensor to intiate
-      if (enb_pin != GPIO_NUM_NC) {
-        digitalWrite(enb_pin, HIGH);
-        sleep(1.0);
-      }
-      auto measure = static_cast<float>(analogRead(data_pin)) / 1023;
-      if (enb_pin != GPIO_NUM_NC) {
-        sleep(0.1);
-        digitalWrite(enb_pin, LOW);
+    static void power_on() {
+      if constexpr (SWITCHED)
+        digitalWrite(SPEC.enable, HIGH);
+    }
+
+    static float sample() {
+      uint32_t millivolts;
+      if (!AdcSampler::read_mv(SPEC.data, SPEC.adc, millivolts)) {
+        Serial.printf("[Sensor] Couldn't read the ADC on pin %d\n", SPEC.data);
+        return NAN;
       }
+      auto measure = std::min(static_cast<float>(millivolts) / AdcSampler::FULL_SCALE_MV, 1.0f);
 
       // Convert measure to wanted value
-      return measure * max_val + (1 - measure) * min_val;
+      return measure * SPEC.max_value + (1 - measure) * SPEC.min_value;
     }
 
-    void cleanup() {
-      if (enb_pin != GPIO_NUM_NC)
-        digitalWrite(enb_pin, LOW);
+    static void power_off() {
+      if constexpr (SWITCHED)
+        digitalWrite(SPEC.enable, LOW);
     }
-
-  private:
-    float min_val, max_val;
-    gpio_num_t enb_pin;
-    gpio_num_t data_pin;
   };
 
 } // namespace meltwin
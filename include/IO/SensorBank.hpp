@@ -0,0 +1,269 @@
+#ifndef SENSOR_BANK_HPP
+#define SENSOR_BANK_HPP
+
+#include <Arduino.h>
+#include <array>
+#include <iterator>
+#include "IO/AdcSampler.hpp"
+#include "IO/DeviceTable.hpp"
+
+namespace meltwin {
+
+  /**
+   * Analog multiplexer (74HC4051 with 3 address lines, 74HC4067 with 4) in front of an ADC pin
+   */
+  struct MuxSpec {
+    gpio_num_t signal;                // Common pin, to an ADC
+    gpio_num_t address[4];            // S0 to S3, GPIO_NUM_NC past the address lines in use
+    gpio_num_t inhibit = GPIO_NUM_NC; // ~E, the mux is only enabled while scanning with one, always enabled without
+    AdcConfig adc{};
+  };
+
+  /**
+   * Power rail shared by the sensors of a group, with how long they take to be readable
+   */
+  struct SensorRail {
+    gpio_num_t enable;              // Powers the rail while HIGH
+    unsigned long warmup_ms = 1000; // Delay between power on and the first reading
+    uint32_t settle_us = 20;        // Delay between selecting a channel and reading it (mux and sensor output RC)
+  };
+
+  /**
+   * Sensor wired to a mux channel, as an entry of a bank table
+   */
+  struct MuxChannelSpec {
+    uint8_t channel;        // Mux input
+    uint8_t rail;           // Index of its power rail
+    float min_value = 0.0f; // Value at 0 V
+    float max_value = 1.0f; // Value at AdcSampler::FULL_SCALE_MV
+    float deadband = 0.0f;  // Changes below this are not reported
+  };
+
+  /**
+   * Scan order and wiring checks of a SensorBank, each check is a static_assert there
+   */
+  template <const auto& MUX, const auto& RAILS, const auto& CHANNELS>
+  struct SensorBankLayout {
+    static constexpr size_t COUNT{std::size(CHANNELS)};
+    static constexpr size_t RAIL_COUNT{std::size(RAILS)};
+
+    static constexpr uint8_t address_bits() {
+      uint8_t bits = 0;
+      while (bits < std::size(MUX.address) && MUX.address[bits] != GPIO_NUM_NC)
+        bits++;
+      return bits;
+    }
+
+    // Channels sorted by rail warm-up, then by rail, then by address
+    static constexpr std::array<size_t, COUNT> scan_order() {
+      std::array<size_t, COUNT> order{};
+      for (size_t i = 0; i < COUNT; i++)
+        order[i] = i;
+      auto before = [](size_t a, size_t b) {
+        const MuxChannelSpec &x = CHANNELS[a], &y = CHANNELS[b];
+        if (RAILS[x.rail].warmup_ms != RAILS[y.rail].warmup_ms)
+          return RAILS[x.rail].warmup_ms < RAILS[y.rail].warmup_ms;
+        return (x.rail != y.rail) ? x.rail < y.rail : x.channel < y.channel;
+      };
+      for (size_t i = 1; i < COUNT; i++)
+        for (size_t j = i; j > 0 && before(order[j], order[j - 1]); j--) {
+          size_t swapped = order[j];
+          order[j] = order[j - 1];
+          order[j - 1] = swapped;
+        }
+      return order;
+    }
+
+    static constexpr bool mux_pins_usable() {
+      if (Esp32Pins::adc_channel(MUX.signal) < 0 || address_bits() < 3)
+        return false;
+      if (MUX.inhibit != GPIO_NUM_NC && !Esp32Pins::can_output(MUX.inhibit))
+        return false;
+      for (size_t i = 0; i < std::size(MUX.address); i++) {
+        gpio_num_t pin = MUX.address[i];
+        if (i >= address_bits() && pin != GPIO_NUM_NC)
+          return false; // Address lines must be S0, S1...
+        if (i < address_bits() && (!Esp32Pins::can_output(pin) || pin == MUX.signal || pin == MUX.inhibit))
+          return false;
+        for (size_t j = i + 1; j < address_bits(); j++)
+          if (pin == MUX.address[j])
+            return false;
+      }
+      return true;
+    }
+
+    static constexpr bool rails_usable() {
+      for (size_t r = 0; r < RAIL_COUNT; r++) {
+        gpio_num_t pin = RAILS[r].enable;
+        if (!Esp32Pins::can_output(pin) || pin == MUX.signal || pin == MUX.inhibit)
+          return false;
+        for (uint8_t bit = 0; bit < address_bits(); bit++)
+          if (pin == MUX.address[bit])
+            return false;
+        for (size_t other = r + 1; other < RAIL_COUNT; other++)
+          if (pin == RAILS[other].enable)
+            return false;
+
+        bool used = false;
+        for (const MuxChannelSpec& spec : CHANNELS)
+          used = used || spec.rail == r;
+        if (!used)
+          return false;
+      }
+      return true;
+    }
+
+    static constexpr bool channels_valid() {
+      for (size_t i = 0; i < COUNT; i++) {
+        if (CHANNELS[i].channel >= (1U << address_bits()) || CHANNELS[i].rail >= RAIL_COUNT)
+          return false;
+        for (size_t j = i + 1; j < COUNT; j++)
+          if (CHANNELS[i].channel == CHANNELS[j].channel)
+            return false;
+      }
+      return true;
+    }
+  };
+
+  /**
+   * Sensors read through an analog multiplexer, with one warm-up per power rail instead of one per sensor.
+   */
+  template <const auto& MUX, const auto& RAILS, const auto& CHANNELS>
+  struct SensorBank : SensorBankLayout<MUX, RAILS, CHANNELS> {
+    using Layout = SensorBankLayout<MUX, RAILS, CHANNELS>;
+    static constexpr size_t COUNT{Layout::COUNT};
+    static constexpr size_t RAIL_COUNT{Layout::RAIL_COUNT};
+    static constexpr bool ON_ADC2{Esp32Pins::on_adc2(MUX.signal)};
+
+    static void setup() {
+      for (uint8_t bit = 0; bit < ADDRESS_BITS; bit++)
+        pinMode(MUX.address[bit], OUTPUT);
+      if constexpr (MUX.inhibit != GPIO_NUM_NC) {
+        pinMode(MUX.inhibit, OUTPUT);
+        digitalWrite(MUX.inhibit, HIGH);
+      }
+      for (const SensorRail& rail : RAILS)
+        pinMode(rail.enable, OUTPUT);
+      pinMode(MUX.signal, INPUT_PULLDOWN);
+    }
+
+    /**
+     * Power, wait for and read every sensor of the bank, already set up
+     * @param values receives the value of each sensor (same order as the channels table)
+     */
+    static void read_all(float* values) {
+      unsigned long started = millis();
+      for (const SensorRail& rail : RAILS)
+        digitalWrite(rail.enable, HIGH);
+      if constexpr (MUX.inhibit != GPIO_NUM_NC)
+        digitalWrite(MUX.inhibit, LOW);
+
+      int selected = -1;
+      size_t rail = RAIL_COUNT;
+      for (size_t i : SCAN_ORDER) {
+        const MuxChannelSpec& spec = CHANNELS[i];
+        if (spec.rail != rail) {
+          if (rail < RAIL_COUNT)
+            digitalWrite(RAILS[rail].enable, LOW);
+          rail = spec.rail;
+          if (unsigned long elapsed = millis() - started; elapsed < RAILS[rail].warmup_ms)
+            delay(RAILS[rail].warmup_ms - elapsed);
+        }
+
+        select(spec.channel, selected);
+        delayMicroseconds(RAILS[rail].settle_us);
+        values[i] = sample(spec);
+      }
+
+      if (rail < RAIL_COUNT)
+        digitalWrite(RAILS[rail].enable, LOW);
+      if constexpr (MUX.inhibit != GPIO_NUM_NC)
+        digitalWrite(MUX.inhibit, HIGH);
+    }
+
+    static constexpr std::array<float, COUNT> deadbands() {
+      std::array<float, COUNT> deadbands{};
+      for (size_t i = 0; i < COUNT; i++)
+        deadbands[i] = CHANNELS[i].deadband;
+      return deadbands;
+    }
+
+    static constexpr bool uses_pin(gpio_num_t pin) {
+      if (pin == GPIO_NUM_NC)
+        return false;
+      if (pin == MUX.signal || pin == MUX.inhibit)
+        return true;
+      for (const gpio_num_t address : MUX.address)
+        if (pin == address)
+          return true;
+      for (const SensorRail& rail : RAILS)
+        if (pin == rail.enable)
+          return true;
+      return false;
+    }
+
+    /**
+     * Whether none of the bank pins is used by a DeviceTable (or another bank)
+     */
+    template <typename Table>
+    static constexpr bool shares_no_pin_with() {
+      bool shared = Table::uses_pin(MUX.signal) || Table::uses_pin(MUX.inhibit);
+      for (const gpio_num_t address : MUX.address)
+        shared = shared || Table::uses_pin(address);
+      for (const SensorRail& rail : RAILS)
+        shared = shared || Table::uses_pin(rail.enable);
+      return !shared;
+    }
+
+  private:
+    static constexpr uint8_t ADDRESS_BITS{Layout::address_bits()};
+
+    static constexpr std::array<size_t, COUNT> SCAN_ORDER{Layout::scan_order()};
+
+    // Only toggle the address lines that differ from the selected channel
+    static void select(uint8_t channel, int& selected) {
+      for (uint8_t bit = 0; bit < ADDRESS_BITS; bit++)
+        if (selected < 0 || ((selected ^ channel) >> bit & 1))
+          digitalWrite(MUX.address[bit], (channel >> bit & 1) ? HIGH : LOW);
+      selected = channel;
+    }
+
+    static float sample(const MuxChannelSpec& spec) {
+      uint32_t millivolts;
+      if (!AdcSampler::read_mv(MUX.signal, MUX.adc, millivolts)) {
+        Serial.printf("[Sensor] Couldn't read the ADC on pin %d (mux channel %u)\n", MUX.signal, spec.channel);
+        return NAN;
+      }
+      auto measure = std::min(static_cast<float>(millivolts) / AdcSampler::FULL_SCALE_MV, 1.0f);
+      return measure * spec.max_value + (1 - measure) * spec.min_value;
+    }
+
+    static_assert(Layout::mux_pins_usable(), "Mux signal pin without an ADC channel, less than 3 address lines, or "
+                                             "address pins that can't drive an output, aren't S0, S1... or are shared");
+    static_assert(Layout::rails_usable(),
+                  "Rail enable pin that can't drive an output, is already used, or powers no channel");
+    static_assert(Layout::channels_valid(),
+                  "Mux channel out of the address range, used twice, or on a rail that doesn't exist");
+  };
+
+  /**
+   * Stand-in for a SensorBank on boards without a mux
+   */
+  struct NoSensorBank {
+    static constexpr size_t COUNT{0};
+    static constexpr bool ON_ADC2{false};
+
+    static void setup() {}
+    static void read_all(float*) {}
+    static constexpr std::array<float, 0> deadbands() { return {}; }
+    static constexpr bool uses_pin(gpio_num_t) { return false; }
+
+    template <typename Table>
+    static constexpr bool shares_no_pin_with() {
+      return true;
+    }
+  };
+
+} // namespace meltwin
+
+#endif
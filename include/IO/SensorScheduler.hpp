@@ -0,0 +1,110 @@
+#ifndef SENSOR_SCHEDULER_HPP
+#define SENSOR_SCHEDULER_HPP
+
+#include <Arduino.h>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include "IO/DeviceTable.hpp"
+#include "IO/Sensor.hpp"
+
+namespace meltwin {
+
+  enum class AdcUnit : uint8_t { ANY, ADC1, ADC2 };
+
+  /**
+   * Read the sensors of a device table with overlapping warm-ups. Sensors wired to the same data pin form a lane,
+   * of which only one sensor is powered at a time.
+   */
+  template <const auto& SENSORS>
+  struct SensorScheduler {
+    static constexpr size_t COUNT{std::size(SENSORS)};
+
+    /**
+     * Power, wait for and read every sensor of an ADC unit, already set up. The values of the other sensors are left
+     * as is.
+     * @param values receives the value of each sensor (same order as the table)
+     */
+    template <AdcUnit UNIT = AdcUnit::ANY>
+    static void read_all(float* values) {
+      read_all<UNIT>(values, nullptr, std::make_index_sequence<COUNT>{});
+    }
+
+    /**
+     * Read every sensor in one pass, calling adc2_done as soon as the last ADC2 sensor has been read (e.g. to start
+     * the WiFi) while the other sensors go on
+     */
+    static void read_all(float* values, void (*adc2_done)(float* values)) {
+      read_all<AdcUnit::ANY>(values, adc2_done, std::make_index_sequence<COUNT>{});
+    }
+
+  private:
+    enum class State : uint8_t { PENDING, WARMING, DONE };
+
+    template <AdcUnit UNIT>
+    static constexpr bool accepts(size_t i) {
+      return UNIT == AdcUnit::ANY || Esp32Pins::on_adc2(SENSORS[i].data) == (UNIT == AdcUnit::ADC2);
+    }
+
+    template <AdcUnit UNIT, size_t... I>
+    static void read_all(float* values, void (*adc2_done)(float*), std::index_sequence<I...>) {
+      State states[]{((accepts<UNIT>(I)) ? State::PENDING : State::DONE)...};
+      unsigned long ready_at[COUNT]{};
+      size_t remaining = (0 + ... + size_t{accepts<UNIT>(I)});
+      size_t adc2_left = (0 + ... + size_t{accepts<UNIT>(I) && Esp32Pins::on_adc2(SENSORS[I].data)});
+
+      while (remaining > 0 || adc2_done != nullptr) {
+        if (adc2_done != nullptr && adc2_left == 0) {
+          adc2_done(values);
+          adc2_done = nullptr;
+          continue;
+        }
+        bool progressed = false;
+        unsigned long now = millis();
+        unsigned long next_wait = ~0UL;
+        (step<I>(states, ready_at, values, now, remaining, adc2_left, progressed, next_wait), ...);
+
+        // Nothing is ready, sleep until the next sensor is
+        if (!progressed && remaining > 0)
+          delay(next_wait);
+      }
+    }
+
+    template <size_t I>
+    static void step(State* states, unsigned long* ready_at, float* values, unsigned long now, size_t& remaining,
+                     size_t& adc2_left, bool& progressed, unsigned long& next_wait) {
+      using S = Sensor<SENSORS, I>;
+
+      // Start the warm-up as soon as the lane is free
+      if (states[I] == State::PENDING && !lane_busy<I>(states, std::make_index_sequence<COUNT>{})) {
+        S::power_on();
+        ready_at[I] = now + S::WARMUP_MS;
+        states[I] = State::WARMING;
+      }
+
+      if (states[I] != State::WARMING)
+        return;
+
+      // Read the sensor once warm, which frees its lane
+      if (static_cast<long>(now - ready_at[I]) >= 0) {
+        values[I] = S::sample();
+        S::power_off();
+        states[I] = State::DONE;
+        remaining--;
+        if (Esp32Pins::on_adc2(SENSORS[I].data))
+          adc2_left--;
+        progressed = true;
+      }
+      else
+        next_wait = std::min(next_wait, ready_at[I] - now);
+    }
+
+    template <size_t I, size_t... J>
+    static bool lane_busy(const State* states, std::index_sequence<J...>) {
+      return ((SENSORS[J].data == SENSORS[I].data && states[J] == State::WARMING) || ...);
+    }
+  };
+
+} // namespace meltwin
+
+#endif
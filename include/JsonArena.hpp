@@ -0,0 +1,112 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef JSON_ARENA_HPP
+#define JSON_ARENA_HPP
+
+#include <ArduinoJson.hpp>
+#include <cstdint>
+#include <cstring>
+#include "hardware_configs.h"
+
+namespace meltwin {
+
+  /**
+   * Allocator of the JSON documents, bumping a pointer in a static buffer instead of using the heap.
+   * It starts over once every block has been released. One instance per task making API calls.
+   */
+  struct JsonArena : ArduinoJson::Allocator {
+    static constexpr size_t CAPACITY{8192};
+    static constexpr size_t INSTANCES{1 + API_WORKERS}; // One for the Arduino and connect tasks, one per API worker
+
+    /**
+     * Arena of the calling task
+     */
+    static JsonArena& instance() { return arenas()[bound]; }
+
+    /**
+     * Forget the documents of every task, when no API call is running (see APIConnection::close())
+     */
+    static void reset() {
+      for (size_t i = 0; i < INSTANCES; i++)
+        arenas()[i].used = arenas()[i].last = arenas()[i].live = 0;
+    }
+
+    /**
+     * Make the calling task use its own arena from now on
+     */
+    static void bind(size_t index) { bound = static_cast<uint8_t>(index < INSTANCES ? index : 0); }
+
+    void* allocate(size_t size) override {
+      size_t needed = HEADER + align(size);
+      if (used + needed > CAPACITY)
+        return nullptr;
+      auto* header = buffer + used;
+      memcpy(header, &size, sizeof(size));
+      last = used;
+      used += needed;
+      live++;
+      return header + HEADER;
+    }
+
+    void deallocate(void* ptr) override {
+      if (ptr == nullptr)
+        return;
+      if (offset_of(ptr) == last)
+        used = last; // Give back the tail right away, it is usually the block that was just allocated
+      if (--live == 0)
+        used = last = 0;
+    }
+
+    void* reallocate(void* ptr, size_t size) override {
+      if (ptr == nullptr)
+        return allocate(size);
+
+      // The last block grows or shrinks in place
+      size_t offset = offset_of(ptr);
+      if (offset == last) {
+        if (offset + HEADER + align(size) > CAPACITY)
+          return nullptr;
+        memcpy(buffer + offset, &size, sizeof(size));
+        used = offset + HEADER + align(size);
+        return ptr;
+      }
+
+      size_t old_size;
+      memcpy(&old_size, buffer + offset, sizeof(old_size));
+      void* moved = allocate(size);
+      if (moved == nullptr)
+        return nullptr;
+      memcpy(moved, ptr, (size < old_size) ? size : old_size);
+      deallocate(ptr);
+      return moved;
+    }
+
+    size_t size() const { return used; }
+
+  private:
+    static constexpr size_t ALIGNMENT{8};
+    static constexpr size_t HEADER{ALIGNMENT}; // Block size, kept in front of each block
+
+    alignas(ALIGNMENT) uint8_t buffer[CAPACITY];
+    size_t used = 0;
+    size_t last = 0; // Offset of the last block header
+    size_t live = 0; // Blocks not released yet
+
+    inline static thread_local uint8_t bound = 0; // Instance of the task
+
+    JsonArena() = default;
+
+    static JsonArena* arenas() {
+      static JsonArena instances[INSTANCES];
+      return instances;
+    }
+
+    static constexpr size_t align(size_t size) { return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1); }
+    size_t offset_of(void* ptr) const { return static_cast<uint8_t*>(ptr) - buffer - HEADER; }
+  };
+
+} // namespace meltwin
+
+#endif // JSON_ARENA_HPP
@@ -0,0 +1,191 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef MOISTURE_TREND_HPP
+#define MOISTURE_TREND_HPP
+
+#include <Arduino.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include "common.hpp"
+#include "hardware_configs.h"
+
+namespace meltwin {
+
+  constexpr size_t PLANT_COUNT{PLANT_SENSORS};
+
+  /**
+   * Smoothed moisture level and drying rate of a plant (double exponential smoothing)
+   */
+  struct PlantTrend {
+    float level;       // Smoothed moisture, on the sensor scale
+    float slope_per_s; // Moisture change rate, negative while drying
+    float variance;    // Variance of the prediction error
+    time_t updated_at; // Time of the last reading, in seconds
+    uint16_t samples;  // Readings taken into account, saturates
+    uint16_t missed;   // Unusable readings in a row, saturates
+    uint16_t declined; // Reports in a row that found the plant dry without watering it
+    time_t held_until; // Not reported as dry again before then
+  };
+
+  struct TrendState {
+    uint32_t magic;
+    PlantTrend plants[PLANT_COUNT];
+  };
+
+  /**
+   * Moisture level and drying rate of each pumped plant, kept in RTC memory to plan the next wake.
+   * A sudden rise is taken as a watering. A plant found dry but not watered is left out for a growing while.
+   */
+  struct MoistureTrend {
+    static constexpr uint32_t MAGIC{0x74726E32};     // "trn2"
+    static constexpr float LEVEL_TAU_S{1800.0f};     // Smoothing time constant of the level
+    static constexpr float SLOPE_TAU_S{4 * 3600.0f}; // Smoothing time constant of the drying rate
+    static constexpr float WATERING_RISE{0.05f};     // Rise above the prediction taken as a watering
+    static constexpr float MARGIN_SIGMAS{2.0f};      // Prediction error kept as a margin above the threshold
+    static constexpr float SAFETY_FACTOR{0.5f};      // Fraction of the predicted time to threshold actually slept
+    static constexpr uint16_t MIN_SAMPLES{4};        // Readings needed before trusting the trend
+    static constexpr float RAIL_MARGIN{0.01f};       // Readings closer to an end of the scale come from a bad sensor
+    static constexpr uint16_t MAX_MISSED{3};         // Unusable readings in a row after which a plant is left out
+    static_assert(PLANT_COUNT <= 32, "Plants are selected by a 32-bit mask");
+
+    /**
+     * @param _pumped bit mask of the plants that have a pump
+     */
+    static void init(uint32_t _pumped) {
+      pumped = _pumped;
+      if (rtc_trend.magic != MAGIC) {
+        rtc_trend = TrendState{};
+        rtc_trend.magic = MAGIC;
+      }
+    }
+
+    /**
+     * Take a new reading of a plant into account
+     * @param plant the plant index, below PLANT_COUNT
+     * @param value the moisture reading, skipped if not finite (failed read) or at a rail (unplugged or shorted sensor)
+     * @param timestamp the time of the reading, in seconds
+     */
+    static void update(size_t plant, float value, time_t timestamp) {
+      if (plant >= PLANT_COUNT)
+        return;
+      auto& trend = rtc_trend.plants[plant];
+      if (!std::isfinite(value) || value < RAIL_MARGIN || value > 1.0f - RAIL_MARGIN) {
+        if (trend.missed < UINT16_MAX)
+          trend.missed++;
+        return;
+      }
+      trend.missed = 0;
+      auto dt = static_cast<float>(timestamp - trend.updated_at);
+      if (trend.samples == 0 || dt <= 0.0f || dt > SLOPE_TAU_S) {
+        // First reading, or the clock jumped: start over from this reading
+        float slope = (trend.samples == 0) ? 0.0f : trend.slope_per_s;
+        trend = PlantTrend{value, slope, 0.0f, timestamp, 1, 0, trend.declined, trend.held_until};
+        return;
+      }
+
+      float predicted = trend.level + trend.slope_per_s * dt;
+      float error = value - predicted;
+      if (error > WATERING_RISE) {
+        trend.level = value;
+        trend.updated_at = timestamp;
+        trend.declined = 0;
+        trend.held_until = 0;
+        return;
+      }
+
+      float alpha = 1.0f - std::exp(-dt / LEVEL_TAU_S);
+      float beta = 1.0f - std::exp(-dt / SLOPE_TAU_S);
+      float level = predicted + alpha * error;
+      trend.slope_per_s = (1.0f - beta) * trend.slope_per_s + beta * (level - trend.level) / dt;
+      trend.level = level;
+      trend.variance = (1.0f - alpha) * (trend.variance + alpha * error * error);
+      trend.updated_at = timestamp;
+      if (trend.samples < UINT16_MAX)
+        trend.samples++;
+    }
+
+    /**
+     * Seconds until a plant is predicted to need water, with its error margin
+     * @return 0 if it may already need water, a negative value if it isn't drying or its trend is not known yet
+     */
+    static float time_to_threshold(size_t plant, time_t now) {
+      const auto& trend = rtc_trend.plants[plant];
+      if (trend.samples < MIN_SAMPLES)
+        return -1.0f;
+      float level = trend.level + trend.slope_per_s * static_cast<float>(now - trend.updated_at);
+      float headroom = level - MARGIN_SIGMAS * std::sqrt(trend.variance) - MOISTURE_THRESHOLD;
+      if (headroom <= 0.0f)
+        return 0.0f;
+      if (trend.slope_per_s >= 0.0f)
+        return -1.0f;
+      return headroom / -trend.slope_per_s;
+    }
+
+    /**
+     * Whether a plant may need water now, in which case the readings should be reported right away
+     */
+    static bool watering_due(time_t now) {
+      for (size_t i = 0; i < PLANT_COUNT; i++)
+        if (counted(i) && time_to_threshold(i, now) == 0.0f && now >= rtc_trend.plants[i].held_until)
+          return true;
+      return false;
+    }
+
+    /**
+     * Hold back the dry plants a report didn't water, e.g. declined by the server, for SLEEP_MIN_S doubled on each
+     * such report in a row, up to SLEEP_MAX_S
+     * @param watered bit mask of the plants watered during the wake
+     */
+    static void watering_done(time_t now, uint32_t watered) {
+      for (size_t i = 0; i < PLANT_COUNT; i++) {
+        auto& trend = rtc_trend.plants[i];
+        if ((watered >> i) & 1U) {
+          trend.declined = 0;
+          trend.held_until = 0;
+        }
+        else if (counted(i) && time_to_threshold(i, now) == 0.0f && now >= trend.held_until) {
+          time_t hold_s = static_cast<time_t>(SLEEP_MIN_S) << std::min<uint16_t>(trend.declined, 16);
+          trend.held_until = now + std::min<time_t>(hold_s, SLEEP_MAX_S);
+          if (trend.declined < UINT16_MAX)
+            trend.declined++;
+        }
+      }
+    }
+
+    /**
+     * Duration of the next deep sleep, DEEP_SLEEP_DURATION_S until every plant trend is known
+     */
+    static uint64_t next_sleep_us(time_t now) {
+      float sleep_s = SLEEP_MAX_S;
+      for (size_t i = 0; i < PLANT_COUNT; i++) {
+        if (!counted(i))
+          continue;
+        const auto& trend = rtc_trend.plants[i];
+        if (trend.samples < MIN_SAMPLES)
+          return DEEP_SLEEP_DURATION;
+        if (float t = time_to_threshold(i, now); t >= 0.0f)
+          sleep_s = std::min(sleep_s, std::max(t * SAFETY_FACTOR, static_cast<float>(trend.held_until - now)));
+      }
+      return static_cast<uint64_t>(std::clamp<float>(sleep_s, SLEEP_MIN_S, SLEEP_MAX_S)) * S_2US;
+    }
+
+    static const PlantTrend& plant(size_t plant) { return rtc_trend.plants[plant]; }
+
+  private:
+    inline static RTC_DATA_ATTR TrendState rtc_trend;
+    inline static uint32_t pumped = 0;
+
+    // Plants with a pump and a working sensor
+    static bool counted(size_t plant) {
+      const auto& trend = rtc_trend.plants[plant];
+      return ((pumped >> plant) & 1U) && trend.samples > 0 && trend.missed < MAX_MISSED;
+    }
+  };
+
+} // namespace meltwin
+
+#endif // MOISTURE_TREND_HPP
@@ -0,0 +1,276 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef PAYLOAD_HPP
+#define PAYLOAD_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace meltwin {
+
+  enum class PayloadFormat : uint8_t { URLENCODED, CBOR };
+
+  /**
+   * Binary value, sent as a CBOR byte string, or as base64url text without padding (RFC 4648) in a form
+   */
+  struct PayloadBytes {
+    const uint8_t* data;
+    size_t size;
+  };
+
+  /**
+   * Request body, form-urlencoded or CBOR, written into a caller provided buffer.
+   * If the buffer is too small, the payload stops growing and overflowed() is set.
+   */
+  struct Payload {
+    explicit Payload(uint8_t* _buffer, size_t _capacity, PayloadFormat _format = PayloadFormat::URLENCODED) :
+        buffer(_buffer), capacity(_capacity), format(_format) {
+      if (format == PayloadFormat::CBOR)
+        put(0xBF); // Indefinite length map, closed by finish()
+    }
+
+    template <typename T>
+    void add_data(const char* param, const T& value) {
+      begin_field();
+      write_text(param, strlen(param));
+      end_key();
+      write_value(value);
+    }
+
+    /**
+     * Add a field of an indexed list, under the key "list[index][field]"
+     */
+    template <typename T>
+    void add_item(const char* list, size_t index, const char* field, const T& value) {
+      char digits[20];
+      size_t n_digits = to_digits(index, digits);
+      size_t list_len = strlen(list), field_len = strlen(field);
+
+      begin_field();
+      if (format == PayloadFormat::CBOR)
+        write_cbor_head(3, list_len + n_digits + field_len + 4);
+      write(list, list_len);
+      put('[');
+      write(digits, n_digits);
+      write("][", 2);
+      write(field, field_len);
+      put(']');
+      end_key();
+      write_value(value);
+    }
+
+    /**
+     * Close the payload, to be called once every field has been added
+     */
+    Payload& finish() {
+      if (format == PayloadFormat::CBOR && !finished)
+        put(0xFF);
+      finished = true;
+      return *this;
+    }
+
+    uint8_t* data() { return buffer; }
+    size_t size() const { return length; }
+    bool overflowed() const { return overflow; }
+    const char* content_type() const {
+      return (format == PayloadFormat::CBOR) ? "application/cbor" : "application/x-www-form-urlencoded";
+    }
+
+  private:
+    uint8_t* buffer;
+    size_t capacity;
+    size_t length = 0;
+    PayloadFormat format;
+    bool overflow = false;
+    bool finished = false;
+
+    // Raw output
+    void put(uint8_t byte) {
+      if (length < capacity)
+        buffer[length++] = byte;
+      else
+        overflow = true;
+    }
+
+    void write(const void* data, size_t n) {
+      if (length + n > capacity) {
+        overflow = true;
+        return;
+      }
+      memcpy(buffer + length, data, n);
+      length += n;
+    }
+
+    static size_t to_digits(uint64_t value, char* out) {
+      char reversed[20];
+      size_t n = 0;
+      do {
+        reversed[n++] = '0' + value % 10;
+        value /= 10;
+      } while (value > 0);
+      for (size_t i = 0; i < n; i++)
+        out[i] = reversed[n - 1 - i];
+      return n;
+    }
+
+    // Field structure
+    void begin_field() {
+      if (format == PayloadFormat::URLENCODED && length > 0)
+        put('&');
+    }
+
+    void end_key() {
+      if (format == PayloadFormat::URLENCODED)
+        put('=');
+    }
+
+    void write_text(const char* text, size_t n) {
+      if (format == PayloadFormat::CBOR) {
+        write_cbor_head(3, n);
+        write(text, n);
+        return;
+      }
+
+      // Percent-encode everything but unreserved characters
+      static constexpr char HEX[]{"0123456789ABCDEF"};
+      for (size_t i = 0; i < n; i++) {
+        auto c = static_cast<uint8_t>(text[i]);
+        if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~')
+          put(c);
+        else {
+          put('%');
+          put(HEX[c >> 4]);
+          put(HEX[c & 0x0F]);
+        }
+      }
+    }
+
+    // Values
+    void write_value(const char* value) { write_text(value, strlen(value)); }
+    void write_value(char* value) { write_value(static_cast<const char*>(value)); }
+    void write_value(bool value) { write_value(static_cast<unsigned int>(value)); }
+
+    void write_value(const PayloadBytes& value) {
+      if (format == PayloadFormat::CBOR) {
+        write_cbor_head(2, value.size);
+        write(value.data, value.size);
+        return;
+      }
+
+      // The base64url alphabet only has unreserved characters, no percent-encoding needed
+      static constexpr char ALPHABET[]{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"};
+      for (size_t i = 0; i < value.size; i += 3) {
+        uint32_t group = value.data[i] << 16;
+        if (i + 1 < value.size)
+          group |= value.data[i + 1] << 8;
+        if (i + 2 < value.size)
+          group |= value.data[i + 2];
+        size_t chars = std::min<size_t>(value.size - i, 3) + 1;
+        for (size_t c = 0; c < chars; c++)
+          put(ALPHABET[(group >> (18 - 6 * c)) & 0x3F]);
+      }
+    }
+
+    template <typename T>
+    void write_value(const T& value) {
+      static_assert(std::is_arithmetic_v<T>, "Payload values must be text or numbers");
+      if constexpr (std::is_floating_point_v<T>)
+        write_float(static_cast<float>(value));
+      else if constexpr (std::is_signed_v<T>)
+        write_signed(static_cast<int64_t>(value));
+      else
+        write_unsigned(static_cast<uint64_t>(value));
+    }
+
+    void write_unsigned(uint64_t value) {
+      if (format == PayloadFormat::CBOR) {
+        write_cbor_head(0, value);
+        return;
+      }
+      char digits[20];
+      write(digits, to_digits(value, digits));
+    }
+
+    void write_signed(int64_t value) {
+      if (value >= 0) {
+        write_unsigned(static_cast<uint64_t>(value));
+        return;
+      }
+      auto magnitude = static_cast<uint64_t>(-(value + 1)); // CBOR negative integers encode -1 - n
+      if (format == PayloadFormat::CBOR) {
+        write_cbor_head(1, magnitude);
+        return;
+      }
+      put('-');
+      write_unsigned(magnitude + 1);
+    }
+
+    void write_float(float value) {
+      if (format == PayloadFormat::CBOR) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        put(0xFA); // Single precision float
+        for (int shift = 24; shift >= 0; shift -= 8)
+          put(static_cast<uint8_t>(bits >> shift));
+        return;
+      }
+
+      // Fixed point with 6 decimals, trailing zeros removed
+      if (!std::isfinite(value) || std::fabs(value) >= 1e12f) {
+        write("nan", 3);
+        return;
+      }
+      if (value < 0) {
+        put('-');
+        value = -value;
+      }
+      auto scaled = static_cast<uint64_t>(std::llround(static_cast<double>(value) * 1000000.0));
+      write_unsigned(scaled / 1000000);
+      auto decimals = static_cast<uint32_t>(scaled % 1000000);
+      if (decimals == 0)
+        return;
+      char digits[6];
+      for (int i = 5; i >= 0; i--, decimals /= 10)
+        digits[i] = '0' + decimals % 10;
+      size_t n = 6;
+      while (digits[n - 1] == '0')
+        n--;
+      put('.');
+      write(digits, n);
+    }
+
+    void write_cbor_head(uint8_t major, uint64_t value) {
+      major <<= 5;
+      if (value < 24)
+        put(major | value);
+      else if (value <= 0xFF) {
+        put(major | 24);
+        put(value);
+      }
+      else if (value <= 0xFFFF) {
+        put(major | 25);
+        put(value >> 8);
+        put(value);
+      }
+      else if (value <= 0xFFFFFFFF) {
+        put(major | 26);
+        for (int shift = 24; shift >= 0; shift -= 8)
+          put(value >> shift);
+      }
+      else {
+        put(major | 27);
+        for (int shift = 56; shift >= 0; shift -= 8)
+          put(value >> shift);
+      }
+    }
+  };
+
+} // namespace meltwin
+
+#endif // PAYLOAD_HPP
@@ -0,0 +1,260 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef READING_BUFFER_HPP
+#define READING_BUFFER_HPP
+
+#include <Arduino.h>
+#include <algorithm>
+#include <cstddef>
+#include <esp_partition.h>
+#include "IO/Sensor.hpp"
+#include "hardware_configs.h"
+
+namespace meltwin {
+
+  constexpr size_t RTC_READINGS_CAPACITY{64};
+
+  struct ReadingRing {
+    uint32_t magic;
+    uint16_t head;          // Next slot to write in items
+    uint16_t count;         // Readings held in items
+    uint32_t flash_head;    // Next record to write in the flash partition
+    uint32_t flash_count;   // Readings held in the flash partition
+    uint32_t pending_wakes; // Wakes buffered since the last flush
+    bool flush_failed;      // The last flush attempt failed, retry as soon as possible
+    SensorReading items[RTC_READINGS_CAPACITY];
+  };
+
+  // Fixed-size record so that a flash sector holds a whole number of readings
+  struct FlashReading {
+    uint16_t sensor_id; // All ones in an erased record
+    uint16_t state;     // Cleared on the last record of each chunk sent
+    float value;
+    int64_t timestamp;
+  };
+  static_assert(sizeof(FlashReading) == 16, "A flash sector must hold a whole number of readings");
+
+  /**
+   * Buffer of timestamped readings kept in RTC memory, spilled to the "readings" flash partition (a circular log)
+   * when full. The log can be found again from the partition if the RTC memory is lost (see recover()).
+   */
+  struct ReadingBuffer {
+    static constexpr uint32_t MAGIC{0x72656432}; // "red2"
+    static constexpr size_t FLUSH_CHUNK{32};     // Max readings per upload request
+    static constexpr const char* PARTITION_LABEL{"readings"};
+    static constexpr size_t SECTOR_SIZE{4096};
+    static constexpr size_t RECORDS_PER_SECTOR{SECTOR_SIZE / sizeof(FlashReading)};
+    static constexpr uint16_t ERASED_ID{0xFFFF};
+    static constexpr uint16_t UNSENT{0xFFFF};
+    static constexpr uint16_t SENT{0x0000};
+    static constexpr size_t SCAN_BLOCK{16}; // Records read at once by recover()
+
+    static void init() {
+      if (rtc_readings.magic != MAGIC) {
+        rtc_readings = ReadingRing{};
+        rtc_readings.magic = MAGIC;
+        recover();
+      }
+    }
+
+    static size_t size() { return rtc_readings.count + rtc_readings.flash_count; }
+
+    /**
+     * Whether the readings of this wake should be sent, based on the buffered wakes and the age of the oldest reading
+     * @param now the current time, in seconds
+     */
+    static bool flush_due(time_t now) {
+      if (rtc_readings.flush_failed || rtc_readings.pending_wakes + 1 >= REPORT_EVERY_N_WAKES)
+        return true;
+      return size() > 0 && now - oldest() >= REPORT_MAX_AGE_S;
+    }
+
+    /**
+     * Buffer the readings of a wake
+     */
+    static void push(const SensorReading* readings, size_t count) {
+      for (size_t i = 0; i < count; i++) {
+        if (rtc_readings.count == RTC_READINGS_CAPACITY)
+          spill();
+        rtc_readings.items[rtc_readings.head] = readings[i];
+        rtc_readings.head = (rtc_readings.head + 1) % RTC_READINGS_CAPACITY;
+        rtc_readings.count++;
+      }
+      rtc_readings.pending_wakes++;
+    }
+
+    /**
+     * Send every buffered reading, oldest first, by chunks of FLUSH_CHUNK readings
+     * @param send callable taking (const SensorReading*, size_t) and returning true once the chunk is handled
+     * @return true if the buffer has been emptied
+     */
+    template <typename Sink>
+    static bool flush(Sink&& send) {
+      SensorReading chunk[FLUSH_CHUNK];
+
+      // Flash first, it holds the oldest readings
+      const esp_partition_t* partition = flash();
+      while (partition != nullptr && rtc_readings.flash_count > 0) {
+        size_t n = std::min(FLUSH_CHUNK, static_cast<size_t>(rtc_readings.flash_count));
+        uint32_t first = flash_tail(partition);
+        for (size_t i = 0; i < n; i++) {
+          FlashReading record;
+          esp_partition_read(partition, ((first + i) % flash_capacity(partition)) * sizeof(FlashReading), &record,
+                             sizeof(record));
+          chunk[i] = SensorReading{record.sensor_id, record.value, static_cast<time_t>(record.timestamp)};
+        }
+        if (!send(static_cast<const SensorReading*>(chunk), n))
+          return flush_failed();
+        uint16_t sent = SENT;
+        esp_partition_write(partition,
+                            ((first + n - 1) % flash_capacity(partition)) * sizeof(FlashReading) +
+                              offsetof(FlashReading, state),
+                            &sent, sizeof(sent));
+        rtc_readings.flash_count -= n;
+      }
+
+      // Then RTC memory
+      while (rtc_readings.count > 0) {
+        size_t n = std::min(FLUSH_CHUNK, static_cast<size_t>(rtc_readings.count));
+        size_t first = rtc_tail();
+        for (size_t i = 0; i < n; i++)
+          chunk[i] = rtc_readings.items[(first + i) % RTC_READINGS_CAPACITY];
+        if (!send(static_cast<const SensorReading*>(chunk), n))
+          return flush_failed();
+        rtc_readings.count -= n;
+      }
+
+      rtc_readings.pending_wakes = 0;
+      rtc_readings.flush_failed = false;
+      return true;
+    }
+
+    /**
+     * Record that the readings couldn't be sent (e.g. no WiFi), so that the next wake tries again
+     */
+    static bool flush_failed() {
+      rtc_readings.flush_failed = true;
+      return false;
+    }
+
+  private:
+    inline static RTC_DATA_ATTR ReadingRing rtc_readings;
+
+    static size_t rtc_tail() {
+      return (rtc_readings.head + RTC_READINGS_CAPACITY - rtc_readings.count) % RTC_READINGS_CAPACITY;
+    }
+
+    static time_t oldest() {
+      if (const esp_partition_t* partition = flash(); partition != nullptr && rtc_readings.flash_count > 0) {
+        FlashReading record;
+        esp_partition_read(partition, flash_tail(partition) * sizeof(FlashReading), &record, sizeof(record));
+        return record.timestamp;
+      }
+      return rtc_readings.items[rtc_tail()].timestamp;
+    }
+
+    static const esp_partition_t* flash() {
+      static const esp_partition_t* partition =
+        esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, PARTITION_LABEL);
+      return partition;
+    }
+
+    static uint32_t flash_capacity(const esp_partition_t* partition) {
+      return (partition->size / SECTOR_SIZE) * RECORDS_PER_SECTOR;
+    }
+
+    static uint32_t flash_tail(const esp_partition_t* partition) {
+      uint32_t capacity = flash_capacity(partition);
+      return (rtc_readings.flash_head + capacity - rtc_readings.flash_count) % capacity;
+    }
+
+    static bool usable(const esp_partition_t* partition) {
+      return partition != nullptr && flash_capacity(partition) >= 2 * RECORDS_PER_SECTOR;
+    }
+
+    /**
+     * Find the flash log again after the RTC memory was lost (power loss, new firmware). The head is the erased record
+     * following a written one, and the readings left to send follow the last record marked as sent.
+     */
+    static void recover() {
+      const esp_partition_t* partition = flash();
+      if (!usable(partition))
+        return;
+      uint32_t capacity = flash_capacity(partition);
+      FlashReading block[SCAN_BLOCK];
+
+      FlashReading last;
+      esp_partition_read(partition, (capacity - 1) * sizeof(FlashReading), &last, sizeof(last));
+      bool previous_written = last.sensor_id != ERASED_ID;
+      bool head_found = false, any_erased = false;
+      for (uint32_t first = 0; first < capacity && !head_found; first += SCAN_BLOCK) {
+        esp_partition_read(partition, first * sizeof(FlashReading), block, sizeof(block));
+        for (uint32_t i = 0; i < SCAN_BLOCK && !head_found; i++) {
+          bool written = block[i].sensor_id != ERASED_ID;
+          any_erased |= !written;
+          if (!written && previous_written) {
+            rtc_readings.flash_head = first + i;
+            head_found = true;
+          }
+          previous_written = written;
+        }
+      }
+      if (!head_found) {
+        if (!any_erased) // Not a log, start a new one
+          esp_partition_erase_range(partition, 0, SECTOR_SIZE);
+        return;
+      }
+
+      // Distances from the head, in write order: the oldest written record, and the last one sent
+      uint32_t head = rtc_readings.flash_head;
+      uint32_t oldest = capacity, sent = capacity;
+      for (uint32_t first = 0; first < capacity; first += SCAN_BLOCK) {
+        esp_partition_read(partition, first * sizeof(FlashReading), block, sizeof(block));
+        for (uint32_t i = 0; i < SCAN_BLOCK; i++) {
+          if (block[i].sensor_id == ERASED_ID)
+            continue;
+          uint32_t distance = (first + i + capacity - head) % capacity;
+          oldest = std::min(oldest, distance);
+          if (block[i].state == SENT && (sent == capacity || distance > sent))
+            sent = distance;
+        }
+      }
+      uint32_t tail = (sent != capacity) ? sent + 1 : oldest;
+      rtc_readings.flash_count = (tail < capacity) ? capacity - tail : 0;
+      Serial.printf("[Readings] Recovered %u readings from flash\n",
+                    static_cast<unsigned int>(rtc_readings.flash_count));
+    }
+
+    /**
+     * Move the RTC readings to flash. Without a flash partition, the oldest RTC reading is dropped instead.
+     */
+    static void spill() {
+      const esp_partition_t* partition = flash();
+      if (!usable(partition)) {
+        rtc_readings.count--;
+        return;
+      }
+
+      uint32_t capacity = flash_capacity(partition);
+      while (rtc_readings.count > 0) {
+        const auto& reading = rtc_readings.items[rtc_tail()];
+        FlashReading record{static_cast<uint16_t>(reading.sensor_id), UNSENT, reading.value, reading.timestamp};
+        esp_partition_write(partition, rtc_readings.flash_head * sizeof(FlashReading), &record, sizeof(record));
+        rtc_readings.flash_head = (rtc_readings.flash_head + 1) % capacity;
+        rtc_readings.flash_count++;
+        rtc_readings.count--;
+
+        // Sector full: erase the next one, dropping the oldest readings if the log wrapped around
+        if (rtc_readings.flash_head % RECORDS_PER_SECTOR == 0) {
+          esp_partition_erase_range(partition, rtc_readings.flash_head * sizeof(FlashReading), SECTOR_SIZE);
+          rtc_readings.flash_count = std::min<uint32_t>(rtc_readings.flash_count, capacity - RECORDS_PER_SECTOR);
+        }
+      }
+    }
+  };
+
+} // namespace meltwin
+
+#endif // READING_BUFFER_HPP
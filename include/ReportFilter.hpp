@@ -0,0 +1,73 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef REPORT_FILTER_HPP
+#define REPORT_FILTER_HPP
+
+#include <Arduino.h>
+#include <cmath>
+#include <cstring>
+#include "IO/Sensor.hpp"
+#include "hardware_configs.h"
+
+namespace meltwin {
+
+  constexpr size_t REPORT_FILTER_SENSORS{24};
+
+  struct ReportedValues {
+    uint32_t magic;
+    float value[REPORT_FILTER_SENSORS];      // Last value kept for upload
+    time_t timestamp[REPORT_FILTER_SENSORS]; // Its time, 0 if nothing was kept yet
+  };
+
+  /**
+   * Deadband filter between the sensors and the reading buffer.
+   *
+   * A reading is only kept for upload when it moved by more than the deadband of its sensor since the last kept
+   * reading, or when REPORT_HEARTBEAT_S went by without any, so that the API can tell a steady sensor from a dead one.
+   * Non-finite readings (failed reads) are always kept, and never become the reference of the deadband.
+   */
+  struct ReportFilter {
+    static constexpr uint32_t MAGIC{0x64626E32}; // "dbn2"
+
+    static void init() {
+      if (rtc_reported.magic != MAGIC) {
+        memset(&rtc_reported, 0, sizeof(rtc_reported));
+        rtc_reported.magic = MAGIC;
+      }
+    }
+
+    /**
+     * Filter the readings of a wake in place
+     * @param readings the readings, the kept ones are moved to the front
+     * @param count the number of readings
+     * @param deadbands the deadband of each sensor, indexed by sensor id
+     * @return the number of readings kept
+     */
+    static size_t apply(SensorReading* readings, size_t count, const float* deadbands) {
+      size_t kept = 0;
+      for (size_t i = 0; i < count; i++) {
+        const auto& reading = readings[i];
+        auto id = reading.sensor_id;
+        if (id < REPORT_FILTER_SENSORS && rtc_reported.timestamp[id] != 0 &&
+            reading.timestamp - rtc_reported.timestamp[id] < REPORT_HEARTBEAT_S &&
+            std::fabs(reading.value - rtc_reported.value[id]) <= deadbands[id])
+          continue;
+
+        if (id < REPORT_FILTER_SENSORS && std::isfinite(reading.value)) { // A failed read is sent, not compared to
+          rtc_reported.value[id] = reading.value;
+          rtc_reported.timestamp[id] = reading.timestamp;
+        }
+        readings[kept++] = reading;
+      }
+      return kept;
+    }
+
+  private:
+    inline static RTC_DATA_ATTR ReportedValues rtc_reported;
+  };
+
+} // namespace meltwin
+
+#endif // REPORT_FILTER_HPP
@@ -0,0 +1,240 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef SERIES_CODEC_HPP
+#define SERIES_CODEC_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+namespace meltwin {
+
+  /**
+   * Bit writer into a caller provided buffer, most significant bit first. If the buffer is too small, the stream stops
+   * growing and overflowed() is set.
+   */
+  struct BitWriter {
+    BitWriter(uint8_t* _buffer, size_t _capacity) : buffer(_buffer), capacity(_capacity) {}
+
+    void write(uint64_t value, uint8_t bits) {
+      for (uint8_t i = bits; i > 0; i--)
+        put((value >> (i - 1)) & 1);
+    }
+
+    size_t size() const { return (length + 7) / 8; }
+    bool overflowed() const { return overflow; }
+
+  private:
+    uint8_t* buffer;
+    size_t capacity;
+    size_t length = 0; // In bits
+    bool overflow = false;
+
+    void put(bool bit) {
+      size_t byte = length / 8;
+      if (byte >= capacity) {
+        overflow = true;
+        return;
+      }
+      if (length % 8 == 0)
+        buffer[byte] = 0;
+      if (bit)
+        buffer[byte] |= 0x80 >> (length % 8);
+      length++;
+    }
+  };
+
+  /**
+   * Bit reader matching BitWriter. Reading past the end gives zeros and sets exhausted().
+   */
+  struct BitReader {
+    BitReader(const uint8_t* _data, size_t _size) : data(_data), size(_size) {}
+
+    uint64_t read(uint8_t bits) {
+      uint64_t value = 0;
+      for (uint8_t i = 0; i < bits; i++)
+        value = (value << 1) | get();
+      return value;
+    }
+
+    bool exhausted() const { return overrun; }
+
+  private:
+    const uint8_t* data;
+    size_t size;
+    size_t position = 0; // In bits
+    bool overrun = false;
+
+    uint8_t get() {
+      if (position / 8 >= size) {
+        overrun = true;
+        return 0;
+      }
+      uint8_t bit = (data[position / 8] >> (7 - position % 8)) & 1;
+      position++;
+      return bit;
+    }
+  };
+
+  /**
+   * Gorilla-style compression (Pelkonen et al., VLDB 2015) of 32-bit timestamps in seconds and float values.
+   *  - timestamps: '0' (same interval), '10' + 7 bits, '110' + 9 bits, '1110' + 12 bits or '1111' + 32 bits
+   *  - values: '0' (same value), '10' + bits within the previous window, or '11' + 5 bits of leading zeros + 5 bits of
+   *    length - 1 + the meaningful bits
+   */
+  struct SeriesEncoder {
+    static constexpr size_t MAX_POINT_BITS{(4 + 32) + (2 + 5 + 5 + 32)};
+
+    /**
+     * Buffer size needed for points, whichever way they are split in series
+     */
+    static constexpr size_t max_size(size_t points) { return (points * MAX_POINT_BITS + 7) / 8; }
+
+    /**
+     * Start a series, written after what the stream already holds
+     */
+    explicit SeriesEncoder(BitWriter& _bits) : bits(_bits) {}
+
+    void add(time_t timestamp, float value) {
+      uint32_t raw;
+      memcpy(&raw, &value, sizeof(raw));
+      if (count == 0) {
+        bits.write(static_cast<uint32_t>(timestamp), 32);
+        bits.write(raw, 32);
+      }
+      else {
+        int64_t delta = timestamp - last_time;
+        write_interval_change(delta - last_delta);
+        write_xor(raw ^ last_value);
+        last_delta = delta;
+      }
+      last_time = timestamp;
+      last_value = raw;
+      count++;
+    }
+
+    size_t points() const { return count; }
+
+  private:
+    BitWriter& bits;
+    size_t count = 0;
+    time_t last_time = 0;
+    int64_t last_delta = 0;
+    uint32_t last_value = 0;
+    uint8_t window_leading = 0;
+    uint8_t window_trailing = 0;
+    bool has_window = false;
+
+    void write_interval_change(int64_t change) {
+      if (change == 0)
+        bits.write(0b0, 1);
+      else if (change >= -64 && change < 64) {
+        bits.write(0b10, 2);
+        bits.write(static_cast<uint64_t>(change), 7);
+      }
+      else if (change >= -256 && change < 256) {
+        bits.write(0b110, 3);
+        bits.write(static_cast<uint64_t>(change), 9);
+      }
+      else if (change >= -2048 && change < 2048) {
+        bits.write(0b1110, 4);
+        bits.write(static_cast<uint64_t>(change), 12);
+      }
+      else {
+        bits.write(0b1111, 4);
+        bits.write(static_cast<uint64_t>(change), 32);
+      }
+    }
+
+    void write_xor(uint32_t x) {
+      if (x == 0) {
+        bits.write(0b0, 1);
+        return;
+      }
+      uint8_t leading = __builtin_clz(x), trailing = __builtin_ctz(x);
+      if (has_window && leading >= window_leading && trailing >= window_trailing) {
+        bits.write(0b10, 2);
+        bits.write(x >> window_trailing, 32 - window_leading - window_trailing);
+        return;
+      }
+      uint8_t meaningful = 32 - leading - trailing;
+      bits.write(0b11, 2);
+      bits.write(leading, 5);
+      bits.write(meaningful - 1, 5);
+      bits.write(x >> trailing, meaningful);
+      window_leading = leading;
+      window_trailing = trailing;
+      has_window = true;
+    }
+  };
+
+  /**
+   * Decoder of the SeriesEncoder format
+   */
+  struct SeriesDecoder {
+    explicit SeriesDecoder(BitReader& _bits) : bits(_bits) {}
+
+    /**
+     * Decode the next point
+     * @return false if the data ended before the point
+     */
+    bool next(time_t& timestamp, float& value) {
+      if (count == 0) {
+        last_time = static_cast<time_t>(bits.read(32));
+        last_value = static_cast<uint32_t>(bits.read(32));
+      }
+      else {
+        last_delta += read_interval_change();
+        last_time = static_cast<time_t>(static_cast<uint32_t>(last_time + last_delta));
+        last_value ^= read_xor();
+      }
+      count++;
+      timestamp = last_time;
+      memcpy(&value, &last_value, sizeof(value));
+      return !bits.exhausted();
+    }
+
+  private:
+    BitReader& bits;
+    size_t count = 0;
+    time_t last_time = 0;
+    int64_t last_delta = 0;
+    uint32_t last_value = 0;
+    uint8_t window_leading = 0;
+    uint8_t window_trailing = 0;
+
+    int64_t read_signed(uint8_t width) {
+      uint64_t raw = bits.read(width);
+      return (raw & (uint64_t{1} << (width - 1))) ? static_cast<int64_t>(raw) - (int64_t{1} << width)
+                                                   : static_cast<int64_t>(raw);
+    }
+
+    int64_t read_interval_change() {
+      if (bits.read(1) == 0)
+        return 0;
+      if (bits.read(1) == 0)
+        return read_signed(7);
+      if (bits.read(1) == 0)
+        return read_signed(9);
+      if (bits.read(1) == 0)
+        return read_signed(12);
+      return read_signed(32);
+    }
+
+    uint32_t read_xor() {
+      if (bits.read(1) == 0)
+        return 0;
+      if (bits.read(1) == 1) {
+        window_leading = static_cast<uint8_t>(bits.read(5));
+        uint8_t meaningful = static_cast<uint8_t>(bits.read(5)) + 1;
+        window_trailing = 32 - window_leading - meaningful;
+      }
+      return static_cast<uint32_t>(bits.read(32 - window_leading - window_trailing)) << window_trailing;
+    }
+  };
+
+} // namespace meltwin
+
+#endif // SERIES_CODEC_HPP
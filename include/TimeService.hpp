@@ -0,0 +1,165 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef TIME_SERVICE_HPP
+#define TIME_SERVICE_HPP
+
+#include <Arduino.h>
+#include <algorithm>
+#include <cmath>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+#include <sys/time.h>
+#include "datetime.h"
+#include "common.hpp"
+#include "hardware_configs.h"
+
+namespace meltwin {
+
+  struct ClockState {
+    uint32_t magic;
+    bool synced;                // Set by a first SNTP sync, the clock counts from 1970 at power-on until then
+    int64_t last_sync_us;       // Epoch time of the last SNTP sync
+    int64_t last_correction_us; // Epoch time at which the drift was last compensated
+    float drift_ppm;            // Estimated rate error of the RTC clock, positive when running fast
+    float error_ppm;            // Uncertainty on the drift estimate
+    int64_t first_sync_us;      // Epoch time of the first sync, the clock read less until then
+    int64_t unset_offset_us;    // What the first sync added to the clock
+    uint32_t failures;          // Failed syncs in a row
+    int64_t retry_us;           // Clock time before which no new sync is attempted
+  };
+
+  /**
+   * Wall clock kept by the RTC across deep sleep, its drift compensated on each wake and synced over SNTP only once the
+   * error may exceed TIME_MAX_ERROR_MS. Until the first sync, the clock counts from 1970 (see rebase()).
+   */
+  struct TimeService {
+    static constexpr uint32_t MAGIC{0x636C6B32};       // "clk2"
+    static constexpr float DEFAULT_ERROR_PPM{1500.0f}; // Uncalibrated RTC slow clock
+    static constexpr float MIN_ERROR_PPM{20.0f};       // Noise floor of the drift estimate
+    static constexpr int64_t MIN_CALIBRATION_US{10 * 60 * DateTime::US_PER_S}; // Shorter intervals are too noisy
+
+    /**
+     * Compensate the drift accumulated since the last wake, to be called at the beginning of each wake
+     */
+    static void begin() {
+      if (rtc_clock.magic != MAGIC)
+        rtc_clock = ClockState{MAGIC, false, 0, 0, 0.0f, DEFAULT_ERROR_PPM, 0, 0, 0, 0};
+      if (!synced())
+        return;
+      int64_t raw = epoch_us();
+      auto correction = static_cast<int64_t>(static_cast<double>(raw - rtc_clock.last_correction_us) *
+                                             rtc_clock.drift_ppm / 1e6);
+      set_epoch_us(raw - correction);
+      rtc_clock.last_correction_us = raw - correction;
+    }
+
+    static bool synced() { return rtc_clock.synced; }
+
+    static DateTime now() { return DateTime(epoch_us()); }
+
+    /**
+     * Time on the synced clock of a time taken before the first sync, in seconds. Later times are returned as is: they
+     * can't be earlier than the first sync, the clock counting from 1970 until then.
+     */
+    static time_t rebase(time_t time_s) {
+      if (!synced() || time_s * DateTime::US_PER_S >= rtc_clock.first_sync_us)
+        return time_s;
+      return static_cast<time_t>(time_s + rtc_clock.unset_offset_us / DateTime::US_PER_S);
+    }
+
+    /**
+     * Worst case error of the current time, in ms
+     */
+    static float estimated_error_ms() {
+      if (!synced())
+        return INFINITY;
+      return static_cast<float>(epoch_us() - rtc_clock.last_sync_us) * rtc_clock.error_ppm / 1e9f;
+    }
+
+    /**
+     * Whether the clock has to be synced during this wake, and the last failed sync was long enough ago
+     */
+    static bool sync_due() { return estimated_error_ms() > TIME_MAX_ERROR_MS && epoch_us() >= rtc_clock.retry_us; }
+
+    /**
+     * Sync the clock over SNTP and update the drift estimate. WiFi must be connected.
+     * @return false if no answer came within the timeout
+     */
+    static bool sync(uint32_t timeout_ms = TIME_SYNC_TIMEOUT_MS) {
+      sync_done = false;
+      int64_t raw_before = epoch_us();
+      int64_t started = esp_timer_get_time();
+
+      sntp_setoperatingmode(SNTP_OPMODE_POLL);
+      sntp_setservername(0, NTP_SERVER);
+      sntp_set_time_sync_notification_cb(&TimeService::on_sync);
+      sntp_init();
+      while (!sync_done && esp_timer_get_time() - started < static_cast<int64_t>(timeout_ms) * MS_2US)
+        delay(10);
+      sntp_stop();
+      if (!sync_done) {
+        // The server set no time, so the clock still reads raw_before plus the time spent here
+        int64_t backoff_s = std::min<int64_t>(int64_t{TIME_SYNC_RETRY_S} << std::min<uint32_t>(rtc_clock.failures, 16),
+                                              TIME_SYNC_RETRY_MAX_S);
+        rtc_clock.failures++;
+        rtc_clock.retry_us = epoch_us() + backoff_s * DateTime::US_PER_S;
+        Serial.printf("[Time] SNTP sync timed out, next attempt in %u s\n", static_cast<unsigned int>(backoff_s));
+        return false;
+      }
+      rtc_clock.failures = 0;
+      rtc_clock.retry_us = 0;
+
+      // What the local clock would read at the time of the answer, the esp_timer being accurate during a wake
+      int64_t raw = raw_before + (synced_at - started);
+      int64_t offset = raw - server_us;
+      if (!synced()) {
+        rtc_clock = ClockState{MAGIC, true, server_us, server_us, 0.0f, DEFAULT_ERROR_PPM, server_us, -offset, 0, 0};
+        Serial.println("[Time] First sync, RTC set");
+        return true;
+      }
+
+      int64_t elapsed = raw - rtc_clock.last_sync_us;
+      if (elapsed >= MIN_CALIBRATION_US) {
+        // The drift known so far has already been compensated, what is left refines the estimate
+        auto residual_ppm = static_cast<float>(static_cast<double>(offset) / elapsed * 1e6);
+        rtc_clock.drift_ppm += residual_ppm;
+        rtc_clock.error_ppm = std::max(std::fabs(residual_ppm), MIN_ERROR_PPM);
+      }
+      rtc_clock.last_sync_us = server_us;
+      rtc_clock.last_correction_us = server_us;
+      Serial.printf("[Time] Synced, clock was %lld ms off (drift %.1f ppm)\n", static_cast<long long>(offset / 1000),
+                    rtc_clock.drift_ppm);
+      return true;
+    }
+
+  private:
+    inline static RTC_DATA_ATTR ClockState rtc_clock;
+
+    inline static volatile bool sync_done = false;
+    inline static int64_t synced_at = 0; // esp_timer time of the answer
+    inline static int64_t server_us = 0; // Epoch time given by the server
+
+    static int64_t epoch_us() {
+      timeval tv{};
+      gettimeofday(&tv, nullptr);
+      return static_cast<int64_t>(tv.tv_sec) * DateTime::US_PER_S + tv.tv_usec;
+    }
+
+    static void set_epoch_us(int64_t us) {
+      timeval tv{static_cast<time_t>(us / DateTime::US_PER_S), static_cast<suseconds_t>(us % DateTime::US_PER_S)};
+      settimeofday(&tv, nullptr);
+    }
+
+    // Called from the lwIP task once the system time has been set
+    static void on_sync(timeval* tv) {
+      synced_at = esp_timer_get_time();
+      server_us = static_cast<int64_t>(tv->tv_sec) * DateTime::US_PER_S + tv->tv_usec;
+      sync_done = true;
+    }
+  };
+
+} // namespace meltwin
+
+#endif // TIME_SERVICE_HPP
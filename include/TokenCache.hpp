@@ -0,0 +1,66 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef TOKEN_CACHE_HPP
+#define TOKEN_CACHE_HPP
+
+#include <Arduino.h>
+#include <cstring>
+#include <ctime>
+#include "TimeService.hpp"
+
+namespace meltwin {
+
+  struct CachedToken {
+    uint32_t magic;
+    time_t expires_at; // Seconds on the system clock, re-based once it is first synced
+    char token[128];
+  };
+
+  /**
+   * API token kept in RTC slow memory so that it survives deep sleep and can be reused until it expires.
+   * Not thread-safe: the API calls go through APICaller::get_token(), which serialises them.
+   */
+  struct TokenCache {
+    static constexpr uint32_t MAGIC{0x746F6B31};  // Marks a valid entry ("tok1")
+    static constexpr time_t DEFAULT_TTL_S{3600}; // Lifetime used when the API doesn't give one
+    static constexpr time_t EXPIRY_MARGIN_S{30}; // Renew a bit before expiry to cover the wake cycle
+    static constexpr size_t TOKEN_LENGTH{sizeof(CachedToken::token)};
+
+    /**
+     * Get the cached token if there is still a valid one
+     * @return the token, or nullptr if it needs to be renewed
+     */
+    static const char* get() {
+      if (rtc_token.magic != MAGIC || time(nullptr) + EXPIRY_MARGIN_S >= TimeService::rebase(rtc_token.expires_at))
+        return nullptr;
+      return rtc_token.token;
+    }
+
+    /**
+     * Store a new token
+     * @param token the token given by the API
+     * @param ttl_s its lifetime, in seconds
+     * @return false if the token is too long to be cached
+     */
+    static bool store(const char* token, time_t ttl_s = DEFAULT_TTL_S) {
+      if (token == nullptr || strnlen(token, TOKEN_LENGTH) >= TOKEN_LENGTH) {
+        invalidate();
+        return false;
+      }
+      strncpy(rtc_token.token, token, TOKEN_LENGTH);
+      rtc_token.expires_at = time(nullptr) + ttl_s;
+      rtc_token.magic = MAGIC;
+      return true;
+    }
+
+    static void invalidate() { rtc_token.magic = 0; }
+
+  private:
+    inline static RTC_DATA_ATTR CachedToken rtc_token;
+  };
+
+} // namespace meltwin
+
+#endif // TOKEN_CACHE_HPP
@@ -0,0 +1,111 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef WAKE_BUDGET_HPP
+#define WAKE_BUDGET_HPP
+
+#include <Arduino.h>
+#include <algorithm>
+#include <esp_timer.h>
+#include <freertos/timers.h>
+#include "WakeProfiler.hpp"
+#include "hardware_configs.h"
+
+namespace meltwin {
+
+  /**
+   * Wake deadline, enforced by a FreeRTOS timer that cuts the outputs and starts the deep sleep, and a time slice per
+   * phase that keeps the wrap-up slice free. A phase still running past its slice is counted as an overrun.
+   */
+  struct WakeBudget {
+    static constexpr int64_t DEADLINE_US{WAKE_DEADLINE_MS * 1000LL}; // Since boot
+
+    /**
+     * Arm the wake deadline, right after the profiler in setup()
+     * @param _cut_outputs called before a forced sleep, to stop what must not stay on
+     */
+    static void begin(void (*_cut_outputs)()) {
+      cut_outputs = _cut_outputs;
+      for (auto& running : phase_running)
+        running = false;
+      int64_t left_us = std::max<int64_t>(DEADLINE_US - esp_timer_get_time(), 1000);
+      timer = xTimerCreateStatic("wake", pdMS_TO_TICKS(left_us / 1000), pdFALSE, nullptr, on_deadline, &timer_buffer);
+      xTimerStart(timer, 0);
+    }
+
+    /**
+     * Leave the wake without deadline, for the developer console whose session has its own timeout
+     */
+    static void disarm() { xTimerStop(timer, 0); }
+
+    static void start(WakePhase phase) {
+      auto i = static_cast<size_t>(phase);
+      int64_t end = DEADLINE_US - ((phase == WakePhase::SLEEP) ? 0 : BUDGET_SLEEP_MS * 1000LL);
+      if (SLICES_MS[i] > 0)
+        end = std::min<int64_t>(end, esp_timer_get_time() + SLICES_MS[i] * 1000LL);
+      phase_deadline_us[i] = end;
+      phase_running[i] = true;
+    }
+
+    /**
+     * End a phase, counting an overrun if its slice is spent
+     */
+    static void stop(WakePhase phase) {
+      auto i = static_cast<size_t>(phase);
+      phase_running[i] = false;
+      int64_t late_us = esp_timer_get_time() - phase_deadline_us[i];
+      if (late_us < 0)
+        return;
+      Serial.printf("[Budget] %s overran its slice by %u ms\n", WakeProfiler::name(phase),
+                    static_cast<unsigned int>(late_us / 1000));
+      WakeProfiler::add_overrun(phase);
+    }
+
+    /**
+     * Time left in the slice of a started phase, rounded up so that a wait for it reaches the end of the slice
+     */
+    static uint32_t left_ms(WakePhase phase, uint32_t at_most = UINT32_MAX) {
+      int64_t left_us = phase_deadline_us[static_cast<size_t>(phase)] - esp_timer_get_time();
+      return static_cast<uint32_t>(std::clamp<int64_t>((left_us + 999) / 1000, 0, at_most));
+    }
+
+    static int64_t deadline_us(WakePhase phase) { return phase_deadline_us[static_cast<size_t>(phase)]; }
+
+  private:
+    // Slice of each phase, 0 for the ones only bound by the wake deadline. The connection is accounted as WIFI.
+    static constexpr uint32_t SLICES_MS[WAKE_PHASES]{
+      0,                 // Boot
+      0,                 // Console, its own timeout
+      BUDGET_SENSORS_MS, // Sensors
+      BUDGET_CONNECT_MS, // WiFi, clock sync and authentication
+      0,                 // Clock sync, part of the connection
+      0,                 // Authentication, part of the connection
+      BUDGET_UPLOAD_MS,  // Upload
+      BUDGET_PUMP_MS,    // Pumps
+      BUDGET_SLEEP_MS,   // Wrap-up
+      0,                 // Whole wake
+    };
+    static_assert(BUDGET_SLEEP_MS < WAKE_DEADLINE_MS, "The wrap-up slice must fit in the wake");
+
+    inline static int64_t phase_deadline_us[WAKE_PHASES];
+    inline static bool phase_running[WAKE_PHASES];
+    inline static void (*cut_outputs)() = nullptr;
+    inline static TimerHandle_t timer;
+    inline static StaticTimer_t timer_buffer;
+
+    static void on_deadline(TimerHandle_t) {
+      if (cut_outputs != nullptr)
+        cut_outputs();
+      Serial.println("[Budget] Wake deadline reached, going to sleep");
+      for (size_t i = 0; i < WAKE_PHASES; i++)
+        if (phase_running[i])
+          WakeProfiler::add_overrun(static_cast<WakePhase>(i));
+      WakeProfiler::add_forced_sleep();
+      esp_deep_sleep_start();
+    }
+  };
+
+} // namespace meltwin
+
+#endif // WAKE_BUDGET_HPP
@@ -0,0 +1,221 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef WAKE_PROFILER_HPP
+#define WAKE_PROFILER_HPP
+
+#include <Arduino.h>
+#include <algorithm>
+#include <cstring>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <initializer_list>
+#include "Payload.hpp"
+#include "hardware_configs.h"
+
+namespace meltwin {
+
+  enum class WakePhase : uint8_t { BOOT, CONSOLE, SENSORS, WIFI, TIME_SYNC, AUTH, UPLOAD, PUMP, SLEEP, WAKE, COUNT };
+
+  constexpr size_t WAKE_PHASES{static_cast<size_t>(WakePhase::COUNT)};
+
+  /**
+   * Durations of one phase, with a histogram of half-octave bins (64 us to 67 s) to estimate percentiles, and the heap
+   * blocks it leaves allocated
+   */
+  struct PhaseStats {
+    static constexpr uint8_t MIN_OCTAVE{6};  // 2^6 us, shorter durations go in the first bin
+    static constexpr uint8_t MAX_OCTAVE{26}; // 2^26 us, longer durations go in the last bin
+    static constexpr size_t BINS{2 * (MAX_OCTAVE - MIN_OCTAVE + 1)};
+
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+    int32_t heap_blocks; // Most heap blocks a run of the phase left allocated
+    uint16_t overruns;   // Runs that went past their time slice (see WakeBudget)
+    uint16_t bins[BINS];
+  };
+
+  /**
+   * WiFi connections by outcome (see WifiConnect.hpp)
+   */
+  struct WiFiCounts {
+    uint32_t fast_success;  // Direct connection to the cached access point with the cached IP
+    uint32_t fast_fallback; // Fast connection failed, full scan and DHCP used instead
+    uint32_t cold_connect;  // No cache, full scan and DHCP
+    uint32_t failures;      // Couldn't connect at all
+  };
+
+  struct WakeProfile {
+    uint32_t magic;
+    uint32_t wakes;         // Wakes accumulated since the last upload
+    uint32_t forced_sleeps; // Wakes put to sleep by their deadline
+    WiFiCounts wifi;
+    PhaseStats phases[WAKE_PHASES];
+  };
+
+  /**
+   * Duration of each phase of the wake cycle, accumulated in RTC memory and sent every PROFILE_REPORT_EVERY_N_WAKES
+   * wakes. Each phase also logs the heap blocks it left allocated.
+   */
+  struct WakeProfiler {
+    static constexpr uint32_t MAGIC{0x70726634}; // "prf4"
+
+    /**
+     * Load the statistics and record the boot time, to be called first thing in setup()
+     */
+    static void begin() {
+      if (rtc_profile.magic != MAGIC)
+        reset();
+      rtc_profile.wakes++;
+      for (auto phase : {WakePhase::BOOT, WakePhase::WAKE}) {
+        phase_started_us[static_cast<size_t>(phase)] = 0;
+        phase_started_blocks[static_cast<size_t>(phase)] = heap_blocks();
+      }
+      stop(WakePhase::BOOT);
+    }
+
+    static void start(WakePhase phase) {
+      phase_started_blocks[static_cast<size_t>(phase)] = heap_blocks();
+      phase_started_us[static_cast<size_t>(phase)] = esp_timer_get_time();
+    }
+
+    static void stop(WakePhase phase) {
+      auto i = static_cast<size_t>(phase);
+      add(phase, static_cast<uint32_t>(std::max<int64_t>(0, esp_timer_get_time() - phase_started_us[i])));
+
+      auto blocks = static_cast<int32_t>(heap_blocks() - phase_started_blocks[i]);
+      auto& stats = rtc_profile.phases[i];
+      stats.heap_blocks = (stats.count == 1) ? blocks : std::max(stats.heap_blocks, blocks);
+      if (blocks != 0)
+        Serial.printf("[Heap] %s left %+d blocks allocated\n", NAMES[i], static_cast<int>(blocks));
+    }
+
+    /**
+     * Time a phase for the lifetime of the object
+     */
+    struct Span {
+      explicit Span(WakePhase _phase) : phase(_phase) { start(phase); }
+      ~Span() { stop(phase); }
+      Span(const Span&) = delete;
+      Span& operator=(const Span&) = delete;
+
+    private:
+      WakePhase phase;
+    };
+
+    static bool report_due() { return rtc_profile.wakes >= PROFILE_REPORT_EVERY_N_WAKES; }
+
+    static void add_overrun(WakePhase phase) {
+      auto& overruns = rtc_profile.phases[static_cast<size_t>(phase)].overruns;
+      if (overruns < UINT16_MAX)
+        overruns++;
+    }
+
+    static void add_forced_sleep() { rtc_profile.forced_sleeps++; }
+
+    // Counted by WiFiConnect::init(), since the last upload
+    static WiFiCounts& wifi() { return rtc_profile.wifi; }
+
+    /**
+     * Add the WiFi counters and the statistics of every measured or overrun phase to a request, under "profile[i][...]"
+     */
+    static void add_to(Payload& payload) {
+      payload.add_data("profile_wakes", rtc_profile.wakes);
+      if (rtc_profile.forced_sleeps > 0)
+        payload.add_data("profile_forced_sleeps", rtc_profile.forced_sleeps);
+      payload.add_data("profile_wifi_fast", rtc_profile.wifi.fast_success);
+      payload.add_data("profile_wifi_fallback", rtc_profile.wifi.fast_fallback);
+      payload.add_data("profile_wifi_cold", rtc_profile.wifi.cold_connect);
+      payload.add_data("profile_wifi_failures", rtc_profile.wifi.failures);
+      size_t n = 0;
+      for (size_t i = 0; i < WAKE_PHASES; i++) {
+        const auto& stats = rtc_profile.phases[i];
+        if (stats.count == 0 && stats.overruns == 0)
+          continue;
+        payload.add_item("profile", n, "phase", NAMES[i]);
+        payload.add_item("profile", n, "count", stats.count);
+        payload.add_item("profile", n, "min_us", stats.min_us);
+        uint32_t mean_us = (stats.count > 0) ? static_cast<uint32_t>(stats.sum_us / stats.count) : 0;
+        payload.add_item("profile", n, "mean_us", mean_us);
+        payload.add_item("profile", n, "p95_us", percentile(stats, 95));
+        payload.add_item("profile", n, "max_us", stats.max_us);
+        payload.add_item("profile", n, "heap_blocks", stats.heap_blocks);
+        if (stats.overruns > 0)
+          payload.add_item("profile", n, "overruns", stats.overruns);
+        n++;
+      }
+    }
+
+    /**
+     * Start over once the statistics have been uploaded
+     */
+    static void reset() {
+      memset(&rtc_profile, 0, sizeof(rtc_profile));
+      rtc_profile.magic = MAGIC;
+    }
+
+    static const PhaseStats& stats(WakePhase phase) { return rtc_profile.phases[static_cast<size_t>(phase)]; }
+    static const char* name(WakePhase phase) { return NAMES[static_cast<size_t>(phase)]; }
+
+    /**
+     * Estimate a percentile from the histogram, as the upper bound of the bin holding it
+     */
+    static uint32_t percentile(const PhaseStats& stats, uint8_t percent) {
+      if (stats.count == 0)
+        return 0;
+      uint32_t rank = (stats.count * percent + 99) / 100, seen = 0;
+      for (size_t bin = 0; bin < PhaseStats::BINS; bin++) {
+        seen += stats.bins[bin];
+        if (seen >= rank)
+          return std::clamp(upper_bound(bin), stats.min_us, stats.max_us);
+      }
+      return stats.max_us;
+    }
+
+  private:
+    inline static RTC_DATA_ATTR WakeProfile rtc_profile;
+    inline static int64_t phase_started_us[WAKE_PHASES];
+    inline static size_t phase_started_blocks[WAKE_PHASES];
+
+    static constexpr const char* NAMES[WAKE_PHASES]{"boot",   "console", "sensors", "wifi",  "time_sync",
+                                                    "auth",   "upload",  "pump",    "sleep", "wake"};
+
+    static size_t heap_blocks() {
+      multi_heap_info_t info;
+      heap_caps_get_info(&info, MALLOC_CAP_DEFAULT);
+      return info.allocated_blocks;
+    }
+
+    static void add(WakePhase phase, uint32_t us) {
+      auto& stats = rtc_profile.phases[static_cast<size_t>(phase)];
+      stats.min_us = (stats.count == 0) ? us : std::min(stats.min_us, us);
+      stats.max_us = std::max(stats.max_us, us);
+      stats.sum_us += us;
+      stats.count++;
+      auto& bin = stats.bins[bin_of(us)];
+      if (bin < UINT16_MAX)
+        bin++;
+    }
+
+    // Bins split each octave [2^k, 2^(k+1)[ at 1.5 * 2^k
+    static size_t bin_of(uint32_t us) {
+      if (us < (1U << PhaseStats::MIN_OCTAVE))
+        return 0;
+      uint8_t octave = 31 - __builtin_clz(us);
+      if (octave > PhaseStats::MAX_OCTAVE)
+        return PhaseStats::BINS - 1;
+      return 2 * (octave - PhaseStats::MIN_OCTAVE) + ((us >> (octave - 1)) & 1);
+    }
+
+    static uint32_t upper_bound(size_t bin) {
+      uint8_t octave = PhaseStats::MIN_OCTAVE + bin / 2;
+      return (bin % 2 == 0) ? 3U << (octave - 1) : 2U << octave;
+    }
+  };
+
+} // namespace meltwin
+
+#endif // WAKE_PROFILER_HPP
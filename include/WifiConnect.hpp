@@ -2,34 +2,94 @@
 #define WIFI_CONNECT_HPP
 
 #include <WiFi.h>
+#include <cstring>
+#include "WakeProfiler.hpp"
 
-namespace {
+namespace meltwin {
 
-  bool init_wifi(const char* ssid, const char* password, unsigned long timeout = 5000U) {
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(ssid, password);
-    Serial.print("Connecting to WiFi ...");
+  // Access point and lease of the last successful connection, kept through deep sleep
+  struct WiFiCache {
+    uint32_t magic;
+    uint8_t bssid[6];
+    int32_t channel;
+    uint32_t ip, gateway, subnet, dns;
+  };
 
-    auto end = millis() + timeout;
-    auto loop_time = millis();
-    while (WiFi.status() != WL_CONNECTED && WiFi.status() != WL_CONNECT_FAILED && loop_time < end) {
-      Serial.print(".");
-      delay(100);
-      loop_time = millis();
+  struct WiFiConnect {
+    static constexpr uint32_t CACHE_MAGIC{0x77696631};  // "wif1"
+    static constexpr unsigned long FAST_TIMEOUT{1500U}; // Time given to the fast reconnect before falling back
+    static constexpr unsigned long POLL_PERIOD{10U};    // Status polling period, in milliseconds
+
+    static bool init(const char* ssid, const char* password, unsigned long timeout = 5000U) {
+      WiFi.mode(WIFI_STA);
+      Serial.print("Connecting to WiFi ...");
+
+      // Try to connect directly on the last access point with the last lease
+      auto& stats = WakeProfiler::wifi(); // Sent with the wake profile
+      bool connected = false;
+      if (cache.magic == CACHE_MAGIC) {
+        WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+        WiFi.begin(ssid, password, cache.channel, cache.bssid);
+        connected = wait(FAST_TIMEOUT);
+        if (connected)
+          stats.fast_success++;
+        else {
+          Serial.print(" fast reconnect failed, scanning ...");
+          stats.fast_fallback++;
+          cache.magic = 0;
+          WiFi.disconnect();
+          WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE); // Back to DHCP
+        }
+      }
+      else
+        stats.cold_connect++;
+
+      // Full scan and DHCP
+      if (!connected) {
+        WiFi.begin(ssid, password);
+        connected = wait(timeout);
+      }
+
+      if (!connected) {
+        stats.failures++;
+        Serial.println("Couldn't connect to WiFi network ...");
+        return false;
+      }
+      else {
+        save_cache();
+        Serial.println("\nConnected to the WiFi network");
+        Serial.print("Local ESP32 IP: ");
+        Serial.println(WiFi.localIP());
+        Serial.printf("Fast reconnects: %u ok, %u fallbacks, %u cold connects, %u failures\n", stats.fast_success,
+                      stats.fast_fallback, stats.cold_connect, stats.failures);
+        return true;
+      }
     }
 
-    if (WiFi.status() == WL_CONNECT_FAILED || loop_time > end) {
-      Serial.println("Couldn't connect to WiFi network ...");
-      return false;
+  private:
+    inline static RTC_DATA_ATTR WiFiCache cache;
+
+    static bool wait(unsigned long timeout) {
+      auto end = millis() + timeout;
+      auto loop_time = millis();
+      while (WiFi.status() != WL_CONNECTED && WiFi.status() != WL_CONNECT_FAILED && loop_time < end) {
+        delay(POLL_PERIOD);
+        loop_time = millis();
+      }
+      return WiFi.status() == WL_CONNECTED;
     }
-    else {
-      Serial.println("\nConnected to the WiFi network");
-      Serial.print("Local ESP32 IP: ");
-      Serial.println(WiFi.localIP());
-      return true;
+
+    static void save_cache() {
+      memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+      cache.channel = WiFi.channel();
+      cache.ip = WiFi.localIP();
+      cache.gateway = WiFi.gatewayIP();
+      cache.subnet = WiFi.subnetMask();
+      cache.dns = WiFi.dnsIP();
+      cache.magic = CACHE_MAGIC;
     }
-  }
+  };
 
-} // namespace
+} // namespace meltwin
 
 #endif
@@ -13,6 +13,7 @@ typedef uint32_t TimeValue;
 // Time utils
 constexpr TimeValue S_2US{1000000};
 constexpr TimeValue S_2MS{1000};
+constexpr TimeValue MS_2US{1000};
 constexpr TimeValue M_2_US{60 * S_2US};
 constexpr TimeValue H_2_US{60 * M_2_US};
 
@@ -9,233 +9,234 @@
 #ifndef MELTWIN_DATETIME
 #define MELTWIN_DATETIME
 
-#include <Preferences.h>
+#include <cstdint>
 #include <cstring>
-#include <sstream>
 #include "hardware_configs.h"
 
 namespace meltwin {
+  /**
+   * Point in time stored as microseconds since the Unix epoch (UTC).
+   * Arithmetic and comparisons are plain integer operations, calendar fields are only computed when asked for.
+   */
   struct DateTime {
+    static constexpr size_t ISO_LENGTH{32}; // Length of "YYYY-MM-DDThh:mm:ss.ssssss+00:00"
     static constexpr const char* ISO_NULL{"0000-00-00T00:00:00.000000+00:00"};
-    static constexpr const char* YEAR_KEY{"yr"};
-    static constexpr const char* MONTH_KEY{"mth"};
-    static constexpr const char* DAY_KEY{"dy"};
-    static constexpr const char* HOUR_KEY{"hr"};
-    static constexpr const char* MINUTES_KEY{"min"};
-    static constexpr const char* SECONDS_KEY{"s"};
-    static constexpr const char* USEC_KEY{"us"};
-
-    // Time structure
-    const char* prefix = "";
-    uint16_t year = 0;
-    uint8_t month = 0;
-    uint8_t day = 0;
-    uint8_t hour = 0;
-    uint8_t minutes = 0;
-    uint8_t seconds = 0;
-    uint32_t usecs = 0;
-
-    DateTime() {}
-    DateTime(uint16_t y, uint8_t m, uint8_t d, uint8_t h, uint8_t mi, uint8_t s, uint32_t us, const char* p = "") :
-        year(y), month(m), day(d), hour(h), minutes(mi), seconds(s), usecs(us), prefix(p) {}
-
-    // Parse time from ISO-8601-1 datetime format: "YYYY-MM-DDThh:mm:ss.ssssss+hh:mm"
-    static DateTime from_iso(const char* iso_string) {
-      DateTime datetime;
-      char buffer[6];
-      const char* p = (const char*)iso_string;
-
-      // Get year
-      strncpy(buffer, p, 4);
-      buffer[4] = '\0';
-      datetime.year = strtol(buffer, NULL, 10);
-      p += 5;
-
-      // Get month
-      strncpy(buffer, p, 2);
-      buffer[2] = '\0';
-      datetime.month = strtol(buffer, NULL, 10);
-      p += 3;
-
-      // Get day
-      strncpy(buffer, p, 2);
-      datetime.day = strtol(buffer, NULL, 10);
-      p += 3;
-
-      // Get hour
-      strncpy(buffer, p, 2);
-      datetime.hour = strtol(buffer, NULL, 10);
-      p += 3;
-
-      // Get minutes
-      strncpy(buffer, p, 2);
-      datetime.minutes = strtol(buffer, NULL, 10);
-      p += 3;
-
-      // Get seconds
-      strncpy(buffer, p, 2);
-      datetime.seconds = strtol(buffer, NULL, 10);
-      p += 3;
-
-      // Get microseconds
-      strncpy(buffer, p, 6);
-      buffer[6] = '\0';
-      datetime.usecs = strtol(buffer, NULL, 10);
-
-      return datetime;
-    }
 
-    static std::string prefixed(const char* prefix, const char* key) {
-      std::stringstream ss;
-      ss << prefix << key;
-      // Serial.printf("Using key \"%s\", and do exist: %s\n", ss.str().c_str(), (preferences.isKey(ss.str().c_str())) ?
-      // "true" : "false");
-      return ss.str();
-    }
+    static constexpr int64_t US_PER_S{1000000};
+    static constexpr int64_t US_PER_DAY{86400 * US_PER_S};
 
-    static uint8_t february_length(uint16_t year) {
-      if (year % 4 != 0)
-        return 28;
-      if (year % 100 != 0)
-        return 29;
-      if (year % 400 != 0)
-        return 28;
-      return 29;
-    }
-
-    inline bool is_long_month(uint8_t month) {
-      return (month == 1) || (month == 3) || (month = 5) || (month == 7) || (month == 8) || (month == 10) ||
-        (month == 12);
-    }
+    // Broken-down UTC time
+    struct Fields {
+      int32_t year = 1970;
+      uint8_t month = 1;
+      uint8_t day = 1;
+      uint8_t hour = 0;
+      uint8_t minutes = 0;
+      uint8_t seconds = 0;
+      uint32_t usecs = 0;
+    };
 
-    inline bool is_short_month(uint8_t month) { return (month == 4) || (month == 6) || (month == 9) || (month == 11); }
+    int64_t us = 0; // Microseconds since 1970-01-01T00:00:00Z
 
-    static void rjust_insert(std::string& in, const char* what, const size_t where_end, const size_t size_limit) {
-      size_t what_len = std::min(std::strlen(what), size_limit);
-      for (size_t d_pos = 0; d_pos < what_len; d_pos++)
-        in[where_end - d_pos] = what[what_len - d_pos - 1];
-    }
+    constexpr DateTime() {}
+    constexpr explicit DateTime(int64_t epoch_us) : us(epoch_us) {}
+    constexpr DateTime(int32_t y, uint8_t m, uint8_t d, uint8_t h, uint8_t mi, uint8_t s, uint32_t usecs = 0) :
+        us(days_from_civil(y, m, d) * US_PER_DAY + ((h * 60 + mi) * 60 + s) * US_PER_S + usecs) {}
 
-    std::string to_iso_string() const {
-      std::string iso_str = DateTime::ISO_NULL;
+    static constexpr DateTime from_epoch_s(int64_t seconds) { return DateTime(seconds * US_PER_S); }
+    constexpr int64_t epoch_s() const { return floor_div(us, US_PER_S); }
 
-      // Insert date
-      rjust_insert(iso_str, std::to_string(this->year).c_str(), 3, 4);
-      rjust_insert(iso_str, std::to_string(this->month).c_str(), 6, 2);
-      rjust_insert(iso_str, std::to_string(this->day).c_str(), 9, 2);
+    // ------------------------------------------------------------------------
+    // Calendar conversions (proleptic Gregorian calendar)
+    // ------------------------------------------------------------------------
+    static constexpr bool is_leap(int32_t year) { return (year % 4 == 0) && (year % 100 != 0 || year % 400 == 0); }
 
-      // Insert time
-      rjust_insert(iso_str, std::to_string(this->hour).c_str(), 12, 2);
-      rjust_insert(iso_str, std::to_string(this->minutes).c_str(), 15, 2);
-      rjust_insert(iso_str, std::to_string(this->seconds).c_str(), 18, 2);
-      rjust_insert(iso_str, std::to_string(this->usecs).c_str(), 25, 6);
+    static constexpr uint8_t february_length(int32_t year) { return (is_leap(year)) ? 29 : 28; }
 
-      return iso_str;
+    static constexpr uint8_t month_length(int32_t year, uint8_t month) {
+      return (month == 2) ? february_length(year) : 30 + ((month + (month >> 3)) & 1);
     }
 
+    /**
+     * Number of days since 1970-01-01 of a civil date
+     */
+    static constexpr int64_t days_from_civil(int32_t y, uint8_t m, uint8_t d) {
+      y -= m <= 2;
+      const int64_t era = floor_div(y, 400);
+      const int64_t yoe = y - era * 400;                                     // [0, 399]
+      const int64_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1; // [0, 365]
+      const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;            // [0, 146096]
+      return era * 146097 + doe - 719468;
+    }
 
-    DateTime& operator+=(const DateTime& other) {
-      // Add USecs
-      usecs += other.usecs;
-      if (usecs >= 1000000) {
-        seconds++;
-        usecs -= 1000000;
-      }
-
-      // Add seconds
-      seconds += other.seconds;
-      if (seconds >= 60) {
-        minutes++;
-        seconds -= 60;
-      }
+    /**
+     * Civil date of a number of days since 1970-01-01
+     */
+    static constexpr Fields civil_from_days(int64_t z) {
+      z += 719468;
+      const int64_t era = floor_div(z, 146097);
+      const int64_t doe = z - era * 146097;
+      const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+      const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+      const int64_t mp = (5 * doy + 2) / 153;
+      Fields f;
+      f.day = static_cast<uint8_t>(doy - (153 * mp + 2) / 5 + 1);
+      f.month = static_cast<uint8_t>(mp < 10 ? mp + 3 : mp - 9);
+      f.year = static_cast<int32_t>(yoe + era * 400 + (f.month <= 2));
+      return f;
+    }
 
-      // Add minutes
-      minutes += other.minutes;
-      if (minutes >= 60) {
-        hour++;
-        minutes -= 60;
-      }
+    constexpr Fields fields() const {
+      const int64_t days = floor_div(us, US_PER_DAY);
+      const int64_t in_day = us - days * US_PER_DAY;
+      Fields f = civil_from_days(days);
+      const int64_t secs = in_day / US_PER_S;
+      f.hour = static_cast<uint8_t>(secs / 3600);
+      f.minutes = static_cast<uint8_t>(secs / 60 % 60);
+      f.seconds = static_cast<uint8_t>(secs % 60);
+      f.usecs = static_cast<uint32_t>(in_day % US_PER_S);
+      return f;
+    }
 
-      // Add hours
-      hour += other.hour;
-      if (hour >= 24) {
-        day++;
-        hour -= 24;
+    // ------------------------------------------------------------------------
+    // ISO-8601 conversions
+    // ------------------------------------------------------------------------
+
+    /**
+     * Parse time from ISO-8601-1 datetime format: "YYYY-MM-DDThh:mm:ss[.ssssss][+hh:mm|Z]".
+     * The result is converted to UTC using the offset.
+     * @return false, leaving datetime untouched, if iso is not a valid datetime in this format
+     */
+    static constexpr bool from_iso(const char* iso, DateTime& datetime) {
+      // Fields are checked in order, so that a short string stops at its '\0'
+      if (!is_number(iso, 4) || iso[4] != '-' || !is_number(iso + 5, 2) || iso[7] != '-' || !is_number(iso + 8, 2) ||
+          iso[10] != 'T' || !is_number(iso + 11, 2) || iso[13] != ':' || !is_number(iso + 14, 2) || iso[16] != ':' ||
+          !is_number(iso + 17, 2))
+        return false;
+      const int32_t year = number(iso, 4);
+      const int32_t month = number(iso + 5, 2);
+      const int32_t day = number(iso + 8, 2);
+      const int32_t hour = number(iso + 11, 2);
+      const int32_t minutes = number(iso + 14, 2);
+      const int32_t seconds = number(iso + 17, 2);
+      if (month < 1 || month > 12 || day < 1 || day > month_length(year, month) || hour > 23 || minutes > 59 ||
+          seconds > 59)
+        return false;
+      DateTime parsed(year, month, day, hour, minutes, seconds);
+      const char* p = iso + 19;
+
+      // Fraction of seconds, any number of digits (only the first 6 are kept)
+      if (*p == '.') {
+        p++;
+        if (!is_digit(*p))
+          return false;
+        int64_t scale = US_PER_S;
+        int64_t fraction = 0;
+        for (; is_digit(*p); p++) {
+          scale /= 10; // 0 past the microseconds
+          fraction += (*p - '0') * scale;
+        }
+        parsed.us += fraction;
       }
 
-      // Add days
-      day += other.day;
-      uint8_t feb_length = DateTime::february_length(year);
-      if ((month == 2 && day > feb_length) || (is_short_month(month) && day > 30) ||
-          (is_long_month(month) && day > 31)) {
-        month++;
-        day = 1;
+      // UTC offset
+      if (*p == '+' || *p == '-') {
+        if (!is_number(p + 1, 2) || p[3] != ':' || !is_number(p + 4, 2) || number(p + 1, 2) > 23 ||
+            number(p + 4, 2) > 59)
+          return false;
+        const int64_t offset = (number(p + 1, 2) * 60 + number(p + 4, 2)) * 60 * US_PER_S;
+        parsed.us -= (*p == '+') ? offset : -offset;
+        p += 6;
       }
+      else if (*p == 'Z')
+        p++;
+      if (*p != '\0')
+        return false;
 
-      // Add months
-      month += other.month;
-      if (month > 12) {
-        year++;
-        month = 1;
-      }
+      datetime = parsed;
+      return true;
+    }
 
-      // Add years
-      year += other.year;
+    /**
+     * Write the UTC ISO-8601 representation in a buffer of at least ISO_LENGTH + 1 characters
+     * @return the number of characters written, without the final '\0'
+     */
+    size_t to_iso(char* buffer) const {
+      const Fields f = fields();
+      char* p = buffer;
+      p = digits(p, f.year, 4);
+      *p++ = '-';
+      p = digits(p, f.month, 2);
+      *p++ = '-';
+      p = digits(p, f.day, 2);
+      *p++ = 'T';
+      p = digits(p, f.hour, 2);
+      *p++ = ':';
+      p = digits(p, f.minutes, 2);
+      *p++ = ':';
+      p = digits(p, f.seconds, 2);
+      *p++ = '.';
+      p = digits(p, f.usecs, 6);
+      memcpy(p, "+00:00", 7);
+      return ISO_LENGTH;
+    }
 
+    // ------------------------------------------------------------------------
+    // Arithmetic, durations are in microseconds
+    // ------------------------------------------------------------------------
+    constexpr DateTime& operator+=(int64_t duration_us) {
+      us += duration_us;
       return *this;
     }
-    friend DateTime operator+(DateTime first, const DateTime& second) {
-      first += second;
-      return first;
+    constexpr DateTime& operator-=(int64_t duration_us) {
+      us -= duration_us;
+      return *this;
+    }
+    friend constexpr DateTime operator+(DateTime first, int64_t duration_us) { return first += duration_us; }
+    friend constexpr DateTime operator-(DateTime first, int64_t duration_us) { return first -= duration_us; }
+    friend constexpr int64_t operator-(const DateTime& lhs, const DateTime& rhs) { return lhs.us - rhs.us; }
+
+    friend constexpr bool operator==(const DateTime& lhs, const DateTime& rhs) { return lhs.us == rhs.us; }
+    friend constexpr bool operator!=(const DateTime& lhs, const DateTime& rhs) { return lhs.us != rhs.us; }
+    friend constexpr bool operator<(const DateTime& lhs, const DateTime& rhs) { return lhs.us < rhs.us; }
+    friend constexpr bool operator>(const DateTime& lhs, const DateTime& rhs) { return rhs < lhs; }
+    friend constexpr bool operator<=(const DateTime& lhs, const DateTime& rhs) { return !(lhs > rhs); }
+    friend constexpr bool operator>=(const DateTime& lhs, const DateTime& rhs) { return !(lhs < rhs); }
+
+  private:
+    static constexpr int64_t floor_div(int64_t a, int64_t b) { return a / b - ((a % b != 0) && ((a < 0) != (b < 0))); }
+
+    static constexpr bool is_digit(char c) { return static_cast<unsigned char>(c - '0') < 10; }
+
+    static constexpr bool is_number(const char* p, uint8_t n) {
+      for (uint8_t i = 0; i < n; i++)
+        if (!is_digit(p[i]))
+          return false;
+      return true;
     }
-    friend bool operator<(const DateTime& first, const DateTime& second) {
-      // Year
-      if (second.year > first.year)
-        return true;
-      if (second.year < first.year)
-        return false;
-
-      // Month
-      if (second.month > first.month)
-        return true;
-      if (second.month < first.month)
-        return false;
-
-      // Day
-      if (second.day > first.day)
-        return true;
-      if (second.day < first.day)
-        return false;
-
-      // Hour
-      if (second.hour > first.hour)
-        return true;
-      if (second.hour < first.hour)
-        return false;
-
-      // Minutes
-      if (second.minutes > first.minutes)
-        return true;
-      if (second.minutes < first.minutes)
-        return false;
-
-      // Seconds
-      if (second.seconds > first.seconds)
-        return true;
-      if (second.seconds < first.seconds)
-        return false;
 
-      // Micro secs
-      if (second.usecs < first.usecs)
-        return false;
+    static constexpr int32_t number(const char* p, uint8_t n) {
+      int32_t value = 0;
+      for (uint8_t i = 0; i < n; i++)
+        value = value * 10 + (p[i] - '0');
+      return value;
+    }
 
-      return true;
+    static char* digits(char* p, uint32_t value, uint8_t n) {
+      for (uint8_t i = n; i > 0; i--, value /= 10)
+        p[i - 1] = static_cast<char>('0' + value % 10);
+      return p + n;
     }
-    friend bool operator>(const DateTime& lhs, const DateTime& rhs) { return rhs < lhs; }
-    friend bool operator<=(const DateTime& lhs, const DateTime& rhs) { return !(lhs > rhs); }
-    friend bool operator>=(const DateTime& lhs, const DateTime& rhs) { return !(lhs < rhs); }
   };
 
+  static_assert(DateTime(1970, 1, 1, 0, 0, 0).us == 0);
+  static_assert(DateTime(2000, 3, 1, 0, 0, 0).epoch_s() == 951868800);
+  static_assert([] {
+    DateTime datetime;
+    return DateTime::from_iso("2024-12-18T11:20:30.5+01:00", datetime) &&
+           datetime == DateTime(2024, 12, 18, 10, 20, 30, 500000);
+  }());
+
 } // namespace meltwin
 
 #endif
@@ -9,7 +9,11 @@
 #ifndef MELTWIN_DEV_CONSOLE
 #define MELTWIN_DEV_CONSOLE
 
+#include <cstdio>
+#include <ctime>
 #include <nvs_flash.h>
+#include "ConfigStore.hpp"
+#include "TimeService.hpp"
 #include "datetime.h"
 #include "hardware_configs.h"
 
@@ -25,7 +29,9 @@ namespace meltwin {
       static constexpr const char* CONSOLE_START{"cmd"};
       static constexpr const char* PING_CMD{"ping"};
       static constexpr const char* EXIT_CMD{"exit"};
-      static constexpr const char* SET_WATER_DATE{"setwd"};
+      static constexpr const char* SET_WATER_DATE{"setwd"}; // setwd <plant> [ISO date], now once synced
+      static constexpr const char* SET_PUMP{"setpump"};     // setpump <plant> <open time ms> <period s>
+      static constexpr const char* SHOW_CONFIG{"config"};
       static constexpr const char* CLEAN_CMD{"clean"};
     };
 
@@ -34,7 +40,7 @@ namespace meltwin {
      * @return true if the console session should continue, false if the system should go in "work" mode
      */
     static bool wait_for_console_launch() {
-      char* buffer = new char[MSG_LENGTH];
+      char buffer[MSG_LENGTH + 1];
       if (!wait_for_next_msg(buffer, START_TIMEOUT)) {
         return false;
       }
@@ -52,7 +58,7 @@ namespace meltwin {
      * @return true if the console should continue to be up, false if the system should reboot
      */
     static bool execute_command() {
-      char* buffer = new char[MSG_LENGTH];
+      char buffer[MSG_LENGTH + 1];
       if (!wait_for_next_msg(buffer, MSG_TIMEOUT)) {
         Serial.println("Timed out while waiting for a new message ...");
         return false;
@@ -63,8 +69,11 @@ namespace meltwin {
       else if (strncmp(buffer, Msgs::EXIT_CMD, 4) == 0)
         return false;
       else if (strncmp(buffer, Msgs::SET_WATER_DATE, 5) == 0)
-        // set_watering_date(buffer);
-        ;
+        set_watering_date(buffer);
+      else if (strncmp(buffer, Msgs::SET_PUMP, 7) == 0)
+        set_pump(buffer);
+      else if (strncmp(buffer, Msgs::SHOW_CONFIG, 6) == 0)
+        show_config();
       else if (strncmp(buffer, Msgs::CLEAN_CMD, 5) == 0)
         clean_nvs();
       else
@@ -75,15 +84,13 @@ namespace meltwin {
   private:
     /**
      * Wait for the next message and read it.
-     * @param buffer the char buffer where to store the received command (should just be a pointer, the value will be
-     * rewritten)
+     * @param buffer the char buffer where to store the received command, of at least MSG_LENGTH + 1 characters
      * @param timout the timeout in milliseconds for this message
      * @return true if a message has successfully been read, false otherwise
      */
     static bool wait_for_next_msg(char* buffer, unsigned long int timeout) {
       auto end = millis() + timeout;
       buffer[0] = STR_END;
-      size_t buffer_index = 0;
 
       // Read data
       while (millis() < end) {
@@ -103,8 +110,55 @@ namespace meltwin {
     static void clean_nvs() {
       nvs_flash_erase(); // erase the NVS partition and...
       nvs_flash_init();  // initialize the NVS partition.
+      ConfigStore::reset();
       Serial.println("Cleaned the NVS!");
     }
+
+    // Settings are committed to NVS at the end of the wake (see ConfigStore)
+    static void set_watering_date(const char* buffer) {
+      unsigned int plant;
+      char iso[DateTime::ISO_LENGTH + 1];
+      int n = sscanf(buffer, "setwd %u %32s", &plant, iso);
+      if (n < 1 || plant >= PLANT_COUNT) {
+        Serial.println("[DEBUG] Usage: setwd <plant> [YYYY-MM-DDThh:mm:ss]");
+        return;
+      }
+      if (n == 1 && !TimeService::synced()) {
+        Serial.println("[DEBUG] The clock isn't synced yet, give the date: setwd <plant> <YYYY-MM-DDThh:mm:ss>");
+        return;
+      }
+      DateTime date = TimeService::now();
+      if (n == 2 && !DateTime::from_iso(iso, date)) {
+        Serial.printf("[DEBUG] Invalid date \"%s\", expected YYYY-MM-DDThh:mm:ss[.ssssss][+hh:mm|Z]\n", iso);
+        return;
+      }
+      ConfigStore::set_last_watered(plant, date.us);
+      date.to_iso(iso);
+      Serial.printf("[DEBUG] Plant %u last watered on %s\n", plant, iso);
+    }
+
+    static void set_pump(const char* buffer) {
+      unsigned int plant, open_time_ms, period_s;
+      if (sscanf(buffer, "setpump %u %u %u", &plant, &open_time_ms, &period_s) != 3 || plant >= PLANT_COUNT) {
+        Serial.println("[DEBUG] Usage: setpump <plant> <open time ms> <period s>");
+        return;
+      }
+      ConfigStore::set_pump(plant, open_time_ms, period_s);
+      Serial.printf("[DEBUG] Plant %u: open %u ms every %u s\n", plant, open_time_ms, period_s);
+    }
+
+    static void show_config() {
+      char iso[DateTime::ISO_LENGTH + 1];
+      for (size_t i = 0; i < PLANT_COUNT; i++) {
+        const auto& plant = ConfigStore::plant(i);
+        if (plant.last_watered_us != 0)
+          DateTime(plant.last_watered_us).to_iso(iso);
+        else
+          strcpy(iso, "never");
+        Serial.printf("[DEBUG] Plant %zu: open %u ms every %u s, last watered %s\n", i,
+                      static_cast<unsigned int>(plant.open_time_ms), static_cast<unsigned int>(plant.period_s), iso);
+      }
+    }
   };
 } // namespace meltwin
 
@@ -19,8 +19,45 @@
 #define SERIAL_BAUD_RATE 9600
 #define MANUAL_PWM_IN 26 // For manual test of the PWM with a potentiometer
 
-// Deep sleep
+// Deep sleep (DEEP_SLEEP_DURATION_S until the moisture trends are known, then adapted within [SLEEP_MIN_S, SLEEP_MAX_S])
 #define DEEP_SLEEP_DURATION_S 120
 constexpr uint32_t DEEP_SLEEP_DURATION{DEEP_SLEEP_DURATION_S * S_2US};
+#define SLEEP_MIN_S 60
+#define SLEEP_MAX_S 1800
+#define MOISTURE_THRESHOLD 0.35f // Plant sensor value below which a plant needs water
+
+// Plant sensors, read through a 16 channel analog multiplexer when built with PLANT_SENSOR_MUX
+#ifdef PLANT_SENSOR_MUX
+#define PLANT_SENSORS 16
+#else
+#define PLANT_SENSORS 3
+#endif
+
+// Reporting (readings are buffered and only sent once one of these is reached)
+#define REPORT_EVERY_N_WAKES 5 // Number of wakes buffered before sending
+#define REPORT_MAX_AGE_S 900   // Max age of the oldest buffered reading, in seconds
+#define REPORT_HEARTBEAT_S 3600 // A sensor reading is kept at least this often, even if it stayed in its deadband
+
+// Time keeping (the clock is only synced when its estimated error goes above the max)
+#define NTP_SERVER "pool.ntp.org"
+#define TIME_MAX_ERROR_MS 2000
+#define TIME_SYNC_TIMEOUT_MS 5000
+#define TIME_SYNC_RETRY_S 300       // Wait after a failed sync, doubled on each failure in a row
+#define TIME_SYNC_RETRY_MAX_S 21600 // Longest wait between two sync attempts
+
+// API requests (independent requests run together on worker tasks, each worker with its own keep-alive connection)
+#define API_WORKERS 2
+#define API_REQUEST_TIMEOUT_MS 5000 // Per request, waiting for a worker included
+
+// Wake budget (each phase gets a time slice within the wake deadline, by which the board goes to sleep in any case)
+#define WAKE_DEADLINE_MS 60000  // From boot to deep sleep
+#define BUDGET_SENSORS_MS 5000  // Sensors warm-up and reading
+#define BUDGET_CONNECT_MS 15000 // WiFi, clock sync and authentication
+#define BUDGET_UPLOAD_MS 15000  // Buffered readings, in chunks
+#define BUDGET_PUMP_MS 30000    // Pumps commands, pump runs and their acknowledgement
+#define BUDGET_SLEEP_MS 3000    // Wrap-up, always kept free before the wake deadline
+
+// Wake cycle profiling (phase durations are sent along with the readings every N wakes)
+#define PROFILE_REPORT_EVERY_N_WAKES 30
 
 #endif
@@ -0,0 +1,132 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// Subset of the Arduino-ESP32 core used by the firmware, running on the simulation clock (see sim.hpp).
+//
+
+#ifndef MOCK_ARDUINO_H
+#define MOCK_ARDUINO_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "IPAddress.h"
+#include "Print.h"
+#include "Stream.h"
+#include "WString.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define PULLUP 0x04
+#define INPUT_PULLUP 0x05
+#define PULLDOWN 0x08
+#define INPUT_PULLDOWN 0x09
+
+// Kept in a section of its own, so that the fleet simulation can swap the RTC memory of each board
+#if defined(__ELF__)
+#define RTC_DATA_ATTR __attribute__((section("rtc_data")))
+#else
+#define RTC_DATA_ATTR
+#endif
+#define IRAM_ATTR
+#define SOC_ADC_MAX_CHANNEL_NUM 10
+
+typedef enum {
+  GPIO_NUM_NC = -1,
+  GPIO_NUM_0 = 0,
+  GPIO_NUM_1,
+  GPIO_NUM_2,
+  GPIO_NUM_3,
+  GPIO_NUM_4,
+  GPIO_NUM_5,
+  GPIO_NUM_6,
+  GPIO_NUM_7,
+  GPIO_NUM_8,
+  GPIO_NUM_9,
+  GPIO_NUM_10,
+  GPIO_NUM_11,
+  GPIO_NUM_12,
+  GPIO_NUM_13,
+  GPIO_NUM_14,
+  GPIO_NUM_15,
+  GPIO_NUM_16,
+  GPIO_NUM_17,
+  GPIO_NUM_18,
+  GPIO_NUM_19,
+  GPIO_NUM_20,
+  GPIO_NUM_21,
+  GPIO_NUM_22,
+  GPIO_NUM_23,
+  GPIO_NUM_25 = 25,
+  GPIO_NUM_26,
+  GPIO_NUM_27,
+  GPIO_NUM_32 = 32,
+  GPIO_NUM_33,
+  GPIO_NUM_34,
+  GPIO_NUM_35,
+  GPIO_NUM_36,
+  GPIO_NUM_37,
+  GPIO_NUM_38,
+  GPIO_NUM_39,
+  GPIO_NUM_MAX,
+} gpio_num_t;
+
+// Time
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+// GPIO
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int8_t digitalPinToAnalogChannel(uint8_t pin); // ADC2 channels are offset by SOC_ADC_MAX_CHANNEL_NUM
+uint16_t analogRead(uint8_t pin);
+
+// LEDC
+double ledcSetup(uint8_t channel, double freq, uint8_t resolution_bits);
+void ledcAttachPin(uint8_t pin, uint8_t channel);
+void ledcDetachPin(uint8_t pin);
+void ledcWrite(uint8_t channel, uint32_t duty);
+
+// Deep sleep, esp_deep_sleep_start() unwinds the firmware back to the simulation driver, from any task
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us);
+[[noreturn]] void esp_deep_sleep_start();
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  void end() {}
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+
+  // Queue input as if it had been typed on the serial monitor
+  void inject(const char* text);
+
+private:
+  std::string input;
+  size_t input_pos = 0;
+};
+
+extern HardwareSerial Serial;
+
+#endif // MOCK_ARDUINO_H
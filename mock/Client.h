@@ -0,0 +1,21 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef MOCK_CLIENT_H
+#define MOCK_CLIENT_H
+
+#include "IPAddress.h"
+#include "Stream.h"
+
+class Client : public Stream {
+public:
+  virtual int connect(IPAddress ip, uint16_t port) = 0;
+  virtual int connect(const char* host, uint16_t port) = 0;
+  virtual uint8_t connected() = 0;
+  virtual void stop() = 0;
+  virtual operator bool() = 0;
+  using Print::write;
+};
+
+#endif // MOCK_CLIENT_H
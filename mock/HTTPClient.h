@@ -0,0 +1,72 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// HTTP client talking to the in-process API server (sim::api_handle). Each request costs a round trip, the server
+// time and the transfer time, plus the TCP and TLS handshakes when the connection can't be reused.
+//
+
+#ifndef MOCK_HTTP_CLIENT_H
+#define MOCK_HTTP_CLIENT_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "WString.h"
+#include "WiFiClient.h"
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_NO_STREAM (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM (-8)
+#define HTTPC_ERROR_ENCODING (-9)
+#define HTTPC_ERROR_STREAM_WRITE (-10)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+#define HTTPCLIENT_DEFAULT_TCP_TIMEOUT (5000)
+
+#define HTTP_CODE_OK 200
+#define HTTP_CODE_NOT_FOUND 404
+
+class HTTPClient {
+public:
+  bool begin(WiFiClient& client, const String& url);
+  bool begin(const String& url);
+  void end();
+
+  void setReuse(bool reuse) { keep_alive = reuse; }
+  void setTimeout(uint16_t _timeout_ms) { timeout_ms = _timeout_ms; }
+  void setConnectTimeout(int32_t _timeout_ms) { connect_timeout_ms = _timeout_ms; }
+  void addHeader(const String& name, const String& value, bool first = false, bool replace = true);
+  void collectHeaders(const char* [], size_t) {}
+  String header(const char*) { return String(); } // Responses always come with a Content-Length
+
+  int GET();
+  int POST(uint8_t* payload, size_t size);
+  int POST(const String& payload) {
+    return POST(reinterpret_cast<uint8_t*>(const_cast<char*>(payload.c_str())), payload.length());
+  }
+
+  int getSize() { return (transport != nullptr) ? transport->available() : -1; }
+  WiFiClient& getStream() { return *transport; }
+  WiFiClient* getStreamPtr() { return transport; }
+  String getString() { return (transport != nullptr) ? transport->readString() : String(); }
+
+private:
+  WiFiClient* transport = nullptr;
+  WiFiClient default_transport;
+  bool keep_alive = true;
+  uint16_t timeout_ms = HTTPCLIENT_DEFAULT_TCP_TIMEOUT; // Wait for the answer
+  int32_t connect_timeout_ms = -1;
+  std::string host;
+  uint16_t port = 80;
+  std::string path;
+  std::vector<std::pair<std::string, std::string>> headers;
+
+  int send(const uint8_t* payload, size_t size);
+};
+
+#endif // MOCK_HTTP_CLIENT_H
@@ -0,0 +1,38 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef MOCK_IPADDRESS_H
+#define MOCK_IPADDRESS_H
+
+#include <cstdint>
+#include "Print.h"
+
+// IPv4 address, stored in network order like on the ESP32
+class IPAddress : public Printable {
+public:
+  IPAddress() = default;
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) :
+      address(a | (b << 8) | (c << 16) | (static_cast<uint32_t>(d) << 24)) {}
+  IPAddress(uint32_t _address) : address(_address) {}
+
+  operator uint32_t() const { return address; }
+  uint8_t operator[](int index) const { return address >> (8 * index); }
+
+  String toString() const {
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+    return String(buffer);
+  }
+  size_t printTo(Print& p) const override { return p.print(toString()); }
+
+private:
+  uint32_t address = 0;
+};
+
+#ifdef INADDR_NONE
+#undef INADDR_NONE
+#endif
+inline const IPAddress INADDR_NONE(0, 0, 0, 0);
+
+#endif // MOCK_IPADDRESS_H
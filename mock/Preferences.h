@@ -0,0 +1,45 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// NVS key/value store, kept in memory so that it survives the simulated deep sleeps.
+//
+
+#ifndef MOCK_PREFERENCES_H
+#define MOCK_PREFERENCES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class Preferences {
+public:
+  bool begin(const char* name, bool read_only = false);
+  void end();
+  bool clear();
+  bool remove(const char* key);
+  bool isKey(const char* key);
+
+  size_t putBytes(const char* key, const void* value, size_t len);
+  size_t getBytes(const char* key, void* buf, size_t max_len);
+  size_t getBytesLength(const char* key);
+
+  size_t putUInt(const char* key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+  uint32_t getUInt(const char* key, uint32_t default_value = 0) { return get(key, default_value); }
+  size_t putInt(const char* key, int32_t value) { return putBytes(key, &value, sizeof(value)); }
+  int32_t getInt(const char* key, int32_t default_value = 0) { return get(key, default_value); }
+  size_t putFloat(const char* key, float value) { return putBytes(key, &value, sizeof(value)); }
+  float getFloat(const char* key, float default_value = 0) { return get(key, default_value); }
+
+private:
+  std::string name;
+  bool opened = false;
+  bool read_only = false;
+
+  template <typename T>
+  T get(const char* key, T default_value) {
+    T value;
+    return (getBytesLength(key) == sizeof(T) && getBytes(key, &value, sizeof(T)) == sizeof(T)) ? value : default_value;
+  }
+};
+
+#endif // MOCK_PREFERENCES_H
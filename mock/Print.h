@@ -0,0 +1,104 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// Arduino Print, Printable and Stream for the native build.
+//
+
+#ifndef MOCK_PRINT_H
+#define MOCK_PRINT_H
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "WString.h"
+
+class Print;
+
+class Printable {
+public:
+  virtual ~Printable() = default;
+  virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+public:
+  virtual ~Print() = default;
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (n < size && write(buffer[n]) == 1)
+      n++;
+    return n;
+  }
+  size_t write(const char* str) { return write(reinterpret_cast<const uint8_t*>(str), strlen(str)); }
+  size_t write(const char* buffer, size_t size) { return write(reinterpret_cast<const uint8_t*>(buffer), size); }
+  virtual void flush() {}
+
+  size_t print(const char* str) { return write(str); }
+  size_t print(const String& str) { return write(str.c_str()); }
+  size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+  size_t print(const Printable& x) { return x.printTo(*this); }
+  size_t print(int value) { return printf("%d", value); }
+  size_t print(unsigned int value) { return printf("%u", value); }
+  size_t print(long value) { return printf("%ld", value); }
+  size_t print(unsigned long value) { return printf("%lu", value); }
+  size_t print(double value, int digits = 2) { return printf("%.*f", digits, value); }
+
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(const T& value) {
+    size_t n = print(value);
+    return n + println();
+  }
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (len < 0)
+      return 0;
+    return write(buffer, std::min(static_cast<size_t>(len), sizeof(buffer) - 1));
+  }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { timeout_ms = timeout; }
+  unsigned long getTimeout() const { return timeout_ms; }
+
+  // Everything is already buffered in the simulation, so there is nothing to wait for
+  virtual size_t readBytes(char* buffer, size_t length) {
+    size_t n = 0;
+    for (int c; n < length && (c = read()) >= 0; n++)
+      buffer[n] = static_cast<char>(c);
+    return n;
+  }
+  size_t readBytes(uint8_t* buffer, size_t length) { return readBytes(reinterpret_cast<char*>(buffer), length); }
+
+  size_t readBytesUntil(char terminator, char* buffer, size_t length) {
+    size_t n = 0;
+    for (int c; n < length && (c = read()) >= 0 && c != terminator; n++)
+      buffer[n] = static_cast<char>(c);
+    return n;
+  }
+
+  String readString() {
+    String str;
+    for (int c; (c = read()) >= 0;)
+      str += static_cast<char>(c);
+    return str;
+  }
+
+protected:
+  unsigned long timeout_ms = 1000;
+};
+
+#endif // MOCK_PRINT_H
@@ -0,0 +1,10 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef MOCK_STREAM_H
+#define MOCK_STREAM_H
+
+#include "Print.h"
+
+#endif // MOCK_STREAM_H
@@ -0,0 +1,87 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// Arduino String, backed by std::string for the native build. Its allocations are not charged to the firmware, short
+// strings don't allocate on target and the longer ones are mostly built by the libraries themselves.
+//
+
+#ifndef MOCK_WSTRING_H
+#define MOCK_WSTRING_H
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <strings.h>
+#include "sim.hpp"
+
+class String {
+public:
+  String(const char* str = "") {
+    sim::AllocPause pause;
+    data = (str == nullptr) ? "" : str;
+  }
+  String(const std::string& str) {
+    sim::AllocPause pause;
+    data = str;
+  }
+  String(char c) : data(1, c) {}
+  explicit String(long value) : data(std::to_string(value)) {}
+  explicit String(unsigned long value) : data(std::to_string(value)) {}
+  explicit String(int value) : data(std::to_string(value)) {}
+  explicit String(unsigned int value) : data(std::to_string(value)) {}
+
+  const char* c_str() const { return data.c_str(); }
+  unsigned int length() const { return data.size(); }
+  bool isEmpty() const { return data.empty(); }
+  bool reserve(unsigned int size) {
+    data.reserve(size);
+    return true;
+  }
+
+  char charAt(unsigned int index) const { return (index < data.size()) ? data[index] : '\0'; }
+  char operator[](unsigned int index) const { return charAt(index); }
+
+  bool equals(const String& other) const { return data == other.data; }
+  bool equalsIgnoreCase(const String& other) const { return strcasecmp(c_str(), other.c_str()) == 0; }
+  bool startsWith(const String& prefix) const { return data.compare(0, prefix.data.size(), prefix.data) == 0; }
+  int indexOf(char c, unsigned int from = 0) const {
+    auto pos = data.find(c, from);
+    return (pos == std::string::npos) ? -1 : static_cast<int>(pos);
+  }
+  String substring(unsigned int from, unsigned int to = ~0U) const {
+    return (from >= data.size()) ? String() : String(data.substr(from, to - from));
+  }
+  long toInt() const { return strtol(c_str(), nullptr, 10); }
+  float toFloat() const { return strtof(c_str(), nullptr); }
+
+  bool concat(const String& other) {
+    data += other.data;
+    return true;
+  }
+  bool concat(const char* str, unsigned int n) {
+    data.append(str, n);
+    return true;
+  }
+  bool concat(char c) {
+    data += c;
+    return true;
+  }
+
+  String& operator+=(const String& other) {
+    concat(other);
+    return *this;
+  }
+  String& operator+=(const char* str) { return *this += String(str); }
+  String& operator+=(char c) {
+    concat(c);
+    return *this;
+  }
+  friend String operator+(String lhs, const String& rhs) { return lhs += rhs; }
+  friend bool operator==(const String& lhs, const String& rhs) { return lhs.equals(rhs); }
+  friend bool operator!=(const String& lhs, const String& rhs) { return !lhs.equals(rhs); }
+
+private:
+  std::string data;
+};
+
+#endif // MOCK_WSTRING_H
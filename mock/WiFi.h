@@ -0,0 +1,56 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// WiFi station. Connecting takes Config::wifi_fast_ms with a known BSSID and channel, Config::wifi_scan_ms otherwise,
+// plus Config::wifi_dhcp_ms without a static IP.
+//
+
+#ifndef MOCK_WIFI_H
+#define MOCK_WIFI_H
+
+#include <Arduino.h>
+#include "IPAddress.h"
+#include "WiFiClient.h"
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } wifi_mode_t;
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6,
+  WL_NO_SHIELD = 255,
+} wl_status_t;
+
+class WiFiClass {
+public:
+  bool mode(wifi_mode_t mode);
+  bool config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1 = static_cast<uint32_t>(0),
+              IPAddress dns2 = static_cast<uint32_t>(0));
+  wl_status_t begin(const char* ssid, const char* passphrase = nullptr, int32_t channel = 0,
+                    const uint8_t* bssid = nullptr, bool connect = true);
+  bool disconnect(bool wifioff = false, bool eraseap = false);
+  wl_status_t status();
+
+  uint8_t* BSSID();
+  int32_t channel();
+  IPAddress localIP();
+  IPAddress gatewayIP();
+  IPAddress subnetMask();
+  IPAddress dnsIP(uint8_t index = 0);
+
+private:
+  bool connecting = false;
+  bool associated = false;
+  bool static_ip = false;
+  IPAddress static_address;
+  int64_t started_us = 0;
+  int64_t connected_us = 0;
+};
+
+extern WiFiClass WiFi;
+
+#endif // MOCK_WIFI_H
@@ -0,0 +1,45 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// Socket to the in-process API server. A request is answered as a whole, the response is then read from the buffer.
+//
+
+#ifndef MOCK_WIFI_CLIENT_H
+#define MOCK_WIFI_CLIENT_H
+
+#include <string>
+#include "Client.h"
+
+class WiFiClient : public Client {
+public:
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(const char* _host, uint16_t port) override;
+  // TCP connection, then TLS handshake for a WiFiClientSecure. Fails if they take longer than the timeout (< 0: none)
+  int connect(const char* _host, uint16_t port, int32_t timeout_ms);
+  uint8_t connected() override { return is_connected; }
+  void stop() override;
+  operator bool() override { return is_connected; }
+
+  int available() override { return static_cast<int>(rx.size() - rx_pos); }
+  int read() override { return (rx_pos < rx.size()) ? static_cast<uint8_t>(rx[rx_pos++]) : -1; }
+  int peek() override { return (rx_pos < rx.size()) ? static_cast<uint8_t>(rx[rx_pos]) : -1; }
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+
+  // Simulation side
+  bool secure() const { return is_secure; }
+  const std::string& host() const { return remote; } // "host:port"
+  void receive(const char* data, size_t size);
+
+protected:
+  bool is_secure = false;
+
+private:
+  bool is_connected = false;
+  std::string remote;
+  std::string rx;
+  size_t rx_pos = 0;
+};
+
+#endif // MOCK_WIFI_CLIENT_H
@@ -0,0 +1,17 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef MOCK_WIFI_CLIENT_SECURE_H
+#define MOCK_WIFI_CLIENT_SECURE_H
+
+#include "WiFiClient.h"
+
+class WiFiClientSecure : public WiFiClient {
+public:
+  WiFiClientSecure() { is_secure = true; }
+  void setInsecure() {}
+  void setCACert(const char*) {}
+};
+
+#endif // MOCK_WIFI_CLIENT_SECURE_H
@@ -0,0 +1,166 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// Heap accounting: malloc and friends are interposed to count the allocations made by the firmware.
+//
+
+#include "sim.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <esp_heap_caps.h>
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+
+namespace {
+  constexpr size_t SIM_HEAP_SIZE{300 * 1024}; // Heap left to the application on an ESP32 running WiFi
+  constexpr size_t TRACKED{1 << 14};          // Counted blocks that can be live at once
+
+  std::atomic<bool> enabled{false};
+  thread_local unsigned int paused = 0;
+
+  std::atomic<uint64_t> allocations{0};
+  std::atomic<size_t> live_blocks{0};
+  std::atomic<size_t> live_bytes{0};
+
+  // Counted blocks, so that freeing a block the firmware didn't allocate isn't taken off the counts. Open addressing
+  // with linear probing, entries are shifted back on removal.
+  struct Block {
+    void* ptr;
+    size_t size;
+  };
+  Block blocks[TRACKED];
+  std::atomic_flag lock = ATOMIC_FLAG_INIT;
+
+  struct Locked {
+    Locked() {
+      while (lock.test_and_set(std::memory_order_acquire)) {}
+    }
+    ~Locked() { lock.clear(std::memory_order_release); }
+  };
+
+  size_t slot_of(const void* ptr) { return (reinterpret_cast<uintptr_t>(ptr) >> 4) * 0x9E3779B1U % TRACKED; }
+
+  bool counting() { return paused == 0 && enabled.load(std::memory_order_relaxed); }
+
+  void track(void* ptr, size_t size) {
+    allocations++;
+    if (ptr == nullptr)
+      return;
+    Locked locked;
+    if (live_blocks == TRACKED - 1)
+      return; // Table full, the block is counted but not tracked
+    size_t i = slot_of(ptr);
+    while (blocks[i].ptr != nullptr)
+      i = (i + 1) % TRACKED;
+    blocks[i] = Block{ptr, size};
+    live_blocks++;
+    live_bytes += size;
+  }
+
+  void untrack(void* ptr) {
+    if (ptr == nullptr || live_blocks.load(std::memory_order_relaxed) == 0)
+      return;
+    Locked locked;
+    size_t i = slot_of(ptr);
+    while (blocks[i].ptr != ptr) {
+      if (blocks[i].ptr == nullptr)
+        return;
+      i = (i + 1) % TRACKED;
+    }
+    live_blocks--;
+    live_bytes -= blocks[i].size;
+    blocks[i].ptr = nullptr;
+
+    // Shift back the entries that probed past the freed slot
+    for (size_t j = (i + 1) % TRACKED; blocks[j].ptr != nullptr; j = (j + 1) % TRACKED) {
+      size_t home = slot_of(blocks[j].ptr);
+      bool reachable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+      if (reachable) {
+        blocks[i] = blocks[j];
+        blocks[j].ptr = nullptr;
+        i = j;
+      }
+    }
+  }
+} // namespace
+
+namespace sim {
+  HeapStats heap_stats() { return HeapStats{allocations.load(), live_blocks.load(), live_bytes.load()}; }
+
+  void count_allocations(bool enable) { enabled = enable; }
+
+  AllocPause::AllocPause() { paused++; }
+  AllocPause::~AllocPause() { paused--; }
+} // namespace sim
+
+// ----------------------------------------------------------------------------
+// esp_heap_caps
+// ----------------------------------------------------------------------------
+void heap_caps_get_info(multi_heap_info_t* info, uint32_t) {
+  *info = multi_heap_info_t{};
+  info->total_allocated_bytes = live_bytes;
+  info->total_free_bytes = SIM_HEAP_SIZE - std::min(live_bytes.load(), SIM_HEAP_SIZE);
+  info->largest_free_block = info->total_free_bytes;
+  info->allocated_blocks = live_blocks;
+  info->total_blocks = live_blocks + 1;
+  info->free_blocks = 1;
+}
+
+size_t heap_caps_get_free_size(uint32_t) { return SIM_HEAP_SIZE - std::min(live_bytes.load(), SIM_HEAP_SIZE); }
+
+// ----------------------------------------------------------------------------
+// libc
+// ----------------------------------------------------------------------------
+extern "C" {
+void* malloc(size_t size) {
+  void* ptr = __libc_malloc(size);
+  if (counting())
+    track(ptr, size);
+  return ptr;
+}
+
+void* calloc(size_t count, size_t size) {
+  void* ptr = __libc_calloc(count, size);
+  if (counting())
+    track(ptr, count * size);
+  return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+  untrack(ptr);
+  void* moved = __libc_realloc(ptr, size);
+  if (counting())
+    track(moved, size);
+  return moved;
+}
+
+void free(void* ptr) {
+  untrack(ptr);
+  __libc_free(ptr);
+}
+
+void* memalign(size_t alignment, size_t size) {
+  void* ptr = __libc_memalign(alignment, size);
+  if (counting())
+    track(ptr, size);
+  return ptr;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) { return memalign(alignment, size); }
+
+int posix_memalign(void** out, size_t alignment, size_t size) {
+  void* ptr = memalign(alignment, size);
+  if (ptr == nullptr)
+    return ENOMEM;
+  *out = ptr;
+  return 0;
+}
+}
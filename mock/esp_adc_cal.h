@@ -0,0 +1,35 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// Ideal calibration: the simulated ADC is linear over [0, 3300] mV at 12 bits.
+//
+
+#ifndef MOCK_ESP_ADC_CAL_H
+#define MOCK_ESP_ADC_CAL_H
+
+#include <cstdint>
+#include "driver/adc.h"
+
+typedef enum { ESP_ADC_CAL_VAL_EFUSE_VREF, ESP_ADC_CAL_VAL_EFUSE_TP, ESP_ADC_CAL_VAL_DEFAULT_VREF } esp_adc_cal_value_t;
+
+typedef struct {
+  adc_unit_t adc_num;
+  adc_atten_t atten;
+  adc_bits_width_t bit_width;
+  uint32_t vref;
+} esp_adc_cal_characteristics_t;
+
+constexpr uint32_t SIM_ADC_FULL_SCALE_MV{3300};
+constexpr uint32_t SIM_ADC_MAX_RAW{4095};
+
+inline esp_adc_cal_value_t esp_adc_cal_characterize(adc_unit_t unit, adc_atten_t atten, adc_bits_width_t width,
+                                                    uint32_t default_vref, esp_adc_cal_characteristics_t* chars) {
+  *chars = esp_adc_cal_characteristics_t{unit, atten, width, default_vref};
+  return ESP_ADC_CAL_VAL_DEFAULT_VREF;
+}
+
+inline uint32_t esp_adc_cal_raw_to_voltage(uint32_t raw, const esp_adc_cal_characteristics_t*) {
+  return (raw * SIM_ADC_FULL_SCALE_MV + SIM_ADC_MAX_RAW / 2) / SIM_ADC_MAX_RAW;
+}
+
+#endif // MOCK_ESP_ADC_CAL_H
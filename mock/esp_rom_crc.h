@@ -0,0 +1,15 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// CRC routines of the ESP32 ROM.
+//
+
+#ifndef MOCK_ESP_ROM_CRC_H
+#define MOCK_ESP_ROM_CRC_H
+
+#include <cstdint>
+
+// CRC32 (IEEE 802.3, little endian), chained through crc: esp_rom_crc32_le(0, ...) starts a new one
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len);
+
+#endif // MOCK_ESP_ROM_CRC_H
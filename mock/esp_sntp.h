@@ -0,0 +1,24 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// SNTP client answering with the actual simulation time after Config::sntp_ms.
+//
+
+#ifndef MOCK_ESP_SNTP_H
+#define MOCK_ESP_SNTP_H
+
+#include <cstdint>
+#include <sys/time.h>
+
+#define SNTP_OPMODE_POLL 0
+#define SNTP_OPMODE_LISTENONLY 1
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval* tv);
+
+void sntp_setoperatingmode(uint8_t operating_mode);
+void sntp_setservername(uint8_t idx, const char* server);
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback);
+void sntp_init();
+void sntp_stop();
+
+#endif // MOCK_ESP_SNTP_H
@@ -0,0 +1,83 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// API server load: request queueing on the server workers and request log of the fleet.
+//
+
+#include "sim.hpp"
+#include <algorithm>
+#include <deque>
+
+namespace sim {
+
+  namespace {
+    constexpr int64_t SLOT_US{1000}; // Resolution of the server occupancy
+
+    /**
+     * Time the server workers are busy in each slot, as a fluid queue: a request takes whatever capacity is left in
+     * the slots from its arrival on, but never more than one worker at a time.
+     */
+    struct Server {
+      int64_t first_slot = 0;
+      std::deque<int64_t> busy_us; // Worker time used in each slot from first_slot on
+    };
+
+    Server& server() {
+      static Server s;
+      return s;
+    }
+
+    std::vector<Request>& request_log() {
+      static std::vector<Request> log;
+      return log;
+    }
+
+    std::vector<std::string>& routes() {
+      static std::vector<std::string> names;
+      return names;
+    }
+  } // namespace
+
+  int64_t serve_request(int64_t arrival_epoch_us) {
+    auto& s = server();
+    const int64_t capacity = SLOT_US * std::max<uint32_t>(config().server_workers, 1);
+    if (s.busy_us.empty())
+      s.first_slot = arrival_epoch_us / SLOT_US;
+
+    int64_t at = std::max(arrival_epoch_us, s.first_slot * SLOT_US);
+    int64_t left = config().server_ms * 1000LL;
+    while (left > 0) {
+      auto slot = static_cast<size_t>(at / SLOT_US - s.first_slot);
+      if (slot >= s.busy_us.size())
+        s.busy_us.resize(slot + 1, 0);
+      int64_t slot_end = (at / SLOT_US + 1) * SLOT_US;
+      int64_t used = std::min({left, capacity - s.busy_us[slot], slot_end - at});
+      s.busy_us[slot] += used;
+      left -= used;
+      at = (left > 0) ? slot_end : at + used;
+    }
+    return at;
+  }
+
+  void forget_requests_before(int64_t epoch_us) {
+    auto& s = server();
+    while (!s.busy_us.empty() && s.first_slot < epoch_us / SLOT_US) {
+      s.busy_us.pop_front();
+      s.first_slot++;
+    }
+  }
+
+  void record_request(const char* path, int64_t epoch_us, int64_t latency_us, int64_t queued_us, size_t bytes) {
+    auto& names = routes();
+    auto route = std::find(names.begin(), names.end(), path);
+    if (route == names.end())
+      route = names.insert(names.end(), path);
+    request_log().push_back(Request{static_cast<uint8_t>(route - names.begin()), epoch_us, latency_us, queued_us,
+                                    static_cast<uint32_t>(bytes)});
+  }
+
+  const std::vector<Request>& requests() { return request_log(); }
+
+  const std::vector<std::string>& route_names() { return routes(); }
+
+} // namespace sim
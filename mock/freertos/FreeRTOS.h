@@ -0,0 +1,86 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// FreeRTOS subset, tasks run on their own forked clock (see sim.hpp). One tick is one millisecond.
+//
+
+#ifndef MOCK_FREERTOS_H
+#define MOCK_FREERTOS_H
+
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+typedef uint32_t EventBits_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void (*TaskFunction_t)(void*);
+typedef uint8_t StackType_t; // Stack depths are in bytes, as in ESP-IDF
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portMAX_DELAY static_cast<TickType_t>(0xFFFFFFFF)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) static_cast<TickType_t>(ms)
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+#define BIT0 0x00000001
+#define BIT1 0x00000002
+#define BIT2 0x00000004
+#define BIT3 0x00000008
+#define BIT4 0x00000010
+#define BIT5 0x00000020
+#define BIT6 0x00000040
+#define BIT7 0x00000080
+
+typedef struct sim_task* TaskHandle_t;
+typedef struct sim_event_group* EventGroupHandle_t;
+typedef struct sim_semaphore* SemaphoreHandle_t;
+
+// Storage of the statically allocated objects, large enough for the simulation state behind each handle
+typedef struct {
+  alignas(8) uint8_t storage[16];
+} StaticTask_t;
+typedef struct {
+  alignas(8) uint8_t storage[288];
+} StaticEventGroup_t;
+typedef struct {
+  alignas(8) uint8_t storage[112];
+} StaticSemaphore_t;
+
+// Tasks
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char* name, uint32_t stack_depth, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t task, const char* name, uint32_t stack_depth, void* arg,
+                                          UBaseType_t priority, StackType_t* stack, StaticTask_t* buffer,
+                                          BaseType_t core);
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stack_depth, void* arg, UBaseType_t priority,
+                       TaskHandle_t* handle);
+void vTaskDelete(TaskHandle_t task); // Only a task deleting itself is supported
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+
+// Event groups
+EventGroupHandle_t xEventGroupCreate();
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t* buffer);
+void vEventGroupDelete(EventGroupHandle_t group);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks);
+
+// Semaphores
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+SemaphoreHandle_t xSemaphoreCreateCountingStatic(UBaseType_t max_count, UBaseType_t initial_count,
+                                                 StaticSemaphore_t* buffer);
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t* buffer);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t* woken);
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+
+#endif // MOCK_FREERTOS_H
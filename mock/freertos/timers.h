@@ -0,0 +1,25 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// FreeRTOS software timers. There is no timer task: a timer fires on the task whose clock reaches its expiry first.
+//
+
+#ifndef MOCK_FREERTOS_TIMERS_H
+#define MOCK_FREERTOS_TIMERS_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct sim_software_timer* TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+typedef struct {
+  alignas(8) uint8_t storage[48];
+} StaticTimer_t;
+
+TimerHandle_t xTimerCreateStatic(const char* name, TickType_t period, UBaseType_t auto_reload, void* id,
+                                 TimerCallbackFunction_t callback, StaticTimer_t* buffer);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks); // Counts the period from now on
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks);
+void* pvTimerGetTimerID(TimerHandle_t timer);
+
+#endif // MOCK_FREERTOS_TIMERS_H
@@ -0,0 +1,509 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// Board peripherals: GPIO, ADC, LEDC, Serial, flash partitions, NVS and deep sleep.
+//
+
+#include "sim.hpp"
+#include <Arduino.h>
+#include <Preferences.h>
+#include <driver/adc.h>
+#include <esp_adc_cal.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <map>
+#include <nvs_flash.h>
+
+HardwareSerial Serial;
+
+namespace sim {
+
+  namespace {
+    constexpr int PIN_COUNT{GPIO_NUM_MAX};
+    constexpr int LEDC_CHANNELS{16};
+
+    struct AnalogSource {
+      int data_pin;
+      int enable_pin;
+      std::function<uint32_t(double)> millivolts;
+      int mux_channel = -1;
+    };
+
+    struct Mux {
+      int signal_pin = -1;
+      std::vector<int> address_pins;
+      int inhibit_pin = -1;
+      int previous = 0;         // Channel selected before the last address change
+      int64_t switched_us = -1; // Time of the last address change
+    };
+
+    struct LedcChannel {
+      int pin = -1;
+      uint8_t resolution = 8;
+      uint32_t duty = 0;
+      int64_t on_since_us = 0;
+    };
+
+    struct Board {
+      int levels[PIN_COUNT]{};
+      LedcChannel ledc[LEDC_CHANNELS];
+      std::vector<AnalogSource> sources;
+      Mux mux;
+      double pumped_s[PIN_COUNT]{}; // Full duty equivalent run time of the pump on each pin, kept across wakes
+      uint32_t noise = 12345;       // Deterministic measurement noise
+      uint64_t wakeup_us = 0;
+    };
+
+    Board& board() {
+      static Board b;
+      return b;
+    }
+
+    // +/- 8 mV of noise
+    int32_t noise_mv() {
+      board().noise = board().noise * 1103515245 + 12345;
+      return static_cast<int32_t>((board().noise >> 16) % 17) - 8;
+    }
+  } // namespace
+
+  void set_analog(int data_pin, int enable_pin, std::function<uint32_t(double)> millivolts) {
+    board().sources.push_back(AnalogSource{data_pin, enable_pin, std::move(millivolts)});
+  }
+
+  void set_mux(int signal_pin, std::vector<int> address_pins, int inhibit_pin) {
+    board().mux = Mux{signal_pin, std::move(address_pins), inhibit_pin};
+  }
+
+  void set_mux_analog(int channel, int rail_pin, std::function<uint32_t(double)> millivolts) {
+    board().sources.push_back(AnalogSource{board().mux.signal_pin, rail_pin, std::move(millivolts), channel});
+  }
+
+  namespace {
+    int mux_selected() {
+      int channel = 0;
+      for (size_t bit = 0; bit < board().mux.address_pins.size(); bit++)
+        channel |= pin_level(board().mux.address_pins[bit]) << bit;
+      return channel;
+    }
+  } // namespace
+
+  uint32_t analog_mv(int pin) {
+    // On the mux line, only the selected channel (or the previous one while switching) is connected
+    const auto& mux = board().mux;
+    int channel = -1;
+    if (pin == mux.signal_pin) {
+      if (mux.inhibit_pin >= 0 && pin_level(mux.inhibit_pin) == HIGH)
+        return 0;
+      channel = (mux.switched_us >= 0 && now_us() - mux.switched_us < config().mux_settle_us) ? mux.previous
+                                                                                              : mux_selected();
+    }
+
+    // Powered sensors sharing the line average out, a line left alone is pulled down
+    double epoch_s = static_cast<double>(true_epoch_us()) / 1e6;
+    uint32_t sum = 0, n = 0;
+    for (const auto& source : board().sources)
+      if (source.data_pin == pin && source.mux_channel == channel &&
+          (source.enable_pin < 0 || pin_level(source.enable_pin) == HIGH)) {
+        sum += source.millivolts(epoch_s);
+        n++;
+      }
+    if (n == 0)
+      return 0;
+    return static_cast<uint32_t>(std::max<int32_t>(0, static_cast<int32_t>(sum / n) + noise_mv()));
+  }
+
+  int pin_level(int pin) { return (pin >= 0 && pin < PIN_COUNT) ? board().levels[pin] : LOW; }
+
+  double pumped_s(int pin) { return (pin >= 0 && pin < PIN_COUNT) ? board().pumped_s[pin] : 0.0; }
+
+  void reset_board() {
+    auto& b = board();
+    std::fill(std::begin(b.levels), std::end(b.levels), LOW);
+    for (auto& channel : b.ledc)
+      channel = LedcChannel{};
+    b.mux.previous = 0;
+    b.mux.switched_us = -1;
+  }
+
+} // namespace sim
+
+// ----------------------------------------------------------------------------
+// Time
+// ----------------------------------------------------------------------------
+unsigned long millis() { return static_cast<unsigned long>(sim::now_us() / 1000); }
+unsigned long micros() { return static_cast<unsigned long>(sim::now_us()); }
+void delay(uint32_t ms) { sim::advance(static_cast<int64_t>(ms) * 1000); }
+void delayMicroseconds(uint32_t us) { sim::advance(us); }
+
+// ----------------------------------------------------------------------------
+// GPIO and ADC
+// ----------------------------------------------------------------------------
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin >= sim::PIN_COUNT)
+    return;
+  auto& mux = sim::board().mux;
+  int selected = sim::mux_selected();
+  sim::board().levels[pin] = (value) ? HIGH : LOW;
+  if (sim::mux_selected() != selected) {
+    mux.previous = selected;
+    mux.switched_us = sim::now_us();
+  }
+}
+
+int digitalRead(uint8_t pin) { return sim::pin_level(pin); }
+
+int8_t digitalPinToAnalogChannel(uint8_t pin) {
+  switch (pin) {
+  // ADC1
+  case 36: return 0;
+  case 37: return 1;
+  case 38: return 2;
+  case 39: return 3;
+  case 32: return 4;
+  case 33: return 5;
+  case 34: return 6;
+  case 35: return 7;
+  // ADC2
+  case 4: return SOC_ADC_MAX_CHANNEL_NUM + 0;
+  case 0: return SOC_ADC_MAX_CHANNEL_NUM + 1;
+  case 2: return SOC_ADC_MAX_CHANNEL_NUM + 2;
+  case 15: return SOC_ADC_MAX_CHANNEL_NUM + 3;
+  case 13: return SOC_ADC_MAX_CHANNEL_NUM + 4;
+  case 12: return SOC_ADC_MAX_CHANNEL_NUM + 5;
+  case 14: return SOC_ADC_MAX_CHANNEL_NUM + 6;
+  case 27: return SOC_ADC_MAX_CHANNEL_NUM + 7;
+  case 25: return SOC_ADC_MAX_CHANNEL_NUM + 8;
+  case 26: return SOC_ADC_MAX_CHANNEL_NUM + 9;
+  default: return -1;
+  }
+}
+
+namespace {
+  int pin_of(bool adc2, int channel) {
+    for (int pin = 0; pin < sim::PIN_COUNT; pin++)
+      if (digitalPinToAnalogChannel(pin) == channel + ((adc2) ? SOC_ADC_MAX_CHANNEL_NUM : 0))
+        return pin;
+    return -1;
+  }
+
+  int sample(int pin) {
+    int64_t start = sim::now_us();
+    sim::advance(sim::config().adc_sample_us);
+    sim::record(sim::Phase::ADC, start, sim::now_us());
+    return static_cast<int>(std::min(sim::analog_mv(pin) * SIM_ADC_MAX_RAW / SIM_ADC_FULL_SCALE_MV, SIM_ADC_MAX_RAW));
+  }
+} // namespace
+
+uint16_t analogRead(uint8_t pin) {
+  if (digitalPinToAnalogChannel(pin) >= SOC_ADC_MAX_CHANNEL_NUM && sim::radio_on())
+    return 0;
+  return static_cast<uint16_t>(sample(pin));
+}
+
+esp_err_t adc1_config_width(adc_bits_width_t) { return ESP_OK; }
+esp_err_t adc1_config_channel_atten(adc1_channel_t, adc_atten_t) { return ESP_OK; }
+int adc1_get_raw(adc1_channel_t channel) { return sample(pin_of(false, channel)); }
+esp_err_t adc2_config_channel_atten(adc2_channel_t, adc_atten_t) { return ESP_OK; }
+
+esp_err_t adc2_get_raw(adc2_channel_t channel, adc_bits_width_t, int* raw) {
+  if (sim::radio_on())
+    return ESP_ERR_TIMEOUT;
+  *raw = sample(pin_of(true, channel));
+  return ESP_OK;
+}
+
+// ----------------------------------------------------------------------------
+// LEDC, a channel with a non null duty counts as a running pump
+// ----------------------------------------------------------------------------
+double ledcSetup(uint8_t channel, double freq, uint8_t resolution) {
+  sim::board().ledc[channel % sim::LEDC_CHANNELS].resolution = resolution;
+  return freq;
+}
+
+void ledcAttachPin(uint8_t pin, uint8_t channel) { sim::board().ledc[channel % sim::LEDC_CHANNELS].pin = pin; }
+
+void ledcDetachPin(uint8_t pin) {
+  for (auto& channel : sim::board().ledc)
+    if (channel.pin == pin)
+      channel.pin = -1;
+}
+
+void ledcWrite(uint8_t channel, uint32_t duty) {
+  auto& c = sim::board().ledc[channel % sim::LEDC_CHANNELS];
+  if (c.duty == 0 && duty > 0)
+    c.on_since_us = sim::now_us();
+  else if (c.duty > 0 && duty != c.duty && c.pin >= 0) {
+    if (duty == 0)
+      sim::record(sim::Phase::PUMP, c.on_since_us, sim::now_us());
+    double full_scale = static_cast<double>((1U << c.resolution) - 1);
+    sim::board().pumped_s[c.pin] += static_cast<double>(sim::now_us() - c.on_since_us) / 1e6 * c.duty / full_scale;
+    c.on_since_us = sim::now_us();
+  }
+  c.duty = duty;
+}
+
+// ----------------------------------------------------------------------------
+// Deep sleep
+// ----------------------------------------------------------------------------
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us) {
+  sim::board().wakeup_us = time_in_us;
+  return ESP_OK;
+}
+
+void esp_deep_sleep_start() {
+  sim::AllocPause pause;
+  sim::sleep_now(sim::board().wakeup_us);
+}
+
+// ----------------------------------------------------------------------------
+// Serial, the console input is empty unless injected
+// ----------------------------------------------------------------------------
+int HardwareSerial::available() {
+  sim::advance(sim::config().serial_poll_us);
+  return static_cast<int>(input.size() - input_pos);
+}
+
+int HardwareSerial::read() { return (input_pos < input.size()) ? static_cast<uint8_t>(input[input_pos++]) : -1; }
+
+int HardwareSerial::peek() { return (input_pos < input.size()) ? static_cast<uint8_t>(input[input_pos]) : -1; }
+
+size_t HardwareSerial::write(uint8_t c) { return write(&c, 1); }
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  sim::AllocPause pause; // stdout allocates its buffer on first use
+  if (sim::config().verbose)
+    fwrite(buffer, 1, size, stdout);
+  return size;
+}
+
+void HardwareSerial::inject(const char* text) {
+  input.erase(0, input_pos);
+  input_pos = 0;
+  input += text;
+}
+
+// ----------------------------------------------------------------------------
+// Flash partitions (partitions.csv)
+// ----------------------------------------------------------------------------
+namespace {
+  struct Partition {
+    esp_partition_t info;
+    std::vector<uint8_t> data;
+  };
+
+  std::vector<Partition>& partitions() {
+    sim::AllocPause pause;
+    static std::vector<Partition> table = [] {
+      std::vector<Partition> t;
+      t.push_back(Partition{{ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, 0x290000, 0x20000, "readings", false},
+                            std::vector<uint8_t>(0x20000, 0xFF)});
+      return t;
+    }();
+    return table;
+  }
+
+  Partition* partition_of(const esp_partition_t* info) {
+    for (auto& partition : partitions())
+      if (&partition.info == info)
+        return &partition;
+    return nullptr;
+  }
+} // namespace
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label) {
+  for (auto& partition : partitions())
+    if (partition.info.type == type &&
+        (subtype == ESP_PARTITION_SUBTYPE_ANY || partition.info.subtype == subtype) &&
+        (label == nullptr || strcmp(partition.info.label, label) == 0))
+      return &partition.info;
+  return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* info, size_t src_offset, void* dst, size_t size) {
+  Partition* partition = partition_of(info);
+  if (partition == nullptr || src_offset + size > info->size)
+    return ESP_ERR_INVALID_ARG;
+  memcpy(dst, partition->data.data() + src_offset, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* info, size_t dst_offset, const void* src, size_t size) {
+  Partition* partition = partition_of(info);
+  if (partition == nullptr || dst_offset + size > info->size)
+    return ESP_ERR_INVALID_ARG;
+  int64_t start = sim::now_us();
+  // Programming can only clear bits
+  for (size_t i = 0; i < size; i++)
+    partition->data[dst_offset + i] &= static_cast<const uint8_t*>(src)[i];
+  sim::advance(static_cast<int64_t>(size) * sim::config().flash_write_us_per_byte);
+  sim::record(sim::Phase::FLASH, start, sim::now_us());
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* info, size_t offset, size_t size) {
+  Partition* partition = partition_of(info);
+  if (partition == nullptr || offset + size > info->size || offset % 4096 != 0 || size % 4096 != 0)
+    return ESP_ERR_INVALID_ARG;
+  int64_t start = sim::now_us();
+  std::fill_n(partition->data.begin() + offset, size, 0xFF);
+  sim::advance(static_cast<int64_t>(size / 4096) * sim::config().flash_erase_sector_us);
+  sim::record(sim::Phase::FLASH, start, sim::now_us());
+  return ESP_OK;
+}
+
+// ----------------------------------------------------------------------------
+// NVS
+// ----------------------------------------------------------------------------
+namespace {
+  using Namespace = std::map<std::string, std::vector<uint8_t>>;
+
+  std::map<std::string, Namespace>& nvs() {
+    static std::map<std::string, Namespace> store;
+    return store;
+  }
+} // namespace
+
+esp_err_t nvs_flash_init() { return ESP_OK; }
+
+esp_err_t nvs_flash_erase() {
+  nvs().clear();
+  return ESP_OK;
+}
+
+bool Preferences::begin(const char* _name, bool _read_only) {
+  sim::AllocPause pause;
+  name = _name;
+  read_only = _read_only;
+  opened = true;
+  return true;
+}
+
+void Preferences::end() { opened = false; }
+
+bool Preferences::clear() {
+  sim::AllocPause pause;
+  if (!opened || read_only)
+    return false;
+  nvs()[name].clear();
+  return true;
+}
+
+bool Preferences::remove(const char* key) {
+  sim::AllocPause pause;
+  if (!opened || read_only)
+    return false;
+  return nvs()[name].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char* key) {
+  sim::AllocPause pause;
+  return opened && nvs()[name].count(key) > 0;
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t len) {
+  sim::AllocPause pause;
+  if (!opened || read_only)
+    return 0;
+  int64_t start = sim::now_us();
+  auto bytes = static_cast<const uint8_t*>(value);
+  nvs()[name][key].assign(bytes, bytes + len);
+  sim::advance(sim::config().nvs_write_us + static_cast<int64_t>(len) * sim::config().flash_write_us_per_byte);
+  sim::record(sim::Phase::FLASH, start, sim::now_us());
+  return len;
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t max_len) {
+  sim::AllocPause pause;
+  if (!isKey(key))
+    return 0;
+  int64_t start = sim::now_us();
+  const auto& bytes = nvs()[name][key];
+  sim::advance(sim::config().nvs_read_us);
+  sim::record(sim::Phase::FLASH, start, sim::now_us());
+  if (bytes.size() > max_len)
+    return 0;
+  memcpy(buf, bytes.data(), bytes.size());
+  return bytes.size();
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+  sim::AllocPause pause;
+  return (isKey(key)) ? nvs()[name][key].size() : 0;
+}
+
+// ----------------------------------------------------------------------------
+// ROM
+// ----------------------------------------------------------------------------
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+  crc = ~crc;
+  for (uint32_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320U & -(crc & 1));
+  }
+  return ~crc;
+}
+
+// ----------------------------------------------------------------------------
+// RTC memory and fleet
+// ----------------------------------------------------------------------------
+// RTC_DATA_ATTR places variables in the "rtc_data" section, which the linker brackets with these symbols
+extern "C" {
+extern uint8_t __start_rtc_data[] __attribute__((weak));
+extern uint8_t __stop_rtc_data[] __attribute__((weak));
+}
+
+namespace {
+  size_t rtc_memory_size() { return (__start_rtc_data != nullptr) ? __stop_rtc_data - __start_rtc_data : 0; }
+
+  // RTC memory as it was before the first wake, what a board gets on a cold boot
+  const std::vector<uint8_t>& cold_rtc_memory() {
+    static const std::vector<uint8_t> image(__start_rtc_data, __start_rtc_data + rtc_memory_size());
+    return image;
+  }
+} // namespace
+
+namespace sim {
+  bool rtc_memory_tracked() { return rtc_memory_size() > 0; }
+
+  void load_board(const DeviceState& state) {
+    const auto& rtc = (state.rtc_memory.empty()) ? cold_rtc_memory() : state.rtc_memory;
+    std::copy(rtc.begin(), rtc.end(), __start_rtc_data);
+
+    auto& b = board();
+    std::fill(std::begin(b.pumped_s), std::end(b.pumped_s), 0.0);
+    std::copy(state.pumped_s.begin(), state.pumped_s.end(), b.pumped_s);
+    b.noise = state.noise;
+
+    nvs() = state.nvs;
+    auto& table = partitions();
+    for (size_t i = 0; i < table.size(); i++)
+      if (i < state.partitions.size() && !state.partitions[i].empty())
+        table[i].data = state.partitions[i];
+      else
+        std::fill(table[i].data.begin(), table[i].data.end(), 0xFF);
+  }
+
+  void save_board(DeviceState& state) {
+    state.rtc_memory.assign(__start_rtc_data, __start_rtc_data + rtc_memory_size());
+
+    const auto& b = board();
+    state.pumped_s.assign(std::begin(b.pumped_s), std::end(b.pumped_s));
+    state.noise = b.noise;
+
+    state.nvs = nvs();
+    const auto& table = partitions();
+    state.partitions.resize(table.size());
+    for (size_t i = 0; i < table.size(); i++) {
+      const auto& data = table[i].data;
+      bool erased = std::all_of(data.begin(), data.end(), [](uint8_t byte) { return byte == 0xFF; });
+      if (erased)
+        state.partitions[i].clear();
+      else
+        state.partitions[i] = data;
+    }
+  }
+} // namespace sim
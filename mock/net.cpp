@@ -0,0 +1,567 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// Network: WiFi station, sockets, HTTP client, SNTP and the in-process API server.
+//
+
+#include "SeriesCodec.hpp"
+#include "sim.hpp"
+#include <HTTPClient.h>
+#include <WiFi.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+#include <map>
+#include <set>
+#include <string>
+
+WiFiClass WiFi;
+
+// ----------------------------------------------------------------------------
+// WiFi
+// ----------------------------------------------------------------------------
+namespace {
+  constexpr uint8_t AP_BSSID[6]{0x24, 0x0A, 0xC4, 0x12, 0x34, 0x56};
+  constexpr int32_t AP_CHANNEL{6};
+  const IPAddress DHCP_ADDRESS(192, 168, 1, 42);
+  const IPAddress GATEWAY(192, 168, 1, 1);
+  const IPAddress SUBNET(255, 255, 255, 0);
+} // namespace
+
+bool WiFiClass::mode(wifi_mode_t mode) {
+  if (mode == WIFI_OFF)
+    return disconnect(true);
+  sim::start_radio();
+  return true;
+}
+
+bool WiFiClass::config(IPAddress local_ip, IPAddress, IPAddress, IPAddress, IPAddress) {
+  static_ip = static_cast<uint32_t>(local_ip) != 0;
+  static_address = local_ip;
+  return true;
+}
+
+wl_status_t WiFiClass::begin(const char*, const char*, int32_t channel, const uint8_t* bssid, bool connect) {
+  sim::start_radio();
+  associated = false;
+  connecting = connect;
+  started_us = sim::now_us();
+
+  const auto& c = sim::config();
+  bool known_ap = channel > 0 && bssid != nullptr;
+  int64_t duration_ms = ((known_ap) ? c.wifi_fast_ms : c.wifi_scan_ms) + ((static_ip) ? 0 : c.wifi_dhcp_ms);
+  connected_us = started_us + duration_ms * 1000;
+  return WL_DISCONNECTED;
+}
+
+bool WiFiClass::disconnect(bool wifioff, bool) {
+  connecting = false;
+  associated = false;
+  if (wifioff)
+    sim::stop_radio();
+  return true;
+}
+
+wl_status_t WiFiClass::status() {
+  if (connecting && sim::now_us() >= connected_us) {
+    connecting = false;
+    associated = true;
+    sim::record(sim::Phase::WIFI, started_us, connected_us);
+  }
+  if (associated)
+    return WL_CONNECTED;
+  return (connecting) ? WL_DISCONNECTED : WL_IDLE_STATUS;
+}
+
+uint8_t* WiFiClass::BSSID() {
+  static uint8_t bssid[6];
+  memcpy(bssid, AP_BSSID, sizeof(bssid));
+  return bssid;
+}
+
+int32_t WiFiClass::channel() { return AP_CHANNEL; }
+IPAddress WiFiClass::localIP() { return (static_ip) ? static_address : DHCP_ADDRESS; }
+IPAddress WiFiClass::gatewayIP() { return GATEWAY; }
+IPAddress WiFiClass::subnetMask() { return SUBNET; }
+IPAddress WiFiClass::dnsIP(uint8_t) { return GATEWAY; }
+
+// ----------------------------------------------------------------------------
+// Sockets
+// ----------------------------------------------------------------------------
+int WiFiClient::connect(IPAddress ip, uint16_t port) { return connect(ip.toString().c_str(), port); }
+
+int WiFiClient::connect(const char* _host, uint16_t port) { return connect(_host, port, -1); }
+
+int WiFiClient::connect(const char* _host, uint16_t port, int32_t timeout_ms) {
+  sim::AllocPause pause;
+  stop();
+  if (WiFi.status() != WL_CONNECTED)
+    return 0;
+  const auto& c = sim::config();
+  int64_t handshake = (c.rtt_ms + ((is_secure) ? c.tls_handshake_ms : 0)) * 1000LL; // TCP, then TLS handshake
+  if (timeout_ms >= 0 && handshake > timeout_ms * 1000LL) {
+    sim::advance(timeout_ms * 1000LL);
+    return 0;
+  }
+  sim::advance(handshake);
+  is_connected = true;
+  remote = std::string(_host) + ":" + std::to_string(port);
+  return 1;
+}
+
+void WiFiClient::stop() {
+  is_connected = false;
+  remote.clear();
+  rx.clear();
+  rx_pos = 0;
+}
+
+size_t WiFiClient::write(const uint8_t*, size_t size) { return (is_connected) ? size : 0; }
+
+void WiFiClient::receive(const char* data, size_t size) {
+  sim::AllocPause pause;
+  rx.assign(data, size);
+  rx_pos = 0;
+}
+
+// ----------------------------------------------------------------------------
+// HTTP
+// ----------------------------------------------------------------------------
+namespace {
+  constexpr size_t HEADERS_SIZE{160}; // Rough size of the request and response headers
+}
+
+bool HTTPClient::begin(WiFiClient& client, const String& url) {
+  sim::AllocPause pause;
+  transport = &client;
+  headers.clear();
+
+  // Split "scheme://host[:port]/path", the port defaults to the one of the scheme
+  std::string full(url.c_str());
+  size_t start = full.find("://");
+  bool secure = full.compare(0, 8, "https://") == 0;
+  start = (start == std::string::npos) ? 0 : start + 3;
+  size_t slash = full.find('/', start);
+  std::string authority = full.substr(start, (slash == std::string::npos) ? std::string::npos : slash - start);
+  size_t colon = authority.find(':');
+  host = authority.substr(0, colon);
+  port = (secure) ? 443 : 80;
+  if (colon != std::string::npos)
+    port = static_cast<uint16_t>(std::stoul(authority.substr(colon + 1)));
+  path = (slash == std::string::npos) ? "/" : full.substr(slash);
+  return true;
+}
+
+bool HTTPClient::begin(const String& url) { return begin(default_transport, url); }
+
+void HTTPClient::end() {
+  if (!keep_alive && transport != nullptr)
+    transport->stop();
+  headers.clear();
+}
+
+void HTTPClient::addHeader(const String& name, const String& value, bool, bool) {
+  sim::AllocPause pause;
+  headers.emplace_back(name.c_str(), value.c_str());
+}
+
+int HTTPClient::GET() { return send(nullptr, 0); }
+
+int HTTPClient::POST(uint8_t* payload, size_t size) { return send(payload, size); }
+
+int HTTPClient::send(const uint8_t* payload, size_t size) {
+  sim::AllocPause pause;
+  if (transport == nullptr)
+    return HTTPC_ERROR_NOT_CONNECTED;
+  if (WiFi.status() != WL_CONNECTED)
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+
+  const auto& c = sim::config();
+  int64_t start = sim::now_us();
+  if (sim::true_epoch_us() < (c.start_epoch_s + c.api_down_s) * 1000000) {
+    sim::advance(c.rtt_ms * 1000LL);
+    transport->stop();
+    sim::record(sim::Phase::HTTP, start, sim::now_us());
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+  }
+  if (!transport->connected() || transport->host() != host + ":" + std::to_string(port)) {
+    if (!transport->connect(host.c_str(), port, connect_timeout_ms)) {
+      sim::record(sim::Phase::HTTP, start, sim::now_us());
+      return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+  }
+
+  const char* content_type = "";
+  for (const auto& header : headers)
+    if (header.first == "Content-Type")
+      content_type = header.second.c_str();
+
+  static char response[16384];
+  size_t received = sim::api_handle(path.c_str(), content_type, payload, size, response, sizeof(response));
+  size_t sent = size + path.size() + HEADERS_SIZE;
+  received += HEADERS_SIZE;
+  // The request reaches the server half a round trip later, and may wait there for a worker
+  int64_t arrival = sim::true_epoch_us() + c.rtt_ms * 500LL;
+  int64_t queued = sim::serve_request(arrival) - arrival - c.server_ms * 1000LL;
+  int64_t answered = (c.rtt_ms + c.server_ms) * 1000LL + queued +
+                     static_cast<int64_t>(sent + received) * 1000 / std::max<uint32_t>(c.bandwidth_bytes_per_ms, 1);
+  if (answered > timeout_ms * 1000LL) {
+    // The server still works on it, but the connection is dropped
+    sim::advance(timeout_ms * 1000LL);
+    transport->stop();
+    sim::record(sim::Phase::HTTP, start, sim::now_us());
+    sim::record_bytes(sent, 0);
+    sim::record_request(path.c_str(), sim::true_epoch_us() - (sim::now_us() - start), sim::now_us() - start, queued,
+                        sent);
+    return HTTPC_ERROR_READ_TIMEOUT;
+  }
+  sim::advance(answered);
+  transport->receive(response, received - HEADERS_SIZE);
+
+  sim::record(sim::Phase::HTTP, start, sim::now_us());
+  sim::record_bytes(sent, received);
+  sim::record_request(path.c_str(), sim::true_epoch_us() - (sim::now_us() - start), sim::now_us() - start, queued,
+                      sent + received);
+  return HTTP_CODE_OK;
+}
+
+// ----------------------------------------------------------------------------
+// SNTP
+// ----------------------------------------------------------------------------
+namespace {
+  sntp_sync_time_cb_t sntp_callback = nullptr;
+  sim::Timer* sntp_answer = nullptr;
+  int64_t sntp_started_us = 0;
+
+  void on_sntp_answer(void*) {
+    int64_t now = sim::true_epoch_us();
+    timeval tv{static_cast<time_t>(now / 1000000), static_cast<suseconds_t>(now % 1000000)};
+    settimeofday(&tv, nullptr);
+    sim::record(sim::Phase::SNTP, sntp_started_us, sim::now_us());
+    sim::delete_timer(sntp_answer);
+    sntp_answer = nullptr;
+    if (sntp_callback != nullptr)
+      sntp_callback(&tv);
+  }
+} // namespace
+
+void sntp_setoperatingmode(uint8_t) {}
+void sntp_setservername(uint8_t, const char*) {}
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback) { sntp_callback = callback; }
+
+void sntp_init() {
+  sim::AllocPause pause;
+  if (WiFi.status() != WL_CONNECTED || sntp_answer != nullptr)
+    return;
+  const auto& c = sim::config();
+  if (sim::true_epoch_us() < (c.start_epoch_s + c.sntp_down_s) * 1000000)
+    return; // Never answers
+  sntp_started_us = sim::now_us();
+  sntp_answer = sim::create_timer(&on_sntp_answer, nullptr);
+  esp_timer_start_once(sntp_answer, sim::config().sntp_ms * 1000ULL);
+}
+
+void sntp_stop() {
+  if (sntp_answer != nullptr)
+    sim::delete_timer(sntp_answer);
+  sntp_answer = nullptr;
+}
+
+namespace sim {
+
+  void reset_network() {
+    WiFi = WiFiClass();
+    sntp_stop();
+  }
+
+  // --------------------------------------------------------------------------
+  // API server, same routes and answers as tools/mock_api_server.py
+  // --------------------------------------------------------------------------
+  namespace {
+    using Form = std::map<std::string, std::string>;
+
+    // Error codes, mirrored from meltwin::APIErrors
+    constexpr int NO_ERROR{0};
+    constexpr int MISSING_ARGUMENTS{210};
+    constexpr int UNKNOWN_API_PATH{300};
+    constexpr int INVALID_CREDENTIALS{500};
+    constexpr int INVALID_TOKEN{510};
+
+    std::set<std::string> tokens;
+    uint32_t cmd_requests = 0;
+    uint32_t waterings = 0;
+
+    int hex_value(char c) { return (c <= '9') ? c - '0' : (c | 0x20) - 'a' + 10; }
+
+    std::string url_decode(const std::string& text) {
+      std::string out;
+      for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '%' && i + 2 < text.size()) {
+          out += static_cast<char>(hex_value(text[i + 1]) * 16 + hex_value(text[i + 2]));
+          i += 2;
+        }
+        else
+          out += (text[i] == '+') ? ' ' : text[i];
+      }
+      return out;
+    }
+
+    constexpr char BASE64URL[]{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"};
+
+    std::string base64url_encode(const uint8_t* data, size_t size) {
+      std::string out;
+      for (size_t i = 0; i < size; i += 3) {
+        uint32_t group = data[i] << 16 | ((i + 1 < size) ? data[i + 1] << 8 : 0) | ((i + 2 < size) ? data[i + 2] : 0);
+        for (size_t c = 0; c <= std::min<size_t>(size - i, 3); c++)
+          out += BASE64URL[(group >> (18 - 6 * c)) & 0x3F];
+      }
+      return out;
+    }
+
+    std::string base64url_decode(const std::string& text) {
+      std::string out;
+      uint32_t group = 0;
+      int bits = 0;
+      for (char c : text) {
+        const char* found = strchr(BASE64URL, c);
+        if (found == nullptr || c == '\0')
+          break;
+        group = (group << 6) | static_cast<uint32_t>(found - BASE64URL);
+        if ((bits += 6) >= 8) {
+          bits -= 8;
+          out += static_cast<char>((group >> bits) & 0xFF);
+        }
+      }
+      return out;
+    }
+
+    Form parse_urlencoded(const uint8_t* body, size_t size) {
+      Form form;
+      std::string text(reinterpret_cast<const char*>(body), size);
+      for (size_t start = 0; start < text.size();) {
+        size_t end = text.find('&', start);
+        end = (end == std::string::npos) ? text.size() : end;
+        std::string pair = text.substr(start, end - start);
+        size_t eq = pair.find('=');
+        if (eq != std::string::npos)
+          form[url_decode(pair.substr(0, eq))] = url_decode(pair.substr(eq + 1));
+        start = end + 1;
+      }
+      return form;
+    }
+
+    // The subset of CBOR written by meltwin::Payload: a map of text keys to integers, floats, texts and byte strings.
+    // Byte strings are given as base64url, as in forms.
+    struct CborReader {
+      const uint8_t* data;
+      size_t size;
+      size_t pos = 0;
+
+      uint64_t argument(uint8_t info) {
+        if (info < 24)
+          return info;
+        uint64_t value = 0;
+        for (size_t n = size_t{1} << (info - 24); n > 0 && pos < size; n--)
+          value = (value << 8) | data[pos++];
+        return value;
+      }
+
+      std::string item() {
+        if (pos >= size)
+          return "";
+        uint8_t head = data[pos++];
+        if (head == 0xFA) {
+          uint32_t bits = static_cast<uint32_t>(argument(26));
+          float value;
+          memcpy(&value, &bits, sizeof(value));
+          char text[32];
+          snprintf(text, sizeof(text), "%g", value);
+          return text;
+        }
+        uint64_t value = argument(head & 0x1F);
+        switch (head >> 5) {
+        case 0:
+          return std::to_string(value);
+        case 1:
+          return "-" + std::to_string(value + 1);
+        case 2: {
+          size_t n = std::min<size_t>(value, size - pos);
+          pos += n;
+          return base64url_encode(data + pos - n, n);
+        }
+        case 3: {
+          std::string text(reinterpret_cast<const char*>(data + pos), std::min<size_t>(value, size - pos));
+          pos += text.size();
+          return text;
+        }
+        default:
+          return "";
+        }
+      }
+    };
+
+    Form parse_cbor(const uint8_t* body, size_t size) {
+      Form form;
+      CborReader reader{body, size};
+      if (size == 0 || body[reader.pos++] != 0xBF)
+        return form;
+      while (reader.pos < size && body[reader.pos] != 0xFF) {
+        std::string key = reader.item();
+        form[key] = reader.item();
+      }
+      return form;
+    }
+
+    std::string error(int code, const char* msg = "") {
+      return "{\"err_code\":" + std::to_string(code) + ",\"err_msg\":\"" + msg + "\"}";
+    }
+
+    bool check_token(const Form& form) {
+      auto token = form.find("token");
+      return token != form.end() && tokens.count(token->second) > 0;
+    }
+
+    std::string login(const Form& form) {
+      auto user = form.find("username"), password = form.find("password");
+      if (user == form.end() || password == form.end() || user->second != "plant01" ||
+          password->second != "plt01_access")
+        return error(INVALID_CREDENTIALS, "Invalid credentials");
+      std::string token = "tok" + std::to_string(tokens.size() + 1);
+      tokens.insert(token);
+      return "{\"err_code\":0,\"token\":\"" + token + "\"}";
+    }
+
+    std::string record(const Form& form) {
+      if (!check_token(form))
+        return error(INVALID_TOKEN, "Invalid token");
+      if (form.count("sensor_id") == 0 || form.count("value") == 0)
+        return error(MISSING_ARGUMENTS, "Missing sensor_id or value");
+      return error(NO_ERROR);
+    }
+
+    void print_profile(const Form& form) {
+      if (!config().verbose || form.count("profile_wakes") == 0)
+        return;
+      printf("[Api] profile over %s wakes (us), %s forced to sleep:\n", form.at("profile_wakes").c_str(),
+             (form.count("profile_forced_sleeps") > 0) ? form.at("profile_forced_sleeps").c_str() : "0");
+      if (form.count("profile_wifi_fast") > 0)
+        printf("[Api]   connects   %s fast, %s fallbacks, %s cold, %s failures\n", form.at("profile_wifi_fast").c_str(),
+               form.at("profile_wifi_fallback").c_str(), form.at("profile_wifi_cold").c_str(),
+               form.at("profile_wifi_failures").c_str());
+      for (size_t i = 0; form.count("profile[" + std::to_string(i) + "][phase]") > 0; i++) {
+        auto field = [&](const char* name) { return form.at("profile[" + std::to_string(i) + "][" + name + "]"); };
+        auto optional = [&](const char* name) {
+          auto key = "profile[" + std::to_string(i) + "][" + name + "]";
+          return (form.count(key) > 0) ? form.at(key) : std::string("0");
+        };
+        printf("[Api]   %-10s n=%-4s min=%-9s mean=%-9s p95=%-9s max=%-9s heap=%-3s over=%s\n", field("phase").c_str(),
+               field("count").c_str(), field("min_us").c_str(), field("mean_us").c_str(), field("p95_us").c_str(),
+               field("max_us").c_str(), field("heap_blocks").c_str(), optional("overruns").c_str());
+      }
+    }
+
+    std::string record_batch(const Form& form) {
+      if (!check_token(form))
+        return error(INVALID_TOKEN, "Invalid token");
+      size_t count = form.count("count") ? std::stoul(form.at("count")) : 0;
+      std::string results;
+      for (size_t i = 0; i < count; i++) {
+        std::string prefix = "readings[" + std::to_string(i) + "]";
+        auto id = form.find(prefix + "[sensor_id]");
+        bool valid = id != form.end() && form.count(prefix + "[value]") > 0;
+        results += (i > 0) ? "," : "";
+        results += "{\"sensor_id\":" + ((valid) ? id->second : std::string("-1")) +
+                   ",\"err_code\":" + std::to_string((valid) ? NO_ERROR : MISSING_ARGUMENTS) + "}";
+      }
+      print_profile(form);
+      return "{\"err_code\":0,\"results\":[" + results + "]}";
+    }
+
+    // Results are given in the order of the series
+    std::string record_series(const Form& form) {
+      if (!check_token(form))
+        return error(INVALID_TOKEN, "Invalid token");
+      if (form.count("series_count") == 0 || form.count("series") == 0)
+        return error(MISSING_ARGUMENTS, "Missing series");
+
+      std::string bytes = base64url_decode(form.at("series"));
+      meltwin::BitReader bits(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+      std::string results;
+      for (size_t k = 0, n_series = std::stoul(form.at("series_count")); k < n_series; k++) {
+        auto sensor_id = static_cast<unsigned int>(bits.read(8));
+        auto count = static_cast<size_t>(bits.read(8));
+        meltwin::SeriesDecoder series(bits);
+        for (size_t i = 0; i < count; i++) {
+          time_t timestamp;
+          float value;
+          bool valid = series.next(timestamp, value);
+          if (config().verbose)
+            printf("[Api] sensor %u = %f @ %lld\n", sensor_id, value, static_cast<long long>(timestamp));
+          results += (results.empty()) ? "" : ",";
+          results += "{\"sensor_id\":" + std::to_string(sensor_id) +
+                     ",\"err_code\":" + std::to_string((valid) ? NO_ERROR : MISSING_ARGUMENTS) + "}";
+        }
+      }
+      print_profile(form);
+      return "{\"err_code\":0,\"results\":[" + results + "]}";
+    }
+
+    std::string cmd_json(size_t pump_id, bool water) {
+      const auto& c = config();
+      char text[96];
+      snprintf(text, sizeof(text), "{\"pump_id\":%zu,\"duration\":%g,\"pwm\":%u}", pump_id,
+               (water) ? c.water_duration_s : 0.0f, (water) ? c.water_pwm : 0U);
+      return text;
+    }
+
+    bool water_now() {
+      uint32_t every = config().water_every_n_requests;
+      return every > 0 && ++cmd_requests % every == 0;
+    }
+
+    std::string get_cmd(const Form& form) {
+      if (!check_token(form))
+        return error(INVALID_TOKEN, "Invalid token");
+      size_t pump_id = form.count("pump_id") ? std::stoul(form.at("pump_id")) : 0;
+      std::string cmd = cmd_json(pump_id, pump_id == 0 && water_now());
+      return "{\"err_code\":0," + cmd.substr(1);
+    }
+
+    std::string get_cmds(const Form& form) {
+      if (!check_token(form))
+        return error(INVALID_TOKEN, "Invalid token");
+      size_t count = form.count("count") ? std::stoul(form.at("count")) : 0;
+      // Pumps take turns
+      size_t watered = (count > 0 && water_now()) ? waterings++ % count : count;
+      std::string cmds;
+      for (size_t i = 0; i < count; i++)
+        cmds += ((i > 0) ? "," : "") + cmd_json(i, i == watered);
+      return "{\"err_code\":0,\"cmds\":[" + cmds + "]}";
+    }
+
+    std::string done(const Form& form) {
+      return (check_token(form)) ? error(NO_ERROR) : error(INVALID_TOKEN, "Invalid token");
+    }
+  } // namespace
+
+  size_t api_handle(const char* path, const char* content_type, const uint8_t* body, size_t size, char* response,
+                    size_t capacity) {
+    static const std::map<std::string, std::string (*)(const Form&)> ROUTES{
+      {"/api/auth/login", &login},
+      {"/api/plants/record", &record},
+      {"/api/plants/record_batch", &record_batch},
+      {"/api/plants/record_series", &record_series},
+      {"/api/plants/get_cmd", &get_cmd},
+      {"/api/plants/get_cmds", &get_cmds},
+      {"/api/plants/done", &done},
+      {"/api/plants/done_batch", &done},
+    };
+
+    Form form = (strcmp(content_type, "application/cbor") == 0) ? parse_cbor(body, size) : parse_urlencoded(body, size);
+    auto route = ROUTES.find(path);
+    std::string answer = (route != ROUTES.end()) ? route->second(form) : error(UNKNOWN_API_PATH, "Unknown API path");
+    size_t n = std::min(answer.size(), capacity);
+    memcpy(response, answer.data(), n);
+    return n;
+  }
+
+} // namespace sim
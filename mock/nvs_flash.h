@@ -0,0 +1,13 @@
+//
+// Created by meltwin on 18/12/24.
+//
+
+#ifndef MOCK_NVS_FLASH_H
+#define MOCK_NVS_FLASH_H
+
+#include "esp_err.h"
+
+esp_err_t nvs_flash_init();
+esp_err_t nvs_flash_erase(); // Clears every Preferences namespace
+
+#endif // MOCK_NVS_FLASH_H
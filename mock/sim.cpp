@@ -0,0 +1,640 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// Simulation core: task scheduler, virtual clocks, esp_timer, FreeRTOS primitives and wall clock.
+//
+
+#include "sim.hpp"
+#include <Arduino.h>
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <esp_timer.h>
+#include <freertos/timers.h>
+#include <mutex>
+#include <new>
+#include <sys/time.h>
+#include <thread>
+
+namespace sim {
+
+  namespace {
+    enum class State : uint8_t { READY, RUNNING, BLOCKED, FINISHED };
+
+    struct Task {
+      State state = State::READY;
+      int64_t clock_us = 0;
+      bool go = false; // Holds the baton
+      std::condition_variable cv;
+      const std::function<bool()>* ready = nullptr; // While blocked
+      int64_t deadline_us = -1;                     // While blocked
+      bool timed_out = false;                       // Chosen to run because its wait deadline came first
+    };
+
+    struct World {
+      std::mutex mutex;
+      Task main_task;
+      std::vector<Task*> tasks{&main_task}; // Creation order, which is also the scheduling priority
+      std::vector<Timer*> timers;
+      int64_t rtc_boot_epoch_us = 0;  // Board clock at uptime 0
+      int64_t true_boot_epoch_us = 0; // Actual time at uptime 0
+      int64_t radio_on_us = -1;
+      int64_t sleep_at_us = -1; // Deep sleep started by a task other than the main one, handed over to it
+      uint64_t sleep_duration_us = 0;
+      Wake wake;
+    };
+
+    // Never destroyed, tasks left behind by a deep sleep stay parked on it
+    World& world() {
+      static auto* w = new World;
+      return *w;
+    }
+
+    thread_local Task* self = nullptr;
+    thread_local std::unique_lock<std::mutex>* held = nullptr;
+
+    Timer* next_timer(int64_t limit_us) {
+      Timer* next = nullptr;
+      for (Timer* timer : world().timers)
+        if (timer->deadline_us >= 0 && (limit_us < 0 || timer->deadline_us <= limit_us) &&
+            (next == nullptr || timer->deadline_us < next->deadline_us))
+          next = timer;
+      return next;
+    }
+
+    // Run an expired timer, on the calling task with its clock set to the expiry time
+    void fire(Timer* timer) {
+      int64_t at = timer->deadline_us;
+      timer->deadline_us = (timer->period_us > 0) ? at + timer->period_us : -1;
+      int64_t saved = self->clock_us;
+      self->clock_us = at;
+      timer->callback(timer->arg);
+      self->clock_us = std::max(saved, at);
+    }
+
+    /**
+     * Choose the task to run next, once the calling one blocked or finished
+     */
+    Task* pick() {
+      auto& w = world();
+      if (w.sleep_at_us >= 0)
+        return &w.main_task;
+      while (true) {
+        for (Task* task : w.tasks)
+          if (task->state == State::READY)
+            return task;
+        for (Task* task : w.tasks)
+          if (task->state == State::BLOCKED && (*task->ready)())
+            return task;
+
+        // Every task is blocked: the earliest timer or wait deadline goes first
+        Task* earliest = nullptr;
+        for (Task* task : w.tasks)
+          if (task->state == State::BLOCKED && task->deadline_us >= 0 &&
+              (earliest == nullptr || task->deadline_us < earliest->deadline_us))
+            earliest = task;
+        Timer* timer = next_timer(-1);
+        if (timer != nullptr && (earliest == nullptr || timer->deadline_us <= earliest->deadline_us)) {
+          fire(timer);
+          continue;
+        }
+        if (earliest != nullptr)
+          earliest->timed_out = true;
+        return earliest;
+      }
+    }
+
+    // Give the baton to another task, and wait to get it back unless the calling task is done
+    void switch_to(Task* next) {
+      if (next == self)
+        return;
+      next->go = true;
+      next->cv.notify_one();
+      self->go = false;
+      if (self->state != State::FINISHED)
+        self->cv.wait(*held, [] { return self->go; });
+    }
+  } // namespace
+
+  Config& config() {
+    static Config c;
+    return c;
+  }
+
+  // --------------------------------------------------------------------------
+  // Virtual clock
+  // --------------------------------------------------------------------------
+  int64_t now_us() { return self->clock_us; }
+
+  void advance(int64_t us) { advance_to(self->clock_us + us); }
+
+  void advance_to(int64_t us) {
+    while (Timer* timer = next_timer(us))
+      fire(timer);
+    self->clock_us = std::max(self->clock_us, us);
+  }
+
+  int64_t rtc_epoch_us() { return world().rtc_boot_epoch_us + now_us(); }
+  void set_rtc_epoch_us(int64_t us) { world().rtc_boot_epoch_us = us - now_us(); }
+  int64_t true_epoch_us() { return world().true_boot_epoch_us + now_us(); }
+
+  // --------------------------------------------------------------------------
+  // Tasks and blocking
+  // --------------------------------------------------------------------------
+  void spawn(void (*task)(void*), void* arg) {
+    auto* forked = new Task;
+    forked->clock_us = self->clock_us;
+    world().tasks.push_back(forked);
+
+    std::thread([forked, task, arg] {
+      std::unique_lock<std::mutex> lock(world().mutex);
+      self = forked;
+      held = &lock;
+      self->cv.wait(lock, [] { return self->go; });
+      self->state = State::RUNNING;
+      try {
+        task(arg);
+      } catch (const TaskExit&) {}
+
+      auto& tasks = world().tasks;
+      self->state = State::FINISHED;
+      tasks.erase(std::find(tasks.begin(), tasks.end(), self));
+      Task* next = nullptr;
+      try {
+        next = pick();
+      } catch (const TaskExit&) {
+        next = &world().main_task; // A timer that fired meanwhile started the deep sleep
+      }
+      switch_to((next != nullptr) ? next : &world().main_task);
+      delete forked;
+    }).detach();
+  }
+
+  void join_tasks() {
+    if (!block_until([] { return world().tasks.size() == 1; }, -1))
+      fprintf(stderr, "[Sim] Some tasks never finished\n");
+  }
+
+  bool block_until(const std::function<bool()>& ready, int64_t deadline_us) {
+    while (!ready()) {
+      self->state = State::BLOCKED;
+      self->ready = &ready;
+      self->deadline_us = deadline_us;
+      Task* next = pick();
+      if (next == nullptr) {
+        // Nothing will ever satisfy the wait, neither for this task nor for the others
+        self->state = State::RUNNING;
+        fprintf(stderr, "[Sim] Deadlock, giving up a wait at %lld us\n", static_cast<long long>(self->clock_us));
+        return false;
+      }
+      switch_to(next);
+      self->state = State::RUNNING;
+      auto& w = world();
+      if (self == &w.main_task && w.sleep_at_us >= 0) {
+        // The deep sleep unwinds the main task, as the driver expects
+        self->clock_us = std::max(self->clock_us, w.sleep_at_us);
+        self->timed_out = false;
+        w.sleep_at_us = -1;
+        throw DeepSleep{w.sleep_duration_us};
+      }
+      if (self->timed_out) {
+        self->timed_out = false;
+        advance_to(deadline_us);
+        return ready();
+      }
+    }
+    return true;
+  }
+
+  void sleep_now(uint64_t duration_us) {
+    auto& w = world();
+    if (self == &w.main_task) {
+      self->state = State::RUNNING; // Possibly thrown from a wait, which won't resume
+      throw DeepSleep{duration_us};
+    }
+    w.sleep_at_us = self->clock_us;
+    w.sleep_duration_us = duration_us;
+    throw TaskExit{};
+  }
+
+  // --------------------------------------------------------------------------
+  // esp_timer backend
+  // --------------------------------------------------------------------------
+  Timer* create_timer(void (*callback)(void*), void* arg) {
+    auto* timer = new Timer{callback, arg};
+    world().timers.push_back(timer);
+    return timer;
+  }
+
+  void delete_timer(Timer* timer) {
+    auto& timers = world().timers;
+    timers.erase(std::remove(timers.begin(), timers.end(), timer), timers.end());
+    delete timer;
+  }
+
+  // --------------------------------------------------------------------------
+  // Measurements
+  // --------------------------------------------------------------------------
+  const char* phase_name(Phase phase) {
+    static constexpr const char* NAMES[]{"adc", "flash", "wifi", "sntp", "http", "pump", "radio"};
+    return NAMES[static_cast<size_t>(phase)];
+  }
+
+  void record(Phase phase, int64_t start_us, int64_t end_us) {
+    world().wake.time_us[static_cast<size_t>(phase)] += end_us - start_us;
+    world().wake.count[static_cast<size_t>(phase)]++;
+  }
+
+  void record_bytes(size_t sent, size_t received) {
+    world().wake.bytes_sent += sent;
+    world().wake.bytes_received += received;
+  }
+
+  Wake& current_wake() { return world().wake; }
+
+  // --------------------------------------------------------------------------
+  // Radio
+  // --------------------------------------------------------------------------
+  bool radio_on() { return world().radio_on_us >= 0; }
+
+  void start_radio() {
+    if (!radio_on())
+      world().radio_on_us = now_us();
+  }
+
+  void stop_radio() {
+    if (!radio_on())
+      return;
+    record(Phase::RADIO, world().radio_on_us, now_us());
+    world().radio_on_us = -1;
+  }
+
+  // --------------------------------------------------------------------------
+  // Driver hooks
+  // --------------------------------------------------------------------------
+  void boot() {
+    auto& w = world();
+    if (self == nullptr) {
+      // The driver thread is the main task, it holds the baton until it blocks
+      static std::unique_lock<std::mutex> main_lock(w.mutex);
+      self = &w.main_task;
+      held = &main_lock;
+      self->state = State::RUNNING;
+      self->go = true;
+      w.true_boot_epoch_us = config().start_epoch_s * 1000000;
+      w.rtc_boot_epoch_us = 0; // The board clock starts at 1970 until it is set
+    }
+    self->clock_us = 0;
+    w.wake = Wake{};
+    reset_board();
+    reset_network();
+  }
+
+  void deep_sleep(uint64_t duration) {
+    auto& w = world();
+    int64_t uptime = now_us();
+    stop_radio();
+    w.wake.awake_us = uptime;
+    w.wake.asleep_us = static_cast<int64_t>(duration);
+    w.tasks.assign(1, &w.main_task); // Unfinished tasks die with the CPU
+    for (Timer* timer : w.timers)
+      timer->deadline_us = -1;
+
+    w.true_boot_epoch_us += uptime + static_cast<int64_t>(duration);
+    auto rtc_duration = static_cast<double>(duration) * (1 + config().rtc_drift_ppm * 1e-6);
+    w.rtc_boot_epoch_us += uptime + static_cast<int64_t>(rtc_duration);
+  }
+
+  // --------------------------------------------------------------------------
+  // Fleet
+  // --------------------------------------------------------------------------
+  void load_device(const DeviceState& state) {
+    world().rtc_boot_epoch_us = state.rtc_boot_epoch_us;
+    world().true_boot_epoch_us = state.true_boot_epoch_us;
+    load_board(state);
+  }
+
+  void save_device(DeviceState& state) {
+    state.rtc_boot_epoch_us = world().rtc_boot_epoch_us;
+    state.true_boot_epoch_us = world().true_boot_epoch_us;
+    save_board(state);
+  }
+
+} // namespace sim
+
+// ----------------------------------------------------------------------------
+// FreeRTOS
+// ----------------------------------------------------------------------------
+struct sim_event_group {
+  bool is_static = false; // Built in a StaticEventGroup_t, not to be freed
+  EventBits_t bits = 0;
+  int64_t set_us[32]{}; // Time at which each bit was set
+};
+
+struct sim_semaphore {
+  bool is_static;
+  UBaseType_t max_count;
+  std::deque<int64_t> tokens;      // Time at which each available token was given
+  std::vector<sim::Task*> waiters; // Tasks blocked in xSemaphoreTake, in arrival order
+};
+
+static_assert(sizeof(sim_event_group) <= sizeof(StaticEventGroup_t));
+static_assert(sizeof(sim_semaphore) <= sizeof(StaticSemaphore_t));
+
+namespace {
+  int64_t deadline_of(TickType_t ticks) {
+    return (ticks == portMAX_DELAY) ? -1 : sim::now_us() + static_cast<int64_t>(ticks) * portTICK_PERIOD_MS * 1000;
+  }
+} // namespace
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char*, uint32_t, void* arg, UBaseType_t,
+                                   TaskHandle_t* handle, BaseType_t) {
+  if (handle != nullptr)
+    *handle = nullptr;
+  sim::spawn(task, arg);
+  return pdPASS;
+}
+
+// The task runs on a thread of its own, the stack and task buffers are left unused
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t task, const char*, uint32_t, void* arg, UBaseType_t,
+                                          StackType_t*, StaticTask_t* buffer, BaseType_t) {
+  sim::AllocPause pause;
+  sim::spawn(task, arg);
+  return reinterpret_cast<TaskHandle_t>(buffer);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stack_depth, void* arg, UBaseType_t priority,
+                       TaskHandle_t* handle) {
+  return xTaskCreatePinnedToCore(task, name, stack_depth, arg, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  sim::AllocPause pause;
+  if (task == nullptr)
+    throw sim::TaskExit{};
+}
+
+void vTaskDelay(TickType_t ticks) { sim::advance(static_cast<int64_t>(ticks) * portTICK_PERIOD_MS * 1000); }
+
+TickType_t xTaskGetTickCount() { return static_cast<TickType_t>(sim::now_us() / 1000 / portTICK_PERIOD_MS); }
+
+EventGroupHandle_t xEventGroupCreate() { return new sim_event_group; }
+
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t* buffer) {
+  auto* group = new (buffer) sim_event_group;
+  group->is_static = true;
+  return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+  if (group->is_static)
+    group->~sim_event_group();
+  else
+    delete group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+  for (int i = 0; i < 32; i++)
+    if ((bits & (1U << i)) && !(group->bits & (1U << i)))
+      group->set_us[i] = sim::now_us();
+  group->bits |= bits;
+  return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+  EventBits_t before = group->bits;
+  group->bits &= ~bits;
+  return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) { return group->bits; }
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks) {
+  sim::AllocPause pause;
+  int64_t deadline = deadline_of(ticks);
+  auto satisfied = [&] {
+    EventBits_t set = group->bits & bits;
+    return (wait_for_all) ? set == bits : set != 0;
+  };
+  if (!sim::block_until(satisfied, deadline))
+    return group->bits;
+
+  // The task resumes when the bits it waits for were set, on the clock of the task that set them
+  int64_t resumed = (wait_for_all) ? 0 : INT64_MAX;
+  for (int i = 0; i < 32; i++)
+    if (bits & group->bits & (1U << i))
+      resumed = (wait_for_all) ? std::max(resumed, group->set_us[i]) : std::min(resumed, group->set_us[i]);
+  if (deadline >= 0 && resumed > deadline) {
+    sim::advance_to(deadline);
+    EventBits_t visible = 0;
+    for (int i = 0; i < 32; i++)
+      if ((group->bits & (1U << i)) && group->set_us[i] <= deadline)
+        visible |= 1U << i;
+    return visible;
+  }
+
+  sim::advance_to(resumed);
+  EventBits_t value = group->bits;
+  if (clear_on_exit)
+    group->bits &= ~bits;
+  return value;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count) {
+  auto* semaphore = new sim_semaphore{false, max_count, {}, {}};
+  semaphore->tokens.assign(initial_count, sim::now_us());
+  return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCountingStatic(UBaseType_t max_count, UBaseType_t initial_count,
+                                                 StaticSemaphore_t* buffer) {
+  sim::AllocPause pause; // The token queue stands for the semaphore count
+  auto* semaphore = new (buffer) sim_semaphore{true, max_count, {}, {}};
+  semaphore->tokens.assign(initial_count, sim::now_us());
+  return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() { return xSemaphoreCreateCounting(1, 0); }
+
+SemaphoreHandle_t xSemaphoreCreateMutex() { return xSemaphoreCreateCounting(1, 1); }
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t* buffer) {
+  return xSemaphoreCreateCountingStatic(1, 1, buffer);
+}
+
+// A token goes to the waiter that gets it first in virtual time, not to the one that happens to run first. Tasks run
+// ahead of each other, so tokens may be given out of time order: the earliest one is taken.
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+  sim::AllocPause pause;
+  int64_t deadline = deadline_of(ticks);
+  auto& waiters = semaphore->waiters;
+  sim::Task* me = sim::self; // The predicate may be evaluated by another task
+  waiters.push_back(me);
+  auto first = [&] {
+    if (semaphore->tokens.empty())
+      return false;
+    int64_t given = *std::min_element(semaphore->tokens.begin(), semaphore->tokens.end());
+    for (sim::Task* task : waiters)
+      if (task != me && std::max(task->clock_us, given) < std::max(me->clock_us, given))
+        return false;
+    return true;
+  };
+  struct Leave {
+    std::vector<sim::Task*>& waiters;
+    sim::Task* me;
+    // Also when a deep sleep unwinds the wait
+    ~Leave() { waiters.erase(std::find(waiters.begin(), waiters.end(), me)); }
+  } leave{waiters, me};
+  if (!sim::block_until(first, deadline))
+    return pdFALSE;
+  auto earliest = std::min_element(semaphore->tokens.begin(), semaphore->tokens.end());
+  int64_t given = *earliest;
+  if (deadline >= 0 && given > deadline) {
+    sim::advance_to(deadline);
+    return pdFALSE;
+  }
+  semaphore->tokens.erase(earliest);
+  sim::advance_to(given);
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  sim::AllocPause pause;
+  if (semaphore->tokens.size() >= semaphore->max_count)
+    return pdFALSE;
+  semaphore->tokens.push_back(sim::now_us());
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t* woken) {
+  if (woken != nullptr)
+    *woken = pdFALSE;
+  return xSemaphoreGive(semaphore);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+  sim::AllocPause pause;
+  if (semaphore->is_static)
+    semaphore->~sim_semaphore();
+  else
+    delete semaphore;
+}
+
+// ----------------------------------------------------------------------------
+// Software timers, on top of the esp_timer backend
+// ----------------------------------------------------------------------------
+struct sim_software_timer {
+  uint32_t magic; // RAM outlives the deep sleeps here, so a timer created again in a buffer reuses its backend timer
+  sim::Timer* backend;
+  TimerCallbackFunction_t callback;
+  void* id;
+  int64_t period_us;
+  bool auto_reload;
+};
+
+static_assert(sizeof(sim_software_timer) <= sizeof(StaticTimer_t));
+
+namespace {
+  constexpr uint32_t SOFTWARE_TIMER_MAGIC{0x746d7231}; // "tmr1"
+
+  void on_software_timer(void* arg) {
+    auto* timer = static_cast<sim_software_timer*>(arg);
+    timer->callback(timer);
+  }
+} // namespace
+
+TimerHandle_t xTimerCreateStatic(const char*, TickType_t period, UBaseType_t auto_reload, void* id,
+                                 TimerCallbackFunction_t callback, StaticTimer_t* buffer) {
+  sim::AllocPause pause; // The backend timer stands for the timer list entry
+  auto* timer = reinterpret_cast<sim_software_timer*>(buffer);
+  if (timer->magic != SOFTWARE_TIMER_MAGIC)
+    timer = new (buffer)
+        sim_software_timer{SOFTWARE_TIMER_MAGIC, sim::create_timer(on_software_timer, buffer), {}, {}, 0, false};
+  timer->backend->deadline_us = -1;
+  timer->callback = callback;
+  timer->id = id;
+  timer->period_us = static_cast<int64_t>(period) * portTICK_PERIOD_MS * 1000;
+  timer->auto_reload = auto_reload != pdFALSE;
+  return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t) {
+  timer->backend->deadline_us = sim::now_us() + timer->period_us;
+  timer->backend->period_us = (timer->auto_reload) ? timer->period_us : 0;
+  return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t) {
+  timer->backend->deadline_us = -1;
+  return pdPASS;
+}
+
+void* pvTimerGetTimerID(TimerHandle_t timer) { return timer->id; }
+
+// ----------------------------------------------------------------------------
+// esp_timer
+// ----------------------------------------------------------------------------
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out_handle) {
+  *out_handle = sim::create_timer(args->callback, args->arg);
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+  if (timer->deadline_us >= 0)
+    return ESP_ERR_INVALID_STATE;
+  timer->deadline_us = sim::now_us() + static_cast<int64_t>(timeout_us);
+  timer->period_us = 0;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+  if (timer->deadline_us >= 0)
+    return ESP_ERR_INVALID_STATE;
+  timer->deadline_us = sim::now_us() + static_cast<int64_t>(period);
+  timer->period_us = static_cast<int64_t>(period);
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  if (timer->deadline_us < 0)
+    return ESP_ERR_INVALID_STATE;
+  timer->deadline_us = -1;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+  sim::delete_timer(timer);
+  return ESP_OK;
+}
+
+int64_t esp_timer_get_time() { return sim::now_us(); }
+
+// ----------------------------------------------------------------------------
+// Wall clock, these definitions take precedence over the C library ones
+// ----------------------------------------------------------------------------
+#ifndef __THROW
+#define __THROW
+#endif
+
+extern "C" {
+  time_t time(time_t* t) __THROW {
+    auto now = static_cast<time_t>(sim::rtc_epoch_us() / 1000000);
+    if (t != nullptr)
+      *t = now;
+    return now;
+  }
+
+  int gettimeofday(struct timeval* tv, void*) __THROW {
+    int64_t now = sim::rtc_epoch_us();
+    tv->tv_sec = static_cast<time_t>(now / 1000000);
+    tv->tv_usec = static_cast<suseconds_t>(now % 1000000);
+    return 0;
+  }
+
+  int settimeofday(const struct timeval* tv, const struct timezone*) __THROW {
+    sim::set_rtc_epoch_us(static_cast<int64_t>(tv->tv_sec) * 1000000 + tv->tv_usec);
+    return 0;
+  }
+}
@@ -0,0 +1,236 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// Virtual time simulation behind the native HAL mocks.
+//
+
+#ifndef MOCK_SIM_HPP
+#define MOCK_SIM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace sim {
+
+  /**
+   * Tunables of the simulated board, network and API
+   */
+  struct Config {
+    bool verbose = false;                   // Echo the firmware Serial output
+    int64_t start_epoch_s = 1767225600;     // 2026-01-01T00:00:00Z
+    double rtc_drift_ppm = 150.0;           // RTC slow clock error, accumulated during deep sleep
+    uint32_t serial_poll_us = 10;           // Cost of a Serial.available() call
+    uint32_t adc_sample_us = 40;            // One-shot ADC conversion
+    uint32_t flash_erase_sector_us = 45000; // 4 kB sector erase
+    uint32_t flash_write_us_per_byte = 2;   // Flash programming
+    uint32_t nvs_read_us = 300;             // NVS key lookup and read
+    uint32_t nvs_write_us = 4000;           // NVS entry write, on top of the flash programming
+    uint32_t mux_settle_us = 10;            // Analog mux switching and settling time
+    uint32_t wifi_scan_ms = 2200;           // Full channel scan and association
+    uint32_t wifi_fast_ms = 250;            // Association with a known BSSID and channel
+    uint32_t wifi_dhcp_ms = 700;            // DHCP lease, skipped with a static IP
+    uint32_t rtt_ms = 45;                   // Round trip to the API server
+    uint32_t tls_handshake_ms = 350;        // TLS handshake, on top of the TCP round trip
+    uint32_t server_ms = 15;                // API processing time per request
+    uint32_t server_workers = 8;            // Requests the API server works on at once
+    uint32_t bandwidth_bytes_per_ms = 250;  // Link throughput
+    uint32_t sntp_ms = 40;                  // SNTP answer delay
+    uint32_t sntp_down_s = 0;               // The SNTP server doesn't answer for that long after the simulation start
+    uint32_t api_down_s = 0;                // The API server refuses connections for that long after the start
+    uint32_t water_every_n_requests = 4;    // Every Nth get_cmds request waters a pump, in turn
+    float water_duration_s = 3.0f;          // Duration of these waterings
+    uint16_t water_pwm = 80;                // Duty of these waterings
+  };
+
+  Config& config();
+
+  // --------------------------------------------------------------------------
+  // Virtual clock
+  // --------------------------------------------------------------------------
+  // Each task has its own clock, forked from its creator's and joined back through the synchronisation primitives.
+  // Tasks are run one at a time: a task runs until it blocks, so the simulation is deterministic.
+
+  int64_t now_us();            // Time since boot on the calling task
+  void advance(int64_t us);    // Spend time on the calling task, firing the esp_timers that expire meanwhile
+  void advance_to(int64_t us); // Same, up to an absolute time
+
+  int64_t rtc_epoch_us();            // Epoch time as kept by the board
+  void set_rtc_epoch_us(int64_t us); // settimeofday()
+  int64_t true_epoch_us();           // Actual epoch time, what an NTP server answers
+
+  // --------------------------------------------------------------------------
+  // Tasks and blocking
+  // --------------------------------------------------------------------------
+  struct TaskExit {};
+  struct DeepSleep {
+    uint64_t duration_us;
+  };
+
+  void spawn(void (*task)(void*), void* arg);
+  void join_tasks(); // Let every task run to completion
+
+  /**
+   * Block the calling task until ready() returns true.
+   * Tasks that can run go first. Once every task is blocked, the earliest of the pending esp_timers and of the wait
+   * deadlines happens next, and a wait without deadline that nothing can satisfy anymore fails.
+   * @param deadline_us absolute time at which the wait gives up, or a negative value to wait forever
+   * @return ready()
+   */
+  bool block_until(const std::function<bool()>& ready, int64_t deadline_us);
+
+  /**
+   * Start the deep sleep from the calling task. The driver catches DeepSleep on the main task: another task ends right
+   * away, and the main task throws it as soon as it gets to run, at the time the sleep started.
+   */
+  [[noreturn]] void sleep_now(uint64_t duration_us);
+
+  // --------------------------------------------------------------------------
+  // esp_timer backend
+  // --------------------------------------------------------------------------
+  struct Timer {
+    void (*callback)(void*);
+    void* arg;
+    int64_t deadline_us = -1; // Inactive when negative
+    int64_t period_us = 0;    // One-shot when null
+  };
+
+  Timer* create_timer(void (*callback)(void*), void* arg);
+  void delete_timer(Timer* timer);
+
+  // --------------------------------------------------------------------------
+  // Board model
+  // --------------------------------------------------------------------------
+  /**
+   * Voltage seen on an ADC pin while the enable pin is HIGH (or always, for GPIO_NUM_NC).
+   * The model gets the actual epoch time, in seconds.
+   */
+  void set_analog(int data_pin, int enable_pin, std::function<uint32_t(double)> millivolts);
+
+  /**
+   * Analog multiplexer (74HC4051/4067) whose common pin is an ADC pin, selected by address pins (S0 first) and enabled
+   * while the inhibit pin is LOW (or always, for -1). A channel only reads its own sensor mux_settle_us after the
+   * address changed, the previously selected one before that.
+   */
+  void set_mux(int signal_pin, std::vector<int> address_pins, int inhibit_pin);
+  // Same as set_analog, for a sensor on a mux channel powered by a rail pin
+  void set_mux_analog(int channel, int rail_pin, std::function<uint32_t(double)> millivolts);
+  uint32_t analog_mv(int pin);
+  int pin_level(int pin);
+  double pumped_s(int pin); // Run time of the pump driven by a pin, as seconds at full duty
+
+  bool radio_on();
+  void start_radio(); // Called by the WiFi mock
+  void stop_radio();  // Called by the WiFi mock and at deep sleep
+
+  // --------------------------------------------------------------------------
+  // Measurements
+  // --------------------------------------------------------------------------
+  enum class Phase : uint8_t { ADC, FLASH, WIFI, SNTP, HTTP, PUMP, RADIO, COUNT };
+  const char* phase_name(Phase phase);
+
+  struct Wake {
+    int64_t awake_us = 0;
+    int64_t asleep_us = 0; // Deep sleep that followed
+    int64_t time_us[static_cast<size_t>(Phase::COUNT)]{};
+    uint32_t count[static_cast<size_t>(Phase::COUNT)]{};
+    size_t bytes_sent = 0;
+    size_t bytes_received = 0;
+    uint64_t allocations = 0; // Heap allocations made by the firmware
+  };
+
+  void record(Phase phase, int64_t start_us, int64_t end_us);
+  void record_bytes(size_t sent, size_t received);
+  Wake& current_wake();
+
+  // --------------------------------------------------------------------------
+  // Fleet
+  // --------------------------------------------------------------------------
+  // Several boards share the process and the API server: before each wake, the state a board keeps across deep sleeps
+  // is swapped in, and it is swapped out after. Plain globals are shared, as they would be lost on the board anyway.
+
+  /**
+   * Everything a board keeps across deep sleeps
+   */
+  struct DeviceState {
+    std::vector<uint8_t> rtc_memory; // RTC_DATA_ATTR variables, empty until the first wake
+    int64_t rtc_boot_epoch_us = 0;
+    int64_t true_boot_epoch_us = 0; // Actual time of the next wake
+    std::vector<double> pumped_s;   // Per pin, empty until the first wake
+    uint32_t noise = 12345;
+    std::map<std::string, std::map<std::string, std::vector<uint8_t>>> nvs;
+    std::vector<std::vector<uint8_t>> partitions; // Empty when erased
+  };
+
+  bool rtc_memory_tracked();                  // Whether RTC_DATA_ATTR variables can be told apart from the other ones
+  void load_device(const DeviceState& state); // After boot()
+  void save_device(DeviceState& state);       // After deep_sleep()
+
+  /**
+   * Queue a request on the API server, which works on config().server_workers requests at once
+   * @param arrival_epoch_us actual time at which the request reaches the server
+   * @return actual time at which the answer leaves it
+   */
+  int64_t serve_request(int64_t arrival_epoch_us);
+  // Wakes are run in order of start time, so the server occupancy before the next one is no longer needed
+  void forget_requests_before(int64_t epoch_us);
+
+  struct Request {
+    uint8_t route;      // Index in route_names()
+    int64_t epoch_us;   // Actual time at which it was sent
+    int64_t latency_us; // Until the answer was received, connection included
+    int64_t queued_us;  // Spent waiting for a server worker
+    uint32_t bytes;     // Sent and received
+  };
+
+  void record_request(const char* path, int64_t epoch_us, int64_t latency_us, int64_t queued_us, size_t bytes);
+  const std::vector<Request>& requests();
+  const std::vector<std::string>& route_names();
+
+  // --------------------------------------------------------------------------
+  // Heap accounting
+  // --------------------------------------------------------------------------
+  // malloc and friends are interposed (alloc.cpp). Allocations are only counted while the firmware runs: the mocks
+  // pause the counting for the work they do on its behalf, which the actual drivers do their own way.
+
+  struct HeapStats {
+    uint64_t allocations = 0; // Calls, including reallocations
+    size_t live_blocks = 0;   // Counted blocks not freed yet
+    size_t live_bytes = 0;
+  };
+
+  HeapStats heap_stats();
+  void count_allocations(bool enable); // Turned on by the driver around the firmware code
+
+  /**
+   * Stop counting the allocations of the calling task for the lifetime of the object
+   */
+  struct AllocPause {
+    AllocPause();
+    ~AllocPause();
+    AllocPause(const AllocPause&) = delete;
+    AllocPause& operator=(const AllocPause&) = delete;
+  };
+
+  // --------------------------------------------------------------------------
+  // Driver hooks
+  // --------------------------------------------------------------------------
+  void boot();                        // Reset the per-boot state, uptime starts from 0
+  void reset_board();                 // GPIO and peripherals back to their reset state
+  void reset_network();               // WiFi disconnected, pending SNTP requests dropped
+  void deep_sleep(uint64_t duration); // Radio off, RTC keeps counting
+
+  // RTC memory, NVS, flash and plants part of load_device() and save_device()
+  void load_board(const DeviceState& state);
+  void save_board(DeviceState& state);
+
+  // In-process stand-in of tools/mock_api_server.py
+  size_t api_handle(const char* path, const char* content_type, const uint8_t* body, size_t size, char* response,
+                    size_t capacity);
+
+} // namespace sim
+
+#endif // MOCK_SIM_HPP
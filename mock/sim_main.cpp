@@ -0,0 +1,271 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// Simulation driver: runs the firmware for a number of wake cycles and reports where the time goes, for one board or
+// for a fleet of boards sharing the API server.
+//
+//     pio run -e native && .pio/build/native/program --wakes 20
+//     .pio/build/native/program --devices 1000 --wakes 12 --workers 4
+//
+
+#include "sim.hpp"
+#include <Arduino.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <queue>
+
+void setup();
+void loop();
+
+namespace {
+  constexpr size_t PHASES{static_cast<size_t>(sim::Phase::COUNT)};
+
+  // Plant moisture, drying out at 20 mV per hour and watered by the pump on a pin (-1 for none)
+  std::function<uint32_t(double)> plant_mv(int plant, double start_s, int pump) {
+    return [plant, start_s, pump](double now_s) {
+      double dried = (now_s - start_s) / 3600.0 * 20.0;                // 20 mV per hour
+      double watered = (pump < 0) ? 0.0 : sim::pumped_s(pump) * 150.0; // 150 mV per second of pumping
+      return static_cast<uint32_t>(std::clamp(1800.0 + 300.0 * (plant % 3) - dried + watered, 400.0, 3000.0));
+    };
+  }
+
+#ifdef PLANT_SENSOR_MUX
+  /**
+   * Sensors wired as in src/main.cpp with PLANT_SENSOR_MUX: battery on GPIO 13, water level on GPIO 32 (enabled by
+   * GPIO 33), 16 plants on a mux read by GPIO 34 and addressed by GPIO 26, 27, 14 and 4, powered by GPIO 25 for
+   * channels 0 to 7 and GPIO 23 for 8 to 15. The first three plants are watered by the pumps on GPIO 18, 19 and 21.
+   */
+  void wire_board(double start_s) {
+    sim::set_analog(13, -1, [](double) { return 2145U; }); // 3.9 V on the 0-6 V range
+    sim::set_analog(32, 33, [](double) { return 2500U; });
+    sim::set_mux(34, {26, 27, 14, 4}, -1);
+    const int pumps[]{18, 19, 21};
+    for (int i = 0; i < 16; i++)
+      sim::set_mux_analog(i, (i < 8) ? 25 : 23, plant_mv(i, start_s, (i < 3) ? pumps[i] : -1));
+  }
+#else
+  /**
+   * Sensors wired as in src/main.cpp: battery on GPIO 13, three plants sharing GPIO 25 (enabled by GPIO 26, 27 and
+   * 14), water level on GPIO 32 (enabled by GPIO 33). Plants slowly dry out and are watered by the pumps on GPIO 18, 19
+   * and 21.
+   */
+  void wire_board(double start_s) {
+    sim::set_analog(13, -1, [](double) { return 2145U; }); // 3.9 V on the 0-6 V range
+    const int enables[]{26, 27, 14};
+    const int pumps[]{18, 19, 21};
+    for (int i = 0; i < 3; i++)
+      sim::set_analog(25, enables[i], plant_mv(i, start_s, pumps[i]));
+    sim::set_analog(32, 33, [](double) { return 2500U; });
+  }
+#endif
+
+  void print_wake(const char* label, const sim::Wake& wake, double scale) {
+    printf("%-9s| awake %8.1f ms | asleep %6.0f s | radio %8.1f ms", label, wake.awake_us * scale / 1000,
+           wake.asleep_us * scale / 1e6, wake.time_us[static_cast<size_t>(sim::Phase::RADIO)] * scale / 1000);
+    for (size_t i = 0; i < PHASES; i++) {
+      if (static_cast<sim::Phase>(i) == sim::Phase::RADIO)
+        continue;
+      printf(" | %s %7.1f ms (%3.0f)", sim::phase_name(static_cast<sim::Phase>(i)), wake.time_us[i] * scale / 1000,
+             wake.count[i] * scale);
+    }
+    printf(" | tx %6.0f B rx %6.0f B | allocs %4.0f\n", wake.bytes_sent * scale, wake.bytes_received * scale,
+           wake.allocations * scale);
+  }
+
+  // Value below which a share of the sorted values falls
+  int64_t percentile(const std::vector<int64_t>& sorted, double share) {
+    if (sorted.empty())
+      return 0;
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(share * static_cast<double>(sorted.size())))];
+  }
+
+  void print_latency(const char* label, std::vector<int64_t> latencies, std::vector<int64_t> queued) {
+    std::sort(latencies.begin(), latencies.end());
+    std::sort(queued.begin(), queued.end());
+    printf("%-26s| n %7zu | p50 %7.1f ms | p90 %7.1f ms | p99 %7.1f ms | max %7.1f ms | queued p99 %7.1f ms\n", label,
+           latencies.size(), percentile(latencies, 0.5) / 1000.0, percentile(latencies, 0.9) / 1000.0,
+           percentile(latencies, 0.99) / 1000.0, (latencies.empty()) ? 0.0 : latencies.back() / 1000.0,
+           percentile(queued, 0.99) / 1000.0);
+  }
+
+  /**
+   * Load put on the API server by the whole fleet: request rate, latency as seen by the boards (connection included)
+   * and traffic per wake
+   */
+  void print_fleet(size_t devices, size_t wakes, size_t reporting_wakes) {
+    const auto& requests = sim::requests();
+    if (requests.empty()) {
+      printf("fleet    | %zu devices | %zu wakes | no request\n", devices, wakes);
+      return;
+    }
+
+    int64_t first = requests.front().epoch_us, last = first;
+    std::map<int64_t, uint32_t> per_second;
+    uint64_t bytes = 0;
+    for (const auto& request : requests) {
+      first = std::min(first, request.epoch_us);
+      last = std::max(last, request.epoch_us + request.latency_us);
+      per_second[request.epoch_us / 1000000]++;
+      bytes += request.bytes;
+    }
+    uint32_t peak = 0;
+    for (const auto& second : per_second)
+      peak = std::max(peak, second.second);
+    double span_s = static_cast<double>(std::max<int64_t>(last - first, 1)) / 1e6;
+    const auto& c = sim::config();
+    double busy = static_cast<double>(requests.size()) * c.server_ms / 1000.0 / (span_s * c.server_workers);
+
+    printf("fleet    | %zu devices | %zu wakes | %zu requests over %.1f h | %.2f req/s, peak %u req/s | server busy "
+           "%.1f %% (%u workers)\n",
+           devices, wakes, requests.size(), span_s / 3600, static_cast<double>(requests.size()) / span_s, peak,
+           busy * 100, c.server_workers);
+    printf("traffic  | %.0f B per wake | %.0f B per reporting wake (%zu) | %.2f requests per reporting wake\n",
+           static_cast<double>(bytes) / static_cast<double>(wakes),
+           static_cast<double>(bytes) / static_cast<double>(std::max<size_t>(reporting_wakes, 1)), reporting_wakes,
+           static_cast<double>(requests.size()) / static_cast<double>(std::max<size_t>(reporting_wakes, 1)));
+
+    std::vector<int64_t> latencies, queued;
+    for (const auto& request : requests) {
+      latencies.push_back(request.latency_us);
+      queued.push_back(request.queued_us);
+    }
+    print_latency("all", latencies, queued);
+    for (size_t route = 0; route < sim::route_names().size(); route++) {
+      latencies.clear();
+      queued.clear();
+      for (const auto& request : requests)
+        if (request.route == route) {
+          latencies.push_back(request.latency_us);
+          queued.push_back(request.queued_us);
+        }
+      print_latency(sim::route_names()[route].c_str(), latencies, queued);
+    }
+  }
+
+  void usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [--wakes N] [--verbose] [--rtc-drift PPM] [--rtt MS] [--sntp-down S] [--api-down S]\n"
+            "          [--devices N] [--workers N] [--spread S]\n"
+            "  --wakes N        number of wake cycles to run, per device (default 10)\n"
+            "  --verbose        echo the firmware serial output\n"
+            "  --rtc-drift PPM  RTC clock error during deep sleep (default 150)\n"
+            "  --rtt MS         round trip time to the API server (default 45)\n"
+            "  --sntp-down S    the SNTP server doesn't answer for the first S seconds (default 0)\n"
+            "  --api-down S     the API server refuses connections for the first S seconds (default 0)\n"
+            "  --devices N      boards sharing the API server, reported as a fleet above 1 (default 1)\n"
+            "  --workers N      requests the API server works on at once (default 8)\n"
+            "  --spread S       the boards first wake up over that many seconds (default 1800)\n",
+            program);
+  }
+
+  /**
+   * Run one wake of a board, from its state when it went to sleep to its state when it goes back to sleep
+   * @return false if the firmware didn't go to deep sleep
+   */
+  bool run_wake(sim::DeviceState& state) {
+    sim::boot();
+    sim::load_device(state);
+    uint64_t allocations = sim::heap_stats().allocations;
+    sim::count_allocations(true);
+    try {
+      setup();
+      loop();
+      fprintf(stderr, "[Sim] setup() returned without going to deep sleep\n");
+      return false;
+    } catch (const sim::DeepSleep& sleep) {
+      sim::count_allocations(false);
+      sim::deep_sleep(sleep.duration_us);
+    }
+    sim::current_wake().allocations = sim::heap_stats().allocations - allocations;
+    sim::save_device(state);
+    return true;
+  }
+} // namespace
+
+int main(int argc, char** argv) {
+  auto& config = sim::config();
+  size_t wakes = 10, devices = 1;
+  double spread_s = 1800;
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--wakes") == 0 && has_value)
+      wakes = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "--verbose") == 0)
+      config.verbose = true;
+    else if (strcmp(argv[i], "--rtc-drift") == 0 && has_value)
+      config.rtc_drift_ppm = strtod(argv[++i], nullptr);
+    else if (strcmp(argv[i], "--rtt") == 0 && has_value)
+      config.rtt_ms = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "--sntp-down") == 0 && has_value)
+      config.sntp_down_s = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "--api-down") == 0 && has_value)
+      config.api_down_s = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "--devices") == 0 && has_value)
+      devices = std::max<size_t>(strtoul(argv[++i], nullptr, 10), 1);
+    else if (strcmp(argv[i], "--workers") == 0 && has_value)
+      config.server_workers = std::max<uint32_t>(strtoul(argv[++i], nullptr, 10), 1);
+    else if (strcmp(argv[i], "--spread") == 0 && has_value)
+      spread_s = strtod(argv[++i], nullptr);
+    else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (devices > 1 && !sim::rtc_memory_tracked()) {
+    fprintf(stderr, "[Sim] RTC_DATA_ATTR variables can't be located on this platform, only one device can be run\n");
+    return 2;
+  }
+
+  // Boards wake up in the actual order of their wakes, each one with its own RTC memory, NVS, flash and plants
+  wire_board(static_cast<double>(config.start_epoch_s));
+  std::vector<sim::DeviceState> states(devices);
+  using Next = std::pair<int64_t, size_t>; // Wake time, device
+  std::priority_queue<Next, std::vector<Next>, std::greater<>> next;
+  for (size_t d = 0; d < devices; d++) {
+    states[d].true_boot_epoch_us =
+      config.start_epoch_s * 1000000 + static_cast<int64_t>(spread_s * 1e6 * static_cast<double>(d) / devices);
+    states[d].noise += static_cast<uint32_t>(d) * 7919;
+    next.emplace(states[d].true_boot_epoch_us, d);
+  }
+
+  sim::Wake total;
+  size_t woken = 0, reporting = 0;
+  std::vector<size_t> runs(devices, 0);
+  while (!next.empty()) {
+    size_t d = next.top().second;
+    next.pop();
+    sim::forget_requests_before(states[d].true_boot_epoch_us);
+    if (!run_wake(states[d]))
+      return 1;
+    if (++runs[d] < wakes)
+      next.emplace(states[d].true_boot_epoch_us, d);
+
+    const auto& wake = sim::current_wake();
+    if (devices == 1) {
+      char label[16];
+      snprintf(label, sizeof(label), "wake %zu", runs[d]);
+      print_wake(label, wake, 1.0);
+    }
+
+    woken++;
+    reporting += (wake.count[static_cast<size_t>(sim::Phase::HTTP)] > 0) ? 1 : 0;
+    total.awake_us += wake.awake_us;
+    total.asleep_us += wake.asleep_us;
+    for (size_t i = 0; i < PHASES; i++) {
+      total.time_us[i] += wake.time_us[i];
+      total.count[i] += wake.count[i];
+    }
+    total.bytes_sent += wake.bytes_sent;
+    total.bytes_received += wake.bytes_received;
+    total.allocations += wake.allocations;
+  }
+
+  if (woken > 0)
+    print_wake("mean", total, 1.0 / static_cast<double>(woken));
+  if (devices > 1)
+    print_fleet(devices, woken, reporting);
+  return 0;
+}
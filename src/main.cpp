@@ -6,9 +6,20 @@
  */
 
 #include <Arduino.h>
+#include <array>
 #include "ApiCaller.hpp"
-#include "IO/Pump.hpp"
-#include "IO/Sensor.hpp"
+#include "ApiWorkers.hpp"
+#include "ConfigStore.hpp"
+#include "IO/DeviceTable.hpp"
+#include "IO/PumpScheduler.hpp"
+#include "IO/SensorBank.hpp"
+#include "IO/SensorScheduler.hpp"
+#include "MoistureTrend.hpp"
+#include "ReadingBuffer.hpp"
+#include "ReportFilter.hpp"
+#include "TimeService.hpp"
+#include "WakeBudget.hpp"
+#include "WakeProfiler.hpp"
 #include "WifiConnect.hpp"
 #include "common.hpp"
 
@@ -21,117 +32,410 @@
 #define WIFI_SSID "B-DTU Wireless"
 #define WIFI_PSW "StudentDK"
 
-// Sensors
-#define BATTERY_SENSOR_DATA GPIO_NUM_13
-#define PLANT1_SENSOR_ENABLE GPIO_NUM_26
-#define PLANT2_SENSOR_ENABLE GPIO_NUM_27
-#define PLANT3_SENSOR_ENABLE GPIO_NUM_14
-#define PLANTS_SENSOR_DATA GPIO_NUM_25
-#define WATER_LEVEL_ENABLE GPIO_NUM_33
-#define WATER_LEVEL_DATA GPIO_NUM_32
-
-// Pump
-#define PUMP1_PWM_PIN GPIO_NUM_18
-#define PUMP2_PWM_PIN GPIO_NUM_19
-#define PUMP3_PWM_PIN GPIO_NUM_21
-#define PUMP_PWM_CHANNEL 0
+#ifdef PLANT_SENSOR_MUX
+// Sensors: data pin, enable pin, value range, warm-up (ms) and deadband (changes below it are not reported)
+constexpr meltwin::SensorSpec SENSORS[]{
+  {GPIO_NUM_13, GPIO_NUM_NC, 0.0f, 6.0f, 0, 0.05f},    // Battery
+  {GPIO_NUM_32, GPIO_NUM_33, 0.0f, 1.0f, 1000, 0.02f}, // Water level
+};
+
+// Plants: a 74HC4067 on GPIO 34 (ADC1, so it is read while the WiFi starts), one power rail per shelf of 8 plants
+constexpr meltwin::MuxSpec PLANT_MUX{GPIO_NUM_34, {GPIO_NUM_26, GPIO_NUM_27, GPIO_NUM_14, GPIO_NUM_4}};
+constexpr meltwin::SensorRail PLANT_RAILS[]{{GPIO_NUM_25, 1000, 20}, {GPIO_NUM_23, 1000, 20}};
+constexpr auto PLANT_CHANNELS{[] {
+  std::array<meltwin::MuxChannelSpec, PLANT_SENSORS> channels{};
+  for (uint8_t i = 0; i < PLANT_SENSORS; i++)
+    channels[i] = meltwin::MuxChannelSpec{i, static_cast<uint8_t>(i / 8), 0.0f, 1.0f, 0.01f};
+  return channels;
+}()};
+using PlantBank = meltwin::SensorBank<PLANT_MUX, PLANT_RAILS, PLANT_CHANNELS>;
+#define FIRST_PLANT_SENSOR 2 // Index of the first plant in the readings, the bank comes after the sensors table
+#else
+// Sensors: data pin, enable pin, value range, warm-up (ms) and deadband (changes below it are not reported)
+constexpr meltwin::SensorSpec SENSORS[]{
+  {GPIO_NUM_13, GPIO_NUM_NC, 0.0f, 6.0f, 0, 0.05f},    // Battery
+  {GPIO_NUM_25, GPIO_NUM_26, 0.0f, 1.0f, 1000, 0.01f}, // Plant 1
+  {GPIO_NUM_25, GPIO_NUM_27, 0.0f, 1.0f, 1000, 0.01f}, // Plant 2
+  {GPIO_NUM_25, GPIO_NUM_14, 0.0f, 1.0f, 1000, 0.01f}, // Plant 3
+  {GPIO_NUM_32, GPIO_NUM_33, 0.0f, 1.0f, 1000, 0.02f}, // Water level
+};
+using PlantBank = meltwin::NoSensorBank;
+#define FIRST_PLANT_SENSOR 1 // Index of the first plant in the readings
+#endif
+
+// Pumps: PWM pin, LEDC channel, resolution (bits) and current drawn at full duty (mA)
+constexpr meltwin::PumpSpec PUMPS[]{
+  {GPIO_NUM_18, 0, 12, 500},
+  {GPIO_NUM_19, 1, 12, 500},
+  {GPIO_NUM_21, 2, 12, 500},
+};
+constexpr size_t PUMP_PLANTS[]{0, 1, 2}; // Plant watered by each pump
 #define PUMP_PWM_FREQ 16000
-#define PUMP_PWM_RESOLUTION 12
+#define PUMP_CURRENT_BUDGET_MA 1000 // Max current for all running pumps
+
+// Wake cycle pipeline
+#define CONNECT_TASK_CORE 0 // Same core as the WiFi stack, sensing stays on the Arduino core
+#define CONNECT_TASK_STACK 8192
 
 // ----------------------------------------------------------------------------
 // Aliases
 // ----------------------------------------------------------------------------
+using meltwin::AdcUnit;
 using meltwin::APICaller;
+using meltwin::ApiFuture;
+using meltwin::ApiWorkers;
+using meltwin::ConfigStore;
 using meltwin::InternalErrors;
-using meltwin::Pump;
+using meltwin::MoistureTrend;
 using meltwin::PumpCmd;
-using meltwin::Sensor;
+using meltwin::PumpRun;
+using meltwin::ReadingBuffer;
+using meltwin::ReportFilter;
+using meltwin::SensorReading;
+using meltwin::SensorScheduler;
+using meltwin::TimeService;
+using meltwin::WakeBudget;
+using meltwin::WakePhase;
+using meltwin::WakeProfiler;
+
+using Devices = meltwin::DeviceTable<SENSORS, PUMPS>;
+constexpr size_t SENSOR_COUNT{Devices::SENSOR_COUNT + PlantBank::COUNT}; // The sensors table, then the plant bank
+static_assert(FIRST_PLANT_SENSOR + meltwin::PLANT_COUNT <= SENSOR_COUNT, "Every plant needs a sensor");
+static_assert(SENSOR_COUNT <= meltwin::REPORT_FILTER_SENSORS, "Too many sensors for the report filter");
+static_assert(SENSOR_COUNT <= meltwin::APICaller::SERIES_MAX_SENSORS, "Too many sensors for the series ids");
+static_assert(std::size(PUMP_PLANTS) == Devices::PUMP_COUNT, "Every pump needs a plant");
+static_assert([] {
+  for (size_t plant : PUMP_PLANTS)
+    if (plant >= meltwin::PLANT_COUNT)
+      return false;
+  return true;
+}(), "A pump waters a plant that doesn't exist");
+constexpr uint32_t PUMPED_PLANTS{[] {
+  uint32_t mask = 0;
+  for (size_t plant : PUMP_PLANTS)
+    mask |= 1U << plant;
+  return mask;
+}()};
+static_assert(Devices::pwm_frequency_fits(PUMP_PWM_FREQ), "PWM frequency too high for the pumps resolution");
+static_assert(PlantBank::shares_no_pin_with<Devices>(), "A pin of the plant bank is already used by the devices table");
 
+constexpr std::array<float, SENSOR_COUNT> DEADBANDS{[] {
+  std::array<float, SENSOR_COUNT> deadbands{};
+  auto table = Devices::deadbands();
+  auto bank = PlantBank::deadbands();
+  for (size_t i = 0; i < table.size(); i++)
+    deadbands[i] = table[i];
+  for (size_t i = 0; i < bank.size(); i++)
+    deadbands[table.size() + i] = bank[i];
+  return deadbands;
+}()};
 
 bool console = false;
 
+// ----------------------------------------------------------------------------
+// Connection task, run on the other core while sensors are being read
+// ----------------------------------------------------------------------------
+constexpr EventBits_t ADC2_RELEASED{BIT0}; // The WiFi radio can't start while ADC2 is being read
+constexpr EventBits_t CONNECT_DONE{BIT1};
+EventGroupHandle_t wake_events;
+StaticEventGroup_t wake_events_buffer;
+StackType_t connect_task_stack[CONNECT_TASK_STACK];
+StaticTask_t connect_task_buffer;
+InternalErrors connect_status = InternalErrors::FAILED;
+
+void connect_task(void*) {
+  xEventGroupWaitBits(wake_events, ADC2_RELEASED, pdFALSE, pdTRUE, portMAX_DELAY);
+
+  Serial.println("Initializing WiFi");
+  WakeProfiler::start(WakePhase::WIFI);
+  bool connected = meltwin::WiFiConnect::init(WIFI_SSID, WIFI_PSW);
+  WakeProfiler::stop(WakePhase::WIFI);
+  if (!connected)
+    connect_status = InternalErrors::FAILED;
+  else {
+    // Authenticate on a worker while the other ones open their connections and the clock is synced here
+    Serial.println("Authenticating on the API");
+    WakeProfiler::start(WakePhase::AUTH);
+    static auto authenticate = [] {
+      char token[meltwin::TokenCache::TOKEN_LENGTH];
+      return APICaller::get_token(token);
+    };
+    ApiFuture auth = ApiWorkers::submit(authenticate, WakeBudget::left_ms(WakePhase::WIFI, API_REQUEST_TIMEOUT_MS));
+    for (size_t i = 1; i < ApiWorkers::WORKERS; i++)
+      ApiWorkers::post([](void*) {
+        meltwin::APIConnection::preconnect(meltwin::Endpoints::LOGIN);
+        return InternalErrors::SUCCESS;
+      });
+
+    if (TimeService::sync_due()) {
+      WakeProfiler::Span span(WakePhase::TIME_SYNC);
+      TimeService::sync();
+    }
+    connect_status = ApiWorkers::wait(auth);
+    WakeProfiler::stop(WakePhase::AUTH);
+  }
+
+  xEventGroupSetBits(wake_events, CONNECT_DONE);
+  vTaskDelete(nullptr);
+}
+
 // ----------------------------------------------------------------------------
 // Debug Console & Automatic Watering programs
 // ----------------------------------------------------------------------------
 void run_console() {
   do
     Serial.println("Waiting for next cmd ...");
-  while (!meltwin::DevConsole::execute_command());
+  while (meltwin::DevConsole::execute_command());
+}
+
+/**
+ * Power the pumps that need to, several at once, and checkpoint the watered plants
+ * @param runs filled with what each pump actually did
+ * @param deadline_us esp_timer time by which every pump must have stopped
+ * @return bit mask of the watered plants
+ */
+uint32_t run_pumps(const PumpCmd* cmds, PumpRun* runs, int64_t deadline_us) {
+  static constexpr auto pumps{Devices::pumps()};
+  meltwin::PumpScheduler scheduler(PUMP_CURRENT_BUDGET_MA, PUMP_PWM_FREQ);
+  for (size_t i = 0; i < Devices::PUMP_COUNT; i++)
+    scheduler.add(pumps[i], cmds[i]);
+  scheduler.run(deadline_us);
+  if (scheduler.cut_short() > 0)
+    WakeProfiler::add_overrun(WakePhase::PUMP);
+
+  for (size_t i = 0; i < Devices::PUMP_COUNT; i++)
+    runs[i] = PumpRun{i, 0.0, 0};
+  for (size_t j = 0; j < scheduler.size(); j++)
+    runs[scheduler.job(j).pump - pumps.data()] = meltwin::PumpScheduler::run_of(scheduler.job(j));
+  uint32_t watered = 0;
+  for (size_t i = 0; i < Devices::PUMP_COUNT; i++)
+    if (runs[i].time > 0.0f) {
+      ConfigStore::set_last_watered(PUMP_PLANTS[i], TimeService::now().us);
+      watered |= 1U << PUMP_PLANTS[i];
+    }
+  return watered;
+}
+
+/**
+ * Fallback when the pumps commands can't be fetched: every plant whose watering period has elapsed since its last
+ * watering gets its configured open time, at full duty. Nothing is due until the clock has been set.
+ * @return bit mask of the watered plants
+ */
+uint32_t water_locally() {
+  if (!TimeService::synced())
+    return 0;
+  PumpCmd cmds[Devices::PUMP_COUNT];
+  PumpRun runs[Devices::PUMP_COUNT];
+  bool due = false;
+  int64_t now_us = TimeService::now().us;
+  for (size_t i = 0; i < Devices::PUMP_COUNT; i++) {
+    const auto& plant = ConfigStore::plant(PUMP_PLANTS[i]);
+    cmds[i] = PumpCmd{i, 0.0f, 0};
+    if (now_us - plant.last_watered_us >= static_cast<int64_t>(plant.period_s) * S_2US) {
+      cmds[i] = PumpCmd{i, static_cast<float>(plant.open_time_ms) / 1000.0f, 100};
+      due = true;
+    }
+  }
+  if (!due)
+    return 0;
+  Serial.println("Watering on the local schedule");
+  return run_pumps(cmds, runs, WakeBudget::deadline_us(WakePhase::PUMP));
 }
 
 void run_watering() {
   // ============================================
   // I - Reading sensors
   // ============================================
-  std::vector<Sensor> sensors{
-    Sensor(BATTERY_SENSOR_DATA, 0.0, 6.0),
-    Sensor(PLANTS_SENSOR_DATA, 0.0, 1.0, PLANT1_SENSOR_ENABLE),
-    Sensor(PLANTS_SENSOR_DATA, 0.0, 1.0, PLANT2_SENSOR_ENABLE),
-    Sensor(PLANTS_SENSOR_DATA, 0.0, 1.0, PLANT3_SENSOR_ENABLE),
-    Sensor(WATER_LEVEL_DATA, 0.0, 1.0, WATER_LEVEL_ENABLE),
-  };
-  float values[sensors.size()];
+  constexpr size_t n_sensors{SENSOR_COUNT};
+  SensorReading readings[n_sensors];
+  float values[n_sensors];
+
+  // Only turn the radio on when the buffered readings have to be sent, a plant may need water or the clock drifted.
+  // Readings are held until the clock has been set once, the sync retries having their own backoff.
+  TimeService::begin();
+  ReadingBuffer::init();
+  ReportFilter::init();
+  bool report = (TimeService::synced() && ReadingBuffer::flush_due(time(nullptr))) ||
+                MoistureTrend::watering_due(time(nullptr)) || TimeService::sync_due();
+
+  // Connect to the API on the other core in the meantime
+  if (report) {
+    WakeBudget::start(WakePhase::WIFI);
+    ApiWorkers::begin();
+    wake_events = xEventGroupCreateStatic(&wake_events_buffer);
+    xTaskCreateStaticPinnedToCore(connect_task, "connect", CONNECT_TASK_STACK, nullptr, 1, connect_task_stack,
+                                  &connect_task_buffer, CONNECT_TASK_CORE);
+  }
+
+  // Let the WiFi start as soon as the ADC2 sensors are read, while the ADC1 ones go on
   Serial.println("Reading sensors values");
-  for (size_t i = 0; i < sensors.size(); i++) {
-    Serial.printf("\t-> Reading sensor %zu ... ", i);
-    auto& s = sensors[i];
-    s.setup_sensor();
-    values[i] = s.read_sensor();
-    Serial.printf("%f\n", values[i]);
-    s.cleanup();
+  WakeProfiler::start(WakePhase::SENSORS);
+  WakeBudget::start(WakePhase::SENSORS);
+  Devices::for_each_sensor([](auto sensor) { sensor.setup(); });
+  PlantBank::setup();
+  if (!report)
+    SensorScheduler<SENSORS>::read_all(values);
+  else
+    SensorScheduler<SENSORS>::read_all(values, [](float* table_values) {
+      if constexpr (PlantBank::ON_ADC2)
+        PlantBank::read_all(table_values + Devices::SENSOR_COUNT);
+      xEventGroupSetBits(wake_events, ADC2_RELEASED);
+    });
+  if (!report || !PlantBank::ON_ADC2)
+    PlantBank::read_all(values + Devices::SENSOR_COUNT);
+  for (size_t i = 0; i < n_sensors; i++) {
+    readings[i].sensor_id = i;
+    readings[i].value = values[i];
+    readings[i].timestamp = time(nullptr);
+    Serial.printf("\t-> Sensor %zu: %f\n", i, values[i]);
+  }
+  Devices::for_each_sensor([](auto sensor) { sensor.power_off(); });
+  for (size_t plant = 0; plant < meltwin::PLANT_COUNT; plant++)
+    MoistureTrend::update(plant, values[FIRST_PLANT_SENSOR + plant], readings[FIRST_PLANT_SENSOR + plant].timestamp);
+  WakeBudget::stop(WakePhase::SENSORS);
+  WakeProfiler::stop(WakePhase::SENSORS);
+
+  // Only buffer the readings that changed
+  ReadingBuffer::push(readings, ReportFilter::apply(readings, n_sensors, DEADBANDS.data()));
+  if (!report) {
+    Serial.printf("Buffered %zu readings, nothing to send yet\n", ReadingBuffer::size());
+    return;
   }
 
   // ============================================
   // II - Connect to API
   // ============================================
-  Serial.println("Initializing WiFi");
-  if (!init_wifi(WIFI_SSID, WIFI_PSW))
-    return;
-
-  Serial.println("Authenticating on the API");
-  std::string token;
-  if (auto code = APICaller::authenticate(token); code != InternalErrors::SUCCESS) {
-    Serial.printf("\t-> Couldn't authenticate on API: error %d\n", code);
+  auto bits = xEventGroupWaitBits(wake_events, CONNECT_DONE, pdFALSE, pdTRUE,
+                                  pdMS_TO_TICKS(WakeBudget::left_ms(WakePhase::WIFI)));
+  WakeBudget::stop(WakePhase::WIFI);
+  if ((bits & CONNECT_DONE) == 0 || connect_status != InternalErrors::SUCCESS) {
+    Serial.printf("\t-> Couldn't connect to the API: error %d\n", connect_status);
+    ReadingBuffer::flush_failed();
+    WakeProfiler::start(WakePhase::PUMP);
+    WakeBudget::start(WakePhase::PUMP);
+    MoistureTrend::watering_done(time(nullptr), water_locally());
+    WakeBudget::stop(WakePhase::PUMP);
+    WakeProfiler::stop(WakePhase::PUMP);
     return;
   }
-  Serial.printf("\t-> The connction token is {%s}\n", token.c_str());
-
-  // Upload sensors values
-  Serial.println("Sending sensors data to the API");
-  for (size_t i = 0; i < sensors.size(); i++) {
-    Serial.printf("\t-> Sending data for sensor %zu\n", i);
-    if (auto code = APICaller::sendData(token.c_str(), i, values[i]); code != InternalErrors::SUCCESS)
-      Serial.printf("\t  Couldn't send sensor data on API: error %d\n", code);
+
+  // Upload buffered sensors values, with the wake profile when it is due, while the pumps commands are fetched and run
+  WakeProfiler::start(WakePhase::UPLOAD);
+  WakeBudget::start(WakePhase::UPLOAD);
+  static bool profile;
+  static bool profile_sent;
+  profile = WakeProfiler::report_due();
+  profile_sent = false;
+  static auto upload = [] {
+    bool flushed = ReadingBuffer::flush([](const SensorReading* batch, size_t count) {
+      // Out of time, the remaining readings stay buffered for the next wake
+      uint32_t left_ms = WakeBudget::left_ms(WakePhase::UPLOAD);
+      if (left_ms == 0)
+        return false;
+      meltwin::APIConnection::set_timeout(left_ms);
+
+      // Readings taken before the first clock sync are dated on the synced clock
+      SensorReading rebased[ReadingBuffer::FLUSH_CHUNK];
+      for (size_t i = 0; i < count; i++) {
+        rebased[i] = batch[i];
+        rebased[i].timestamp = TimeService::rebase(batch[i].timestamp);
+      }
+
+      InternalErrors statuses[ReadingBuffer::FLUSH_CHUNK]{};
+      auto code = APICaller::with_token(
+        [&](const char* token) { return APICaller::sendSeries(token, rebased, count, statuses, profile); });
+      if (code != InternalErrors::SUCCESS && code != InternalErrors::REJECTED) {
+        // The request itself failed, the whole chunk stays buffered for the next wake
+        Serial.printf("\t-> Couldn't send all sensors data on API: error %d\n", code);
+        return false;
+      }
+
+      // Readings rejected by the API won't be accepted later, they are dropped with the chunk
+      for (size_t i = 0; i < count; i++)
+        if (statuses[i] == InternalErrors::REJECTED)
+          Serial.printf("\t-> Reading of sensor %u rejected by the API, dropped\n", batch[i].sensor_id);
+      profile_sent = profile_sent || profile;
+      profile = false;
+      return true;
+    });
+    return (flushed) ? InternalErrors::SUCCESS : InternalErrors::FAILED;
+  };
+  ApiFuture uploaded{0, false};
+  if (!TimeService::synced())
+    Serial.printf("Clock not set yet, holding %zu buffered readings\n", ReadingBuffer::size());
+  else {
+    Serial.printf("Sending %zu buffered readings to the API\n", ReadingBuffer::size());
+    uploaded = ApiWorkers::submit(upload, WakeBudget::left_ms(WakePhase::UPLOAD));
   }
 
   // ============================================
   // III - Watering plants
   // ============================================
-  std::vector<Pump> pumps{Pump(PUMP1_PWM_PIN, PUMP_PWM_CHANNEL, PUMP_PWM_RESOLUTION)};
-  for (size_t i = 0; i < pumps.size(); i++) {
-    auto& pump = pumps[i];
-    PumpCmd cmd;
-    APICaller::getPumpCmd(token.c_str(), i, cmd);
-
-    // Power pump if needed
-    if (cmd.time > 0.0 && cmd.pwm > 0.0) {
-      Serial.printf("Running pump %zu for %f s at %f % ...\n", i, cmd.time, cmd.pwm);
-      pump.setup_pump(PUMP_PWM_FREQ);
-      pump.run_pump(cmd);
-      pump.stop_pump();
-    }
-    APICaller::pumpingDone(token.c_str(), i);
+  WakeProfiler::start(WakePhase::PUMP);
+  WakeBudget::start(WakePhase::PUMP);
+  constexpr size_t n_pumps{Devices::PUMP_COUNT};
+  static PumpCmd cmds[n_pumps];
+  static PumpRun runs[n_pumps];
+  static auto fetch = [] {
+    return APICaller::with_token(
+      [](const char* token) { return APICaller::getPumpCmds(token, cmds, Devices::PUMP_COUNT); });
+  };
+  ApiFuture acknowledged{0, false};
+  uint32_t watered = 0;
+  ApiFuture fetched = ApiWorkers::submit(fetch, WakeBudget::left_ms(WakePhase::PUMP, API_REQUEST_TIMEOUT_MS));
+  if (auto code = ApiWorkers::wait(fetched); code != InternalErrors::SUCCESS) {
+    // A fetch that timed out may still write the commands, the local schedule has its own
+    Serial.printf("\t-> Couldn't get the pumps commands: error %d\n", code);
+    watered = water_locally();
+  } else {
+    // Keep time to acknowledge the runs, then report what has actually been done
+    watered = run_pumps(cmds, runs, WakeBudget::deadline_us(WakePhase::PUMP) - API_REQUEST_TIMEOUT_MS * 1000LL);
+    static auto acknowledge = [] {
+      return APICaller::with_token(
+        [](const char* token) { return APICaller::pumpingDoneBatch(token, runs, Devices::PUMP_COUNT); });
+    };
+    acknowledged = ApiWorkers::submit(acknowledge, WakeBudget::left_ms(WakePhase::PUMP, API_REQUEST_TIMEOUT_MS));
   }
+  MoistureTrend::watering_done(time(nullptr), watered);
+
+  // Both chains of requests are done, or given up on
+  if (uploaded.valid)
+    ApiWorkers::wait(uploaded);
+  WakeBudget::stop(WakePhase::UPLOAD);
+  if (profile_sent)
+    WakeProfiler::reset();
+  WakeProfiler::stop(WakePhase::UPLOAD);
+  if (acknowledged.valid)
+    if (auto code = ApiWorkers::wait(acknowledged); code != InternalErrors::SUCCESS)
+      Serial.printf("\t-> Couldn't acknowledge the pumps runs: error %d\n", code);
+  WakeBudget::stop(WakePhase::PUMP);
+  WakeProfiler::stop(WakePhase::PUMP);
+}
+
+// Called at the wake deadline, before a forced deep sleep
+void cut_pumps() {
+  for (const auto& pump : Devices::pumps())
+    pump.cut_pump();
 }
 
 void wrap_up() {
   Serial.println("Wrapping up ...");
+  WakeProfiler::start(WakePhase::SLEEP);
+  WakeBudget::start(WakePhase::SLEEP);
+  if (ApiWorkers::stop(WakeBudget::left_ms(WakePhase::SLEEP)))
+    meltwin::APIConnection::close();
+  ConfigStore::commit();
+  uint64_t sleep_us = MoistureTrend::next_sleep_us(time(nullptr));
+  Serial.printf("Next wake in %u s\n", static_cast<unsigned int>(sleep_us / S_2US));
 
   delay(1000);
   digitalWrite(13, LOW);
   Serial.end();
   delay(1000);
-  esp_sleep_enable_timer_wakeup(DEEP_SLEEP_DURATION);
+  esp_sleep_enable_timer_wakeup(sleep_us);
+  WakeBudget::stop(WakePhase::SLEEP);
+  WakeProfiler::stop(WakePhase::SLEEP);
+  WakeProfiler::stop(WakePhase::WAKE);
   esp_deep_sleep_start();
 }
 
@@ -139,9 +443,13 @@ void wrap_up() {
 // Setup
 // ----------------------------------------------------------------------------
 void setup() {
+  WakeProfiler::begin();
+  WakeBudget::begin(cut_pumps);
+  MoistureTrend::init(PUMPED_PLANTS);
 
   // Setup sub classes
   Serial.begin(SERIAL_BAUD_RATE);
+  ConfigStore::begin();
 
   // Setup deep sleep
   esp_sleep_enable_timer_wakeup(DEEP_SLEEP_DURATION);
@@ -152,7 +460,11 @@ void setup() {
 
   // // Look for serial connection for preferences dev console
   Serial.printf("Send \"cmd\" to start developer console (%f s)\n", meltwin::DevConsole::START_TIMEOUT / 1000.);
+  WakeProfiler::start(WakePhase::CONSOLE);
   console = meltwin::DevConsole::wait_for_console_launch();
+  WakeProfiler::stop(WakePhase::CONSOLE);
+  if (console)
+    WakeBudget::disarm();
 
   (console) ? run_console() : run_watering();
   wrap_up();
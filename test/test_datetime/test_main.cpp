@@ -0,0 +1,236 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// Host tests and benchmark of the DateTime calendar math, run with: pio test -e native -f test_datetime
+//
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <unity.h>
+#include "datetime.h"
+
+using meltwin::DateTime;
+
+void setUp() {}
+void tearDown() {}
+
+namespace {
+
+  void assert_fields(const DateTime& datetime, int32_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minutes,
+                     uint8_t seconds, uint32_t usecs) {
+    auto f = datetime.fields();
+    TEST_ASSERT_EQUAL_INT32(year, f.year);
+    TEST_ASSERT_EQUAL_UINT8(month, f.month);
+    TEST_ASSERT_EQUAL_UINT8(day, f.day);
+    TEST_ASSERT_EQUAL_UINT8(hour, f.hour);
+    TEST_ASSERT_EQUAL_UINT8(minutes, f.minutes);
+    TEST_ASSERT_EQUAL_UINT8(seconds, f.seconds);
+    TEST_ASSERT_EQUAL_UINT32(usecs, f.usecs);
+  }
+
+  std::string iso(const DateTime& datetime) {
+    char buffer[DateTime::ISO_LENGTH + 1];
+    datetime.to_iso(buffer);
+    return buffer;
+  }
+
+  DateTime parse(const char* iso) {
+    DateTime datetime;
+    TEST_ASSERT_TRUE_MESSAGE(DateTime::from_iso(iso, datetime), iso);
+    return datetime;
+  }
+
+  // Same pseudo-random sequence on every run
+  uint64_t next_random(uint64_t& state) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return state >> 11;
+  }
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+// Calendar
+// ----------------------------------------------------------------------------
+void test_leap_years() {
+  TEST_ASSERT_TRUE(DateTime::is_leap(2000));
+  TEST_ASSERT_TRUE(DateTime::is_leap(2024));
+  TEST_ASSERT_TRUE(DateTime::is_leap(1600));
+  TEST_ASSERT_FALSE(DateTime::is_leap(1900));
+  TEST_ASSERT_FALSE(DateTime::is_leap(2100));
+  TEST_ASSERT_FALSE(DateTime::is_leap(2023));
+  TEST_ASSERT_EQUAL_UINT8(29, DateTime::month_length(2000, 2));
+  TEST_ASSERT_EQUAL_UINT8(28, DateTime::month_length(1900, 2));
+  TEST_ASSERT_EQUAL_UINT8(29, DateTime::month_length(2024, 2));
+  TEST_ASSERT_EQUAL_UINT8(28, DateTime::month_length(2100, 2));
+}
+
+void test_month_lengths() {
+  constexpr uint8_t LENGTHS[12]{31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  for (uint8_t month = 1; month <= 12; month++)
+    TEST_ASSERT_EQUAL_UINT8(LENGTHS[month - 1], DateTime::month_length(2023, month));
+}
+
+void test_leap_days() {
+  // The day after February 28th, in a leap year and in century years
+  assert_fields(DateTime(2024, 2, 28, 0, 0, 0) + DateTime::US_PER_DAY, 2024, 2, 29, 0, 0, 0, 0);
+  assert_fields(DateTime(2000, 2, 28, 0, 0, 0) + DateTime::US_PER_DAY, 2000, 2, 29, 0, 0, 0, 0);
+  assert_fields(DateTime(1900, 2, 28, 0, 0, 0) + DateTime::US_PER_DAY, 1900, 3, 1, 0, 0, 0, 0);
+  assert_fields(DateTime(2100, 2, 28, 0, 0, 0) + DateTime::US_PER_DAY, 2100, 3, 1, 0, 0, 0, 0);
+  assert_fields(DateTime(2000, 2, 29, 0, 0, 0) + DateTime::US_PER_DAY, 2000, 3, 1, 0, 0, 0, 0);
+  TEST_ASSERT_EQUAL_INT64(366, (DateTime(2001, 1, 1, 0, 0, 0) - DateTime(2000, 1, 1, 0, 0, 0)) / DateTime::US_PER_DAY);
+  TEST_ASSERT_EQUAL_INT64(365, (DateTime(1901, 1, 1, 0, 0, 0) - DateTime(1900, 1, 1, 0, 0, 0)) / DateTime::US_PER_DAY);
+}
+
+void test_rollovers() {
+  // Microsecond, month and year carries
+  assert_fields(DateTime(2024, 12, 31, 23, 59, 59, 999999) + 1, 2025, 1, 1, 0, 0, 0, 0);
+  assert_fields(DateTime(2024, 4, 30, 23, 59, 59) + DateTime::US_PER_S, 2024, 5, 1, 0, 0, 0, 0);
+  assert_fields(DateTime(2025, 1, 1, 0, 0, 0) - 1, 2024, 12, 31, 23, 59, 59, 999999);
+
+  // More than a month at once
+  assert_fields(DateTime(2024, 1, 31, 12, 0, 0) + 30 * DateTime::US_PER_DAY, 2024, 3, 1, 12, 0, 0, 0);
+  assert_fields(DateTime(2023, 1, 31, 12, 0, 0) + 400 * DateTime::US_PER_DAY, 2024, 3, 6, 12, 0, 0, 0);
+  assert_fields(DateTime(2024, 3, 1, 0, 0, 0) - 366 * DateTime::US_PER_DAY, 2023, 3, 1, 0, 0, 0, 0);
+}
+
+void test_every_day_round_trips() {
+  // Walk day by day from 1600 to 2400: day numbers follow each other and convert back to the same date
+  int64_t expected = DateTime::days_from_civil(1600, 1, 1);
+  for (int32_t year = 1600; year <= 2400; year++)
+    for (uint8_t month = 1; month <= 12; month++)
+      for (uint8_t day = 1; day <= DateTime::month_length(year, month); day++, expected++) {
+        int64_t days = DateTime::days_from_civil(year, month, day);
+        TEST_ASSERT_EQUAL_INT64(expected, days);
+        auto f = DateTime::civil_from_days(days);
+        TEST_ASSERT_EQUAL_INT32(year, f.year);
+        TEST_ASSERT_EQUAL_UINT8(month, f.month);
+        TEST_ASSERT_EQUAL_UINT8(day, f.day);
+      }
+}
+
+void test_epoch_boundaries() {
+  TEST_ASSERT_EQUAL_INT64(0, DateTime(1970, 1, 1, 0, 0, 0).us);
+  assert_fields(DateTime(0), 1970, 1, 1, 0, 0, 0, 0);
+  assert_fields(DateTime(-1), 1969, 12, 31, 23, 59, 59, 999999);
+  TEST_ASSERT_EQUAL_INT64(-1, DateTime(-1).epoch_s());
+  TEST_ASSERT_EQUAL_INT64(-1, DateTime(1969, 12, 31, 23, 59, 59).epoch_s());
+
+  // 32-bit time_t and uint32 timestamps (SeriesCodec) limits
+  TEST_ASSERT_EQUAL_INT64(INT32_MAX, DateTime(2038, 1, 19, 3, 14, 7).epoch_s());
+  assert_fields(DateTime::from_epoch_s(int64_t{INT32_MAX} + 1), 2038, 1, 19, 3, 14, 8, 0);
+  TEST_ASSERT_EQUAL_INT64(UINT32_MAX, DateTime(2106, 2, 7, 6, 28, 15).epoch_s());
+}
+
+void test_matches_libc() {
+  uint64_t state = 1;
+  for (int i = 0; i < 100000; i++) {
+    auto seconds = static_cast<time_t>(next_random(state) % (int64_t{4} << 32)); // 1970 to 2514
+    struct tm expected;
+    gmtime_r(&seconds, &expected);
+    assert_fields(DateTime::from_epoch_s(seconds), expected.tm_year + 1900, expected.tm_mon + 1, expected.tm_mday,
+                  expected.tm_hour, expected.tm_min, expected.tm_sec, 0);
+    TEST_ASSERT_EQUAL_INT64(seconds, DateTime(expected.tm_year + 1900, expected.tm_mon + 1, expected.tm_mday,
+                                              expected.tm_hour, expected.tm_min, expected.tm_sec)
+                                       .epoch_s());
+  }
+}
+
+// ----------------------------------------------------------------------------
+// ISO-8601
+// ----------------------------------------------------------------------------
+void test_to_iso() {
+  TEST_ASSERT_EQUAL_STRING("1970-01-01T00:00:00.000000+00:00", iso(DateTime()).c_str());
+  TEST_ASSERT_EQUAL_STRING("2000-02-29T23:59:59.999999+00:00", iso(DateTime(2000, 2, 29, 23, 59, 59, 999999)).c_str());
+  TEST_ASSERT_EQUAL_STRING("1969-12-31T23:59:59.999999+00:00", iso(DateTime(-1)).c_str());
+  TEST_ASSERT_EQUAL_STRING("1900-03-01T12:00:00.000001+00:00", iso(DateTime(1900, 3, 1, 12, 0, 0, 1)).c_str());
+}
+
+void test_from_iso() {
+  TEST_ASSERT_TRUE(parse("2024-12-18T10:20:30Z") == DateTime(2024, 12, 18, 10, 20, 30));
+  TEST_ASSERT_TRUE(parse("2024-12-18T10:20:30") == DateTime(2024, 12, 18, 10, 20, 30));
+  TEST_ASSERT_TRUE(parse("2024-12-18T11:20:30.5+01:00") == DateTime(2024, 12, 18, 10, 20, 30, 500000));
+  TEST_ASSERT_TRUE(parse("2024-12-18T10:20:30.123456789Z") ==
+                   DateTime(2024, 12, 18, 10, 20, 30, 123456)); // Digits past the microsecond are dropped
+
+  // Offsets that move the date across a day, a month and a year
+  TEST_ASSERT_TRUE(parse("2025-01-01T02:00:00+05:30") == DateTime(2024, 12, 31, 20, 30, 0));
+  TEST_ASSERT_TRUE(parse("2024-02-28T20:00:00-08:00") == DateTime(2024, 2, 29, 4, 0, 0));
+}
+
+void test_from_iso_rejects() {
+  DateTime datetime(42);
+  for (const char* iso : {"", "2024", "2024-01-01", "2024-01-01T10:20", "2024-01-01 10:20:30", "2024-1-01T10:20:30",
+                          "2024-01-01T10:20:3x", "2024-13-01T10:20:30", "2023-02-29T10:20:30", "2024-01-01T24:00:00",
+                          "2024-01-01T10:60:30", "2024-01-01T10:20:30.", "2024-01-01T10:20:30+01",
+                          "2024-01-01T10:20:30+1:00", "2024-01-01T10:20:30Zx", "2024-01-01T10:20:30 "})
+    TEST_ASSERT_FALSE_MESSAGE(DateTime::from_iso(iso, datetime), iso);
+  TEST_ASSERT_TRUE(datetime == DateTime(42)); // Left untouched
+}
+
+void test_iso_round_trips() {
+  uint64_t state = 2;
+  for (int i = 0; i < 100000; i++) {
+    DateTime datetime(static_cast<int64_t>(next_random(state) % (int64_t{1} << 52))); // 1970 to 2112
+    TEST_ASSERT_TRUE(parse(iso(datetime).c_str()) == datetime);
+  }
+  for (int64_t us : {int64_t{0}, int64_t{-1}, DateTime(1900, 1, 1, 0, 0, 0).us, DateTime(2000, 2, 29, 0, 0, 0).us,
+                     DateTime(9999, 12, 31, 23, 59, 59, 999999).us})
+    TEST_ASSERT_TRUE(parse(iso(DateTime(us)).c_str()) == DateTime(us));
+}
+
+// ----------------------------------------------------------------------------
+// Benchmark
+// ----------------------------------------------------------------------------
+template <typename F>
+double ns_per_call(size_t calls, F&& call) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < calls; i++)
+    call(i);
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / calls;
+}
+
+void test_benchmark() {
+  constexpr size_t CALLS{1000000};
+  constexpr int64_t START_US{DateTime(2024, 1, 1, 0, 0, 0).us};
+  constexpr int64_t STEP_US{7919 * DateTime::US_PER_S + 123457}; // Spreads the calls over 250 years
+  volatile int64_t sink = 0;
+  char buffer[DateTime::ISO_LENGTH + 1];
+
+  double fields = ns_per_call(CALLS, [&](size_t i) { sink = sink + DateTime(START_US + i * STEP_US).fields().day; });
+  double civil = ns_per_call(CALLS, [&](size_t i) {
+    sink = sink + DateTime::days_from_civil(1970 + i % 400, 1 + i % 12, 1 + i % 28);
+  });
+  double to_iso = ns_per_call(CALLS, [&](size_t i) { sink = sink + DateTime(START_US + i * STEP_US).to_iso(buffer); });
+  DateTime(START_US).to_iso(buffer);
+  double from_iso = ns_per_call(CALLS, [&](size_t i) {
+    buffer[18] = static_cast<char>('0' + i % 10);
+    DateTime datetime;
+    sink = sink + DateTime::from_iso(buffer, datetime) + datetime.us;
+  });
+  double add = ns_per_call(CALLS, [&](size_t i) { sink = sink + (DateTime(sink) + i * STEP_US < DateTime(START_US)); });
+
+  printf("DateTime, ns per call on this host: fields() %.1f, days_from_civil() %.1f, to_iso() %.1f, from_iso() %.1f, "
+         "add and compare %.1f\n",
+         fields, civil, to_iso, from_iso, add);
+  TEST_ASSERT_TRUE(sink != 1); // Keeps the calls
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_leap_years);
+  RUN_TEST(test_month_lengths);
+  RUN_TEST(test_leap_days);
+  RUN_TEST(test_rollovers);
+  RUN_TEST(test_every_day_round_trips);
+  RUN_TEST(test_epoch_boundaries);
+  RUN_TEST(test_matches_libc);
+  RUN_TEST(test_to_iso);
+  RUN_TEST(test_from_iso);
+  RUN_TEST(test_from_iso_rejects);
+  RUN_TEST(test_iso_round_trips);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,317 @@
+//
+// Created by meltwin on 18/12/24.
+//
+// Host round-trip tests and compression benchmark of the series codec, run with:
+//   pio test -e native -f test_series_codec
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <unity.h>
+#include <vector>
+#include "Payload.hpp"
+#include "SeriesCodec.hpp"
+
+using meltwin::BitReader;
+using meltwin::BitWriter;
+using meltwin::Payload;
+using meltwin::PayloadBytes;
+using meltwin::SeriesDecoder;
+using meltwin::SeriesEncoder;
+
+void setUp() {}
+void tearDown() {}
+
+namespace {
+
+  struct Point {
+    time_t timestamp;
+    float value;
+  };
+
+  uint32_t bits_of(float value) {
+    uint32_t raw;
+    memcpy(&raw, &value, sizeof(raw));
+    return raw;
+  }
+
+  std::vector<uint8_t> encode(const std::vector<Point>& points) {
+    std::vector<uint8_t> buffer(SeriesEncoder::max_size(points.size()));
+    BitWriter bits(buffer.data(), buffer.size());
+    SeriesEncoder series(bits);
+    for (const auto& point : points)
+      series.add(point.timestamp, point.value);
+    TEST_ASSERT_FALSE(bits.overflowed());
+    TEST_ASSERT_EQUAL(points.size(), series.points());
+    buffer.resize(bits.size());
+    return buffer;
+  }
+
+  // Values are compared bit for bit, so that NaN, -0 and subnormals have to come back as they were sent
+  void assert_decodes_to(const std::vector<uint8_t>& encoded, const std::vector<Point>& points) {
+    BitReader bits(encoded.data(), encoded.size());
+    SeriesDecoder series(bits);
+    for (const auto& point : points) {
+      time_t timestamp;
+      float value;
+      TEST_ASSERT_TRUE(series.next(timestamp, value));
+      TEST_ASSERT_EQUAL_INT64(point.timestamp, timestamp);
+      TEST_ASSERT_EQUAL_HEX32(bits_of(point.value), bits_of(value));
+    }
+  }
+
+  void assert_round_trips(const std::vector<Point>& points) { assert_decodes_to(encode(points), points); }
+
+  // Same pseudo-random sequence on every run
+  uint32_t next_random(uint64_t& state) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return static_cast<uint32_t>(state >> 33);
+  }
+
+  // Readings of a sensor every wake (120 s, a few seconds of jitter), on a 12-bit ADC scale
+  std::vector<Point> sensor_series(uint64_t& state, size_t count, float scale, float start, float step) {
+    std::vector<Point> points;
+    time_t timestamp = 1767225600;
+    float level = start;
+    for (size_t i = 0; i < count; i++) {
+      timestamp += 120 + static_cast<time_t>(next_random(state) % 5) - 2;
+      level += step + static_cast<float>(next_random(state) % 9) / 4095.0f * scale - 4.0f / 4095.0f * scale;
+      points.push_back(Point{timestamp, std::round(level / scale * 4095.0f) / 4095.0f * scale});
+    }
+    return points;
+  }
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+// Round trips
+// ----------------------------------------------------------------------------
+void test_empty_series() {
+  TEST_ASSERT_EQUAL(0, encode({}).size());
+
+  // Nothing to decode
+  BitReader bits(nullptr, 0);
+  SeriesDecoder series(bits);
+  time_t timestamp;
+  float value;
+  TEST_ASSERT_FALSE(series.next(timestamp, value));
+}
+
+void test_one_point() {
+  std::vector<Point> points{{1767225600, 0.4217f}};
+  auto encoded = encode(points);
+  TEST_ASSERT_EQUAL(8, encoded.size()); // Stored as is
+  assert_decodes_to(encoded, points);
+}
+
+void test_regular_series() {
+  std::vector<Point> points;
+  for (time_t i = 0; i < 100; i++)
+    points.push_back(Point{1767225600 + 120 * i, 0.5f});
+  auto encoded = encode(points);
+  // The first interval is a change from 0, then one bit for the interval and one for the value
+  TEST_ASSERT_EQUAL((64 + (3 + 9 + 1) + 98 * 2 + 7) / 8, encoded.size());
+  assert_decodes_to(encoded, points);
+}
+
+void test_interval_changes() {
+  // Every width of interval change, at its bounds, both ways
+  const int64_t changes[]{0,    1,     -1,   63,    -64,   64,     -65,     255,        -256,      256,          -257,
+                          2047, -2048, 2048, -2049, 86400, -86400, 1 << 20, -(1 << 20), INT32_MAX, INT32_MIN + 1};
+  std::vector<Point> points{{1767225600, 1.0f}, {1767225720, 1.0f}};
+  int64_t interval = 120;
+  for (int64_t change : changes) {
+    // Keep the timestamps within 32 bits, turning back in time when the change would take them out
+    int64_t next = points.back().timestamp + interval + change;
+    interval = (next < 0 || next > UINT32_MAX) ? -interval : interval + change;
+    points.push_back(Point{static_cast<time_t>(points.back().timestamp + interval), 1.0f});
+  }
+  assert_round_trips(points);
+}
+
+void test_negative_intervals() {
+  // Readings out of order, e.g. after the clock was set back
+  assert_round_trips({{1767225600, 0.5f}, {1767225480, 0.5f}, {1767225360, 0.5f}, {1767225000, 0.6f},
+                      {1767226000, 0.6f}, {1767225999, 0.7f}});
+}
+
+void test_32_bit_fallback() {
+  // Interval changes that only fit in 32 bits: a month without readings, then back to a regular interval
+  std::vector<Point> points{{1767225600, 0.5f}, {1767225720, 0.5f}, {1767225720 + 30 * 86400, 0.5f},
+                            {1767225840 + 30 * 86400, 0.5f}, {1767225960 + 30 * 86400, 0.5f}};
+  assert_round_trips(points);
+  assert_round_trips({{0, 0.0f}, {UINT32_MAX, 0.0f}, {0, 0.0f}}); // Whole timestamp range, both ways
+}
+
+void test_special_values() {
+  const float values[]{0.0f,
+                       -0.0f,
+                       1.0f,
+                       -1.0f,
+                       std::numeric_limits<float>::quiet_NaN(),
+                       std::numeric_limits<float>::infinity(),
+                       -std::numeric_limits<float>::infinity(),
+                       std::numeric_limits<float>::denorm_min(),
+                       std::numeric_limits<float>::max(),
+                       std::numeric_limits<float>::lowest(),
+                       3.898182f,
+                       3.898183f,
+                       3.898183f,
+                       0.545152f};
+  std::vector<Point> points;
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    points.push_back(Point{static_cast<time_t>(1767225600 + 120 * i), values[i]});
+  assert_round_trips(points);
+}
+
+void test_several_series() {
+  // Laid out as APICaller::sendSeries does: sensor id and point count before each series
+  uint64_t state = 1;
+  std::vector<std::vector<Point>> sensors{sensor_series(state, 7, 6.0f, 3.9f, 0.0f), {},
+                                          sensor_series(state, 1, 1.0f, 0.5f, 0.0f),
+                                          sensor_series(state, 24, 1.0f, 0.7f, -0.002f)};
+  uint8_t buffer[SeriesEncoder::max_size(32) + 2 * 4];
+  BitWriter writer(buffer, sizeof(buffer));
+  for (size_t id = 0; id < sensors.size(); id++) {
+    writer.write(id, 8);
+    writer.write(sensors[id].size(), 8);
+    SeriesEncoder series(writer);
+    for (const auto& point : sensors[id])
+      series.add(point.timestamp, point.value);
+  }
+  TEST_ASSERT_FALSE(writer.overflowed());
+
+  BitReader reader(buffer, writer.size());
+  for (size_t id = 0; id < sensors.size(); id++) {
+    TEST_ASSERT_EQUAL(id, reader.read(8));
+    TEST_ASSERT_EQUAL(sensors[id].size(), reader.read(8));
+    SeriesDecoder series(reader);
+    for (const auto& point : sensors[id]) {
+      time_t timestamp;
+      float value;
+      TEST_ASSERT_TRUE(series.next(timestamp, value));
+      TEST_ASSERT_EQUAL_INT64(point.timestamp, timestamp);
+      TEST_ASSERT_EQUAL_HEX32(bits_of(point.value), bits_of(value));
+    }
+  }
+}
+
+void test_random_series() {
+  uint64_t state = 2;
+  for (int n = 0; n < 2000; n++) {
+    std::vector<Point> points;
+    time_t timestamp = next_random(state);
+    for (size_t i = 0, count = next_random(state) % 40; i < count; i++) {
+      uint32_t kind = next_random(state) % 4;
+      if (kind == 0)
+        timestamp = next_random(state); // Anywhere
+      else
+        timestamp = static_cast<time_t>(std::max<int64_t>(0, timestamp + next_random(state) % 4000 - 1000));
+      timestamp = std::min<time_t>(timestamp, UINT32_MAX);
+      // Any bits, or ADC-like values
+      uint32_t raw = (kind == 1) ? next_random(state) : bits_of(static_cast<float>(next_random(state) % 4096) / 4095);
+      float value;
+      memcpy(&value, &raw, sizeof(value));
+      points.push_back(Point{timestamp, value});
+    }
+    assert_round_trips(points);
+  }
+}
+
+void test_truncated_stream() {
+  std::vector<Point> points{{1767225600, 0.5f}, {1767225720, 0.7f}, {1767225840, 0.1f}};
+  auto encoded = encode(points);
+  encoded.resize(encoded.size() - 1);
+  BitReader bits(encoded.data(), encoded.size());
+  SeriesDecoder series(bits);
+  time_t timestamp;
+  float value;
+  TEST_ASSERT_TRUE(series.next(timestamp, value));
+  TEST_ASSERT_TRUE(series.next(timestamp, value));
+  TEST_ASSERT_FALSE(series.next(timestamp, value));
+
+  // The writer stops at its capacity instead
+  uint8_t small[4];
+  BitWriter writer(small, sizeof(small));
+  SeriesEncoder(writer).add(1767225600, 0.5f);
+  TEST_ASSERT_TRUE(writer.overflowed());
+}
+
+// ----------------------------------------------------------------------------
+// Benchmark
+// ----------------------------------------------------------------------------
+void test_compression_benchmark() {
+  // A flush chunk of typical readings (ReadingBuffer::FLUSH_CHUNK): battery, 3 plants drying slowly and the water level
+  uint64_t state = 3;
+  std::vector<std::vector<Point>> sensors{
+    sensor_series(state, 8, 6.0f, 3.9f, 0.0f),      sensor_series(state, 6, 1.0f, 0.55f, -0.001f),
+    sensor_series(state, 6, 1.0f, 0.63f, -0.0015f), sensor_series(state, 6, 1.0f, 0.72f, -0.0005f),
+    sensor_series(state, 6, 1.0f, 0.75f, -0.0002f)};
+  size_t points = 0;
+  for (const auto& sensor : sensors)
+    points += sensor.size();
+
+  // Baseline: the readings as form fields, as the record_batch endpoint takes them
+  static uint8_t form[8192];
+  Payload batch(form, sizeof(form));
+  size_t index = 0;
+  for (size_t id = 0; id < sensors.size(); id++)
+    for (const auto& point : sensors[id]) {
+      batch.add_item("readings", index, "sensor_id", id);
+      batch.add_item("readings", index, "value", point.value);
+      batch.add_item("readings", index, "timestamp", point.timestamp);
+      index++;
+    }
+  TEST_ASSERT_FALSE(batch.overflowed());
+
+  // Series stream, and the form field holding it in base64url
+  uint8_t encoded[SeriesEncoder::max_size(32) + 2 * 5];
+  double encode_ns = 0;
+  size_t stream_size = 0;
+  constexpr int RUNS{10000};
+  for (int run = 0; run < RUNS; run++) {
+    auto start = std::chrono::steady_clock::now();
+    BitWriter bits(encoded, sizeof(encoded));
+    for (size_t id = 0; id < sensors.size(); id++) {
+      bits.write(id, 8);
+      bits.write(sensors[id].size(), 8);
+      SeriesEncoder series(bits);
+      for (const auto& point : sensors[id])
+        series.add(point.timestamp, point.value);
+    }
+    encode_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    stream_size = bits.size();
+  }
+  static uint8_t field[1024];
+  Payload series_form(field, sizeof(field));
+  series_form.add_data("series_count", sensors.size());
+  series_form.add_data("series", PayloadBytes{encoded, stream_size});
+  TEST_ASSERT_FALSE(series_form.overflowed());
+
+  auto per_point = [&](size_t bytes) { return static_cast<double>(bytes) / static_cast<double>(points); };
+  printf("Series codec, %zu readings of %zu sensors: urlencoded %.1f B/point, series stream %.2f B/point "
+         "(%.1fx smaller), as a base64url field %.2f B/point (%.1fx smaller), encoding %.0f ns/point on this host\n",
+         points, sensors.size(), per_point(batch.size()), per_point(stream_size),
+         static_cast<double>(batch.size()) / stream_size, per_point(series_form.size()),
+         static_cast<double>(batch.size()) / series_form.size(), encode_ns / RUNS / points);
+  TEST_ASSERT_LESS_THAN(batch.size() / 4, series_form.size());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_series);
+  RUN_TEST(test_one_point);
+  RUN_TEST(test_regular_series);
+  RUN_TEST(test_interval_changes);
+  RUN_TEST(test_negative_intervals);
+  RUN_TEST(test_32_bit_fallback);
+  RUN_TEST(test_special_values);
+  RUN_TEST(test_several_series);
+  RUN_TEST(test_random_series);
+  RUN_TEST(test_truncated_stream);
+  RUN_TEST(test_compression_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,310 @@
+#!/usr/bin/env python3
+"""
+Local stand-in for the meltwin.fr plants API.
+
+Build the firmware with -DAPI_LOCAL_SERVER=\"<host>:<port>\" so that APICaller targets this server instead of the
+real one, then run:
+
+    python3 tools/mock_api_server.py --port 8080
+
+Every request is logged with its size so that protocol changes can be compared. With --quiet (load tests), only a
+summary per path is printed when the server is stopped.
+"""
+
+import argparse
+import base64
+import json
+import re
+import secrets
+import struct
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qsl
+
+USERS = {"plant01": "plt01_access"}
+TOKENS = set()
+
+# Error codes, mirrored from meltwin::APIErrors
+NO_ERROR = 0
+MISSING_ARGUMENTS = 210
+UNKNOWN_API_PATH = 300
+INVALID_CREDENTIALS = 500
+INVALID_TOKEN = 510
+
+# Per request logging, turned off by --quiet for load tests
+VERBOSE = True
+STATS = {}  # Path: [requests, bytes in, bytes out]
+STATS_LOCK = threading.Lock()
+
+READING_KEY = re.compile(r"readings\[(\d+)\]\[(\w+)\]")
+PROFILE_KEY = re.compile(r"profile\[(\d+)\]\[(\w+)\]")
+
+
+def decode_cbor(data):
+    """Decode the subset of CBOR written by meltwin::Payload (map of text keys to ints, floats, texts and bytes).
+
+    Byte strings are returned as base64url text, as they are sent in forms.
+    """
+
+    def item(pos):
+        head = data[pos]
+        major, info = head >> 5, head & 0x1F
+        pos += 1
+        if head == 0xFA:
+            return struct.unpack(">f", data[pos:pos + 4])[0], pos + 4
+        if head == 0xBF:
+            result = {}
+            while data[pos] != 0xFF:
+                key, pos = item(pos)
+                result[key], pos = item(pos)
+            return result, pos + 1
+        if info < 24:
+            value = info
+        else:
+            size = 1 << (info - 24)
+            value = int.from_bytes(data[pos:pos + size], "big")
+            pos += size
+        if major == 0:
+            return value, pos
+        if major == 1:
+            return -1 - value, pos
+        if major == 2:
+            return base64.urlsafe_b64encode(data[pos:pos + value]).decode().rstrip("="), pos + value
+        if major == 3:
+            return data[pos:pos + value].decode(), pos + value
+        raise ValueError(f"Unsupported CBOR head 0x{head:02x}")
+
+    return {key: str(value) for key, value in item(0)[0].items()}
+
+
+class BitReader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def read(self, bits):
+        value = 0
+        for _ in range(bits):
+            byte = self.data[self.pos // 8] if self.pos // 8 < len(self.data) else 0
+            value = (value << 1) | ((byte >> (7 - self.pos % 8)) & 1)
+            self.pos += 1
+        return value
+
+    def read_signed(self, bits):
+        value = self.read(bits)
+        return value - (1 << bits) if value & (1 << (bits - 1)) else value
+
+
+def decode_series(bits, count):
+    """Decode a series written by meltwin::SeriesEncoder into a list of (timestamp, value)."""
+    points = []
+    timestamp, raw, delta, leading, trailing = 0, 0, 0, 0, 0
+    for index in range(count):
+        if index == 0:
+            timestamp, raw = bits.read(32), bits.read(32)
+        else:
+            # '0', '10' + 7 bits, '110' + 9 bits, '1110' + 12 bits or '1111' + 32 bits
+            if bits.read(1):
+                for width in (7, 9, 12, 32):
+                    if width == 32 or not bits.read(1):
+                        delta += bits.read_signed(width)
+                        break
+            timestamp = (timestamp + delta) & 0xFFFFFFFF
+            # '0', '10' + bits within the previous window or '11' + new window + bits
+            if bits.read(1):
+                if bits.read(1):
+                    leading = bits.read(5)
+                    trailing = 32 - leading - (bits.read(5) + 1)
+                raw ^= bits.read(32 - leading - trailing) << trailing
+        points.append((timestamp, struct.unpack(">f", raw.to_bytes(4, "big"))[0]))
+    return points
+
+
+def log(text):
+    if VERBOSE:
+        print(text)
+
+
+def error(code, msg=""):
+    return {"err_code": code, "err_msg": msg}
+
+
+def check_token(form):
+    return form.get("token") in TOKENS
+
+
+def login(form):
+    if USERS.get(form.get("username")) != form.get("password"):
+        return error(INVALID_CREDENTIALS, "Invalid credentials")
+    token = secrets.token_hex(16)
+    TOKENS.add(token)
+    return {"err_code": NO_ERROR, "token": token}
+
+
+def record(form):
+    if not check_token(form):
+        return error(INVALID_TOKEN, "Invalid token")
+    if "sensor_id" not in form or "value" not in form:
+        return error(MISSING_ARGUMENTS, "Missing sensor_id or value")
+    log(f"  sensor {form['sensor_id']} = {form['value']}")
+    return error(NO_ERROR)
+
+
+def print_profile(form):
+    profile = {}
+    for key, value in form.items():
+        match = PROFILE_KEY.fullmatch(key)
+        if match:
+            profile.setdefault(int(match.group(1)), {})[match.group(2)] = value
+    if profile:
+        log(f"  profile over {form.get('profile_wakes', '?')} wakes (us), "
+            f"{form.get('profile_forced_sleeps', 0)} forced to sleep:")
+        if "profile_wifi_fast" in form:
+            log(f"    connects   {form['profile_wifi_fast']} fast, {form.get('profile_wifi_fallback', 0)} fallbacks, "
+                f"{form.get('profile_wifi_cold', 0)} cold, {form.get('profile_wifi_failures', 0)} failures")
+    for index in sorted(profile):
+        phase = profile[index]
+        log(f"    {phase.get('phase', '?'):<10} n={phase.get('count', '?'):<4} min={phase.get('min_us', '?'):<9} "
+              f"mean={phase.get('mean_us', '?'):<9} p95={phase.get('p95_us', '?'):<9} max={phase.get('max_us', '?'):<9} "
+              f"heap={phase.get('heap_blocks', '?'):<3} over={phase.get('overruns', 0)}")
+
+
+def record_batch(form):
+    if not check_token(form):
+        return error(INVALID_TOKEN, "Invalid token")
+
+    readings = {}
+    for key, value in form.items():
+        match = READING_KEY.fullmatch(key)
+        if match:
+            readings.setdefault(int(match.group(1)), {})[match.group(2)] = value
+
+    results = []
+    for index in range(int(form.get("count", len(readings)))):
+        item = readings.get(index, {})
+        if "sensor_id" in item and "value" in item:
+            log(f"  sensor {item['sensor_id']} = {item['value']} @ {item.get('timestamp', '?')}")
+            results.append({"sensor_id": int(item["sensor_id"]), "err_code": NO_ERROR})
+        else:
+            results.append({"sensor_id": -1, "err_code": MISSING_ARGUMENTS})
+    print_profile(form)
+    return {"err_code": NO_ERROR, "results": results}
+
+
+def get_cmd(form):
+    if not check_token(form):
+        return error(INVALID_TOKEN, "Invalid token")
+    return {"err_code": NO_ERROR, "pump_id": int(form.get("pump_id", 0)), "duration": 0.0, "pwm": 0}
+
+
+def get_cmds(form):
+    if not check_token(form):
+        return error(INVALID_TOKEN, "Invalid token")
+    count = int(form.get("count", 0))
+    return {"err_code": NO_ERROR, "cmds": [{"pump_id": i, "duration": 0.0, "pwm": 0} for i in range(count)]}
+
+
+def record_series(form):
+    if not check_token(form):
+        return error(INVALID_TOKEN, "Invalid token")
+    if "series_count" not in form or "series" not in form:
+        return error(MISSING_ARGUMENTS, "Missing series")
+
+    # For each sensor: id (8 bits), number of readings (8 bits) and readings. Results are given in the same order.
+    text = form["series"]
+    bits = BitReader(base64.urlsafe_b64decode(text + "=" * (-len(text) % 4)))
+    results = []
+    for _ in range(int(form["series_count"])):
+        sensor_id, count = bits.read(8), bits.read(8)
+        for timestamp, value in decode_series(bits, count):
+            log(f"  sensor {sensor_id} = {value:.6f} @ {timestamp}")
+            results.append({"sensor_id": sensor_id, "err_code": NO_ERROR})
+    print_profile(form)
+    return {"err_code": NO_ERROR, "results": results}
+
+
+def done_batch(form):
+    if not check_token(form):
+        return error(INVALID_TOKEN, "Invalid token")
+    for key, value in sorted(form.items()):
+        if key.startswith("runs["):
+            log(f"  {key} = {value}")
+    return error(NO_ERROR)
+
+
+def done(form):
+    if not check_token(form):
+        return error(INVALID_TOKEN, "Invalid token")
+    return error(NO_ERROR)
+
+
+ROUTES = {
+    "/api/auth/login": login,
+    "/api/plants/record": record,
+    "/api/plants/record_batch": record_batch,
+    "/api/plants/record_series": record_series,
+    "/api/plants/get_cmd": get_cmd,
+    "/api/plants/done": done,
+    "/api/plants/get_cmds": get_cmds,
+    "/api/plants/done_batch": done_batch,
+}
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def do_POST(self):
+        length = int(self.headers.get("Content-Length", 0))
+        body = self.rfile.read(length)
+        if self.headers.get("Content-Type") == "application/cbor":
+            form = decode_cbor(body)
+        else:
+            form = dict(parse_qsl(body.decode("ascii")))
+
+        route = ROUTES.get(self.path)
+        response = route(form) if route else error(UNKNOWN_API_PATH, "Unknown API path")
+        data = json.dumps(response).encode()
+        log(f"{self.path}: {length} B in, {len(data)} B out")
+        with STATS_LOCK:
+            stats = STATS.setdefault(self.path, [0, 0, 0])
+            stats[0] += 1
+            stats[1] += length
+            stats[2] += len(data)
+
+        self.send_response(200)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def log_message(self, format, *args):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Local stand-in for the plants API")
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--quiet", action="store_true", help="don't log each request, for load tests")
+    args = parser.parse_args()
+
+    global VERBOSE
+    VERBOSE = not args.quiet
+    server = ThreadingHTTPServer((args.host, args.port), Handler)
+    print(f"Serving plants API on {args.host}:{args.port}")
+    started = time.monotonic()
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+    # Load summary
+    elapsed = max(time.monotonic() - started, 1e-3)
+    for path, (count, received, sent) in sorted(STATS.items()):
+        print(f"{path}: {count} requests ({count / elapsed:.2f}/s), {received / count:.0f} B in, "
+              f"{sent / count:.0f} B out on average")
+
+
+if __name__ == "__main__":
+    main()